@@ -0,0 +1,74 @@
+#include "sqlitexx.h"
+#include "sqlxx_export.h"
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+
+#include <fcntl.h>
+
+void usage() {
+    std::cout << "options: {rows} [output, default /dev/null]\n";
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        usage();
+        return 1;
+    }
+    const long rows = std::atol(argv[1]);
+    const std::string output = argc > 2 ? argv[2] : "/dev/null";
+
+    auto con = sqlitexx::connection::create(":memory:");
+    if (!con) {
+        std::cout << "Can't open sqlite" << std::endl;
+        return 1;
+    }
+    con->query("CREATE TABLE bench(id INTEGER, name TEXT, price REAL, note TEXT)")->execute();
+    con->query("BEGIN")->execute();
+    for (long i = 0; i < rows; ++i) {
+        auto q = con->query("INSERT INTO bench VALUES(?, ?, ?, ?)");
+        (*q) << values(std::int64_t(i), "name " + std::to_string(i), i * 0.25,
+                       std::string(i % 7 ? "plain note" : "note, with \"quotes\""));
+        q->execute();
+    }
+    con->query("COMMIT")->execute();
+
+    auto run = [&](char const* name, sqlxx::export_stats (*fn)(sqlxx::cursor, int, sqlxx::export_options const&)) {
+        int fd = ::open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            std::cout << "Can't open " << output << std::endl;
+            return;
+        }
+        auto start = std::chrono::steady_clock::now();
+        auto stats = fn(con->query("SELECT * FROM bench")->execute(), fd, sqlxx::export_options());
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        ::close(fd);
+        std::cout << name << ": " << stats.rows << " rows, " << stats.bytes << " bytes, "
+                  << stats.bytes / elapsed.count() / (1 << 20) << " MB/s"
+                  << (stats.ok ? "" : " (write failed)") << std::endl;
+    };
+    run("csv", sqlxx::export_csv);
+    run("tsv", sqlxx::export_tsv);
+    run("jsonl", sqlxx::export_jsonl);
+
+    // toString() through an ostream, as before export writers
+    std::ofstream os(output);
+    auto start = std::chrono::steady_clock::now();
+    std::uint64_t bytes = 0;
+    for (auto const& row : con->query("SELECT * FROM bench")->execute()) {
+        std::string line;
+        for (auto const& field : row) {
+            if (!line.empty()) line += ',';
+            line += field.toString();
+        }
+        line += '\n';
+        bytes += line.size();
+        os << line;
+    }
+    os.flush();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "toString: " << bytes / elapsed.count() / (1 << 20) << " MB/s" << std::endl;
+    return 0;
+}
@@ -0,0 +1,48 @@
+#include "mysqlxx.h"
+#include "pqsqlxx.h"
+#include "sqlitexx.h"
+#include "sqlxx_copy.h"
+
+#include <iostream>
+
+void usage() {
+    std::cout << "usage: copy_table {source} {destination} {query} {table}\n";
+    std::cout << "source/destination: SQLITE {db}|MYSQL {host, user, pass, db}|PQSQL {conninfo}\n";
+}
+
+// connection of the backend at argv[i], i is moved past its arguments
+std::unique_ptr<sqlxx::connection> connect(int argc, char *argv[], int& i) {
+    if (i >= argc) return {};
+    const std::string type = argv[i++];
+    if (type == "SQLITE" && i + 1 <= argc) {
+        i += 1;
+        return sqlitexx::connection::create(argv[i - 1]);
+    } else if (type == "PQSQL" && i + 1 <= argc) {
+        i += 1;
+        return pqsqlxx::connection::create(argv[i - 1]);
+    } else if (type == "MYSQL" && i + 4 <= argc) {
+        i += 4;
+        return mysqlxx::connection::create(argv[i - 4], argv[i - 3], argv[i - 2], argv[i - 1]);
+    }
+    i = argc;
+    return {};
+}
+
+int main(int argc, char *argv[])
+{
+    int i = 1;
+    auto src = connect(argc, argv, i);
+    auto dst = connect(argc, argv, i);
+    if (!src || !dst || i + 2 != argc) {
+        usage();
+        return 1;
+    }
+    sqlxx::copy_options options;
+    options.progress = [](sqlxx::copy_progress const& progress) {
+        std::cerr << "\r" << progress.rows << " rows, " << std::uint64_t(progress.throughput()) << " rows/s";
+    };
+    auto stats = sqlxx::copy_table(*src, *dst, argv[i], argv[i + 1], options);
+    std::cerr << "\r" << stats.rows << " rows in " << stats.seconds << " s"
+              << (stats.ok ? "" : ", failed") << std::endl;
+    return stats.ok ? 0 : 1;
+}
@@ -29,6 +29,8 @@
 
 #include <mysql/mysql.h>
 #include <mysql/errmsg.h>
+#include <mysql/mysqld_error.h>
+#include <unordered_map>
 
 namespace mysqlxx {
 
@@ -67,7 +69,8 @@ public:
     else name_ = name;
     open_ = !!db_;
     if (open_) {
-      ::my_bool reconnect = 1; unsigned long trunc = 0;
+      // reconnect is done explicitly, server side state is lost with it
+      ::my_bool reconnect = 0; unsigned long trunc = 0;
       ::mysql_options(db_, MYSQL_OPT_RECONNECT, &reconnect);
       ::mysql_options(db_, MYSQL_REPORT_DATA_TRUNCATION, &trunc);
     }
@@ -86,6 +89,8 @@ public:
     sqlxx::connection_lock<::MYSQL> lock(mutex_, db_);
 #endif
     if (!open_) return;
+    for (auto& cached : cache_) ::mysql_stmt_close(cached.second);
+    cache_.clear();
     ::mysql_close(db_);
     open_ = false;
     db_   = nullptr;
@@ -104,6 +109,90 @@ public:
     ::mysql_query((*this)(), query.c_str());
   }
 
+  // take prepared statement out of the cache (call it with lock held)
+  int acquire(std::string const& query, ::MYSQL_STMT** stmt) const {
+    auto it = cache_.find(query);
+    if (it != cache_.end()) {
+      *stmt = it->second;
+      cache_.erase(it);
+      return 0;
+    }
+    if (!(*stmt = ::mysql_stmt_init(db_))) return CR_OUT_OF_MEMORY;
+    if (sqlxx::query_has_results(query.c_str())) {
+      unsigned long attr = CURSOR_TYPE_READ_ONLY,
+      rows = std::numeric_limits<unsigned long>::max();
+      ::mysql_stmt_attr_set(*stmt, STMT_ATTR_CURSOR_TYPE, &attr);
+      ::mysql_stmt_attr_set(*stmt, STMT_ATTR_PREFETCH_ROWS, &rows);
+    }
+    return ::mysql_stmt_prepare(*stmt, query.data(), query.size());
+  }
+
+  // give statement back to the cache, empty query means not cacheable
+  // (call it with lock held)
+  void release(std::string const& query, ::MYSQL_STMT* stmt, size_t generation) const {
+    if (!stmt) return;
+    if (!open_ || query.empty() || generation != generation_
+    ||  cache_.size() >= cache_size) {
+      ::mysql_stmt_close(stmt);
+      return;
+    }
+    ::mysql_stmt_free_result(stmt);
+    ::mysql_stmt_reset(stmt);
+    cache_.emplace(query, stmt);
+  }
+
+  // maximum number of idle prepared statements
+  static constexpr size_t cache_size = 64;
+
+  // open transaction levels (use it with lock held)
+  sqlxx::transaction_stack& transactions() const { return transactions_; }
+
+  // statements cached before reconnect are from older generation
+  inline size_t generation() const { return generation_; }
+
+  // statement run now and again after every reconnect
+  bool session(std::string const& query) {
+#ifdef USE_SHARED_CONNECTION
+    sqlxx::connection_lock<::MYSQL> lock(mutex_, db_);
+#endif
+    session_.push_back(query);
+    return open_ && ::mysql_query(db_, query.c_str()) == 0;
+  }
+
+  // reconnect policy
+  void reconnect(sqlxx::backoff const& policy) { backoff_ = policy; }
+
+  // returns true if error code means connection is lost
+  static bool is_lost(unsigned int err) {
+    return err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST;
+  }
+
+  // reconnect lost connection in place with backoff, session settings are
+  // applied again and cached statements are prepared lazily on next use
+  // (call it with lock held)
+  bool reconnect() const {
+    if (!open_) return false;
+    for (auto& cached : cache_) ::mysql_stmt_close(cached.second);
+    cache_.clear();
+    transactions_.reset();
+    ++generation_;
+    for (size_t attempt = 0; attempt < backoff_.attempts; ++attempt) {
+      backoff_.wait(attempt);
+      ::my_bool reconnect = 1;
+      ::mysql_options(db_, MYSQL_OPT_RECONNECT, &reconnect);
+      int err = ::mysql_ping(db_);
+      reconnect = 0;
+      ::mysql_options(db_, MYSQL_OPT_RECONNECT, &reconnect);
+      if (err) continue;
+      bool applied = true;
+      for (auto const& query : session_) {
+        applied = applied && ::mysql_query(db_, query.c_str()) == 0;
+      }
+      if (applied) return true;
+    }
+    return false;
+  }
+
 private:
   struct library_init {
     library_init() { ::mysql_library_init(0, nullptr, nullptr); }
@@ -112,26 +201,40 @@ private:
   ::MYSQL*          db_;    // associated db
   std::string       name_;  // db name
   bool              open_;  // db open status
+  mutable std::unordered_multimap<std::string, ::MYSQL_STMT*> cache_; // idle statements
+  mutable size_t    generation_ = 0; // reconnects counter
+  mutable sqlxx::transaction_stack transactions_; // BEGIN and savepoints
+  std::vector<std::string> session_; // session settings
+  sqlxx::backoff    backoff_;        // reconnect policy
 #ifdef USE_SHARED_CONNECTION
   mutable std::mutex mutex_;
 #endif
 };
 
+static inline
+result_type to_result(unsigned err) {
+  switch (err) {
+    case 0: return SQL_OK;
+    case CR_COMMANDS_OUT_OF_SYNC: return SQL_IMPROPER;
+    case CR_OUT_OF_MEMORY: return SQL_NO_MEMORY;
+    case CR_SERVER_GONE_ERROR:
+    case CR_SERVER_LOST: return SQL_SERVER_LOST;
+    case ER_LOCK_WAIT_TIMEOUT: return SQL_BUSY;
+    case ER_LOCK_DEADLOCK: return SQL_DEADLOCK;
+    case CR_UNKNOWN_ERROR:
+    default: return SQL_UNKNOWN_ERROR;
+  }
+}
+
 class statement : public sqlxx::statement {
 public:
-  statement(db const& db, ::MYSQL_STMT* stmt) : db_(db), res_(nullptr), stmt_(stmt) {
+  statement(db const& db, std::string const& query, ::MYSQL_STMT* stmt, size_t generation)
+    : db_(db), query_(query), generation_(generation), res_(nullptr), stmt_(stmt) {
 #ifdef USE_SHARED_CONNECTION
     auto&& lock = db_();
 #endif
-    switch(::mysql_stmt_errno(stmt_)) {
-      case 0: result_ = SQL_OK; break;
-      case CR_COMMANDS_OUT_OF_SYNC: result_ = SQL_IMPROPER; return;
-      case CR_OUT_OF_MEMORY: result_ = SQL_NO_MEMORY; return;
-      case CR_SERVER_GONE_ERROR:
-      case CR_SERVER_LOST: result_ = SQL_SERVER_LOST; return;
-      case CR_UNKNOWN_ERROR:
-      default: result_ = SQL_UNKNOWN_ERROR; return;
-    }
+    result_ = to_result(::mysql_stmt_errno(stmt_));
+    if (result_ != SQL_OK) return;
     if ((res_ = ::mysql_stmt_result_metadata(stmt_))) {
       num_ = ::mysql_num_fields(res_);
     }
@@ -146,16 +249,17 @@ public:
   statement& operator=(statement const&) = delete;
 
   ~statement() override {
+    detach();
 #ifdef USE_SHARED_CONNECTION
     auto&& lock = db_();
 #endif
     if (res_) ::mysql_free_result(res_);
-    ::mysql_stmt_close(stmt_);
+    db_.release(query_, stmt_, generation_);
   }
 
   sqlxx::row next() override {
+    detach();
     if (!res_ || !num_) return {};
-    sqlxx::row row;
     std::vector<MYSQL_BIND> mbinds(num_);
     for(auto &bind : mbinds) {
       bind.length = &bind.buffer_length;
@@ -166,109 +270,151 @@ public:
     ::mysql_stmt_bind_result(stmt_, mbinds.data());
     int res = ::mysql_stmt_fetch(stmt_);
     if (res == 1 || res == MYSQL_NO_DATA) return {};
+    if (lazy_) {
+      if (!names_) {
+        std::vector<std::string> names;
+        for (size_t i = 0; i < num_; ++i) names.emplace_back(::mysql_fetch_field_direct(res_, i)->org_name);
+        names_ = std::make_shared<std::vector<std::string> const>(std::move(names));
+      }
+      current_ = std::make_shared<source>(*this, std::move(mbinds));
+      return { current_ };
+    }
+    sqlxx::row row;
+    row.reserve(num_);
     for (size_t i = 0; i < num_; ++i) {
-      auto &bind = mbinds[i];
-      auto field = ::mysql_fetch_field_direct(res_, i);
-      switch (field->type)
-      {
+      row.push_back(column(mbinds[i], i, ::mysql_fetch_field_direct(res_, i)->org_name));
+    }
+    return row;
+  }
+
+  void first() override {
+    detach();
+#ifdef USE_SHARED_CONNECTION
+    auto&& lock = db_();
+#endif
+    ::mysql_stmt_data_seek(stmt_, 0);
+  }
+
+  result_type result() const override { return result_; };
+  std::uint64_t last_id() const override { return last_id_; };
+  std::uint64_t affected_rows() const override { return affected_rows_; };
+  void lazy(bool on) override { lazy_ = on; }
+
+private:
+  // fetch column of the current row, bind.length is set by the fetch
+  // (call it with lock held)
+  sqlxx::field_type column(MYSQL_BIND& bind, size_t i, std::string const& name) const {
+    auto field = ::mysql_fetch_field_direct(res_, i);
+    switch (field->type) {
       case MYSQL_TYPE_TINY: {
         char i8 = 0;
         bind.buffer_type = field->type;
         bind.buffer = reinterpret_cast<void *>(&i8);
         ::mysql_stmt_fetch_column(stmt_, &bind, i, 0);
-        row.emplace_back(std::int64_t(i8), field->org_name);
-      } break;
+        return { std::int64_t(i8), name };
+      }
       case MYSQL_TYPE_SHORT: {
         short i16 = 0;
         bind.buffer_type = field->type;
         bind.buffer = reinterpret_cast<void *>(&i16);
         ::mysql_stmt_fetch_column(stmt_, &bind, i, 0);
-        row.emplace_back(std::int64_t(i16), field->org_name);
-      } break;
+        return { std::int64_t(i16), name };
+      }
       case MYSQL_TYPE_INT24:
       case MYSQL_TYPE_LONG: {
         int i32 = 0;
         bind.buffer_type = field->type;
         bind.buffer = reinterpret_cast<void *>(&i32);
         ::mysql_stmt_fetch_column(stmt_, &bind, i, 0);
-        row.emplace_back(std::int64_t(i32), field->org_name);
-      } break;
+        return { std::int64_t(i32), name };
+      }
       case MYSQL_TYPE_LONGLONG: {
         std::int64_t i64 = 0;
         bind.buffer_type = field->type;
         bind.buffer = reinterpret_cast<void *>(&i64);
         ::mysql_stmt_fetch_column(stmt_, &bind, i, 0);
-        row.emplace_back(i64, field->org_name);
-      } break;
+        return { i64, name };
+      }
       case MYSQL_TYPE_FLOAT: {
         float f;
         bind.buffer_type = field->type;
         bind.buffer = reinterpret_cast<void *>(&f);
         ::mysql_stmt_fetch_column(stmt_, &bind, i, 0);
-        row.emplace_back(double(f), field->org_name);
-      } break;
+        return { double(f), name };
+      }
       case MYSQL_TYPE_DOUBLE: {
         double d;
         bind.buffer_type = field->type;
         bind.buffer = reinterpret_cast<void *>(&d);
         ::mysql_stmt_fetch_column(stmt_, &bind, i, 0);
-        row.emplace_back(d, field->org_name);
-      } break;
+        return { d, name };
+      }
       case MYSQL_TYPE_STRING: case MYSQL_TYPE_VAR_STRING:
       case MYSQL_TYPE_BLOB: if (field->charsetnr == 63) {
         blob v(bind.buffer_length);
         bind.buffer = const_cast<std::uint8_t *>(v.data());
         ::mysql_stmt_fetch_column(stmt_, &bind, i, 0);
-        row.emplace_back(std::move(v), field->org_name);
+        return sqlxx::field_type(std::move(v), name);
       } else {
         std::string s(bind.buffer_length, '\0');
         bind.buffer = const_cast<char *>(s.data());
         ::mysql_stmt_fetch_column(stmt_, &bind, i, 0);
-        row.emplace_back(std::move(s), field->org_name);
-      } break;
-      case MYSQL_TYPE_NULL:
-        row.emplace_back(field->org_name);
-        break;
-      default:
-        row.emplace_back(std::int64_t(0), field->org_name);
-        break;
+        return { std::move(s), name };
       }
+      case MYSQL_TYPE_NULL: return { name };
+      default: return { std::int64_t(0), name };
     }
-    return row;
   }
 
-  void first() override {
+  // columns of the current row, valid until the next fetch or seek
+  class source : public sqlxx::row_source {
+  public:
+    source(statement const& stmt, std::vector<MYSQL_BIND>&& mbinds)
+      : sqlxx::row_source(stmt.names_), stmt_(stmt), mbinds_(std::move(mbinds)) {}
+
+  protected:
+    sqlxx::field_type decode(size_t idx, std::string const& name) override {
 #ifdef USE_SHARED_CONNECTION
-    auto&& lock = db_();
+      auto&& lock = stmt_.db_();
 #endif
-    ::mysql_stmt_data_seek(stmt_, 0);
-  }
+      return stmt_.column(mbinds_[idx], idx, name);
+    }
 
-  result_type result() const override { return result_; };
-  std::uint64_t last_id() const override { return last_id_; };
-  std::uint64_t affected_rows() const override { return affected_rows_; };
+  private:
+    statement const& stmt_;
+    std::vector<MYSQL_BIND> mbinds_; // lengths point into it, never copied
+  };
+
+  // a row still referenced is decoded before the statement moves
+  void detach() {
+    if (current_ && current_.use_count() > 1) current_->detach();
+    current_.reset();
+  }
 
-private:
   db const& db_;
+  std::string query_;
+  size_t generation_;
   size_t num_ = 0;
   ::MYSQL_RES* res_;
   ::MYSQL_STMT* stmt_;
   result_type result_;
   std::uint64_t last_id_ = 0;
   std::uint64_t affected_rows_ = 0;
+  bool lazy_ = false;
+  std::shared_ptr<std::vector<std::string> const> names_;
+  std::shared_ptr<source> current_;
 };
 
 /*
- * Representation of a transaction
+ * Representation of a transaction, a nested one is a savepoint
  */
 class transaction {
 public:
-  transaction(::MYSQL* db) : db_(db) {
-    finished_ = !begin();
-  }
+  transaction(db const& db, ::MYSQL* handle)
+    : stack_(db.transactions()), db_(handle), level_(stack_.begin(exec(handle))) {}
 
-  transaction(transaction&& t) : db_(t.db_), finished_(t.finished_) {
-    t.finished_ = true;
+  transaction(transaction&& t) : stack_(t.stack_), db_(t.db_), level_(t.level_) {
+    t.level_ = 0;
   }
 
   ~transaction() { rollback(); }
@@ -277,28 +423,33 @@ public:
   transaction& operator=(transaction&&) = delete;
   transaction& operator=(transaction const&) = delete;
 
-  bool begin() {
-    int err = ::mysql_query(db_, "BEGIN;");
-    return err == 0;
-  }
+  // 0 if begin failed or it's finished
+  size_t level() const { return level_; }
 
   bool commit() {
-    if (finished_) return true;
-    int err = ::mysql_query(db_, "COMMIT;");
-    finished_ = err == 0;
-    return finished_;
+    if (!level_) return true;
+    if (stack_.commit(level_, exec(db_))) level_ = 0;
+    return !level_;
   }
 
   bool rollback() {
-    if (finished_) return true;
-    int err = ::mysql_query(db_, "ROLLBACK;");
-    finished_ = err == 0;
-    return finished_;
+    if (!level_) return true;
+    auto level = level_;
+    level_ = 0;
+    return stack_.rollback(level, exec(db_));
+  }
+
+  // statement runner of the transaction stack
+  static sqlxx::transaction_stack::exec_type exec(::MYSQL* db) {
+    return [db](char const* sql) {
+      return ::mysql_query(db, sql) ? to_result(::mysql_errno(db)) : SQL_OK;
+    };
   }
 
 private:
+  sqlxx::transaction_stack& stack_;
   ::MYSQL* db_;
-  bool finished_;
+  size_t level_;
 };
 
 class query : public sqlxx::query {
@@ -308,7 +459,7 @@ public:
   query(db const& db, std::string const& str) : sqlxx::query(str), db_(db) {}
 
 private:
-  int do_bind(::MYSQL_STMT* stmt, std::vector<sqlxx::field_type> binds) {
+  int do_bind(::MYSQL_STMT* stmt, std::vector<sqlxx::field_type> const& binds) {
     auto cnt = ::mysql_stmt_param_count(stmt);
     if (!cnt) return ::mysql_stmt_execute(stmt);
     std::vector<MYSQL_BIND> mbinds(cnt);
@@ -317,17 +468,15 @@ private:
       auto &mbind = mbinds[i];
       auto const& bind = binds[i];
       if (bind.type() == SQL_BLOB) {
-        std::string const& v = bind;
         mbind.buffer_type = MYSQL_TYPE_BLOB;
-        mbind.buffer = const_cast<char *>(v.data());
-        mbind.buffer_length = v.size();
+        mbind.buffer = const_cast<char *>(bind.data());
+        mbind.buffer_length = bind.size();
         mbind.is_unsigned = static_cast<::my_bool>(1);
       }
       else if (bind.type() == SQL_TEXT) {
-        std::string const& s = bind;
         mbind.buffer_type = MYSQL_TYPE_STRING;
-        mbind.buffer = const_cast<char *>(s.data());
-        mbind.buffer_length = s.size();
+        mbind.buffer = const_cast<char *>(bind.data());
+        mbind.buffer_length = bind.size();
       }
       else if (bind.type() == SQL_NULL) {
         mbind.buffer_type = MYSQL_TYPE_NULL;
@@ -359,23 +508,199 @@ private:
     return ::mysql_stmt_execute(stmt);
   }
 
+#if defined(MARIADB_PACKAGE_VERSION_ID) && MARIADB_PACKAGE_VERSION_ID >= 30000
+  // server runs an array of bind sets in one round trip, MariaDB since 10.2.6
+  static bool array_binds(::MYSQL* db) {
+    char const* info = ::mysql_get_server_info(db);
+    return ::mysql_get_server_version(db) >= 100206 && info && std::strstr(info, "MariaDB");
+  }
+
+  // adds types of a set's columns, false if one differs from the sets before
+  static bool same_types(std::vector<sql_type>& types, std::vector<sqlxx::field_type> const& set) {
+    auto valued = [](sql_type type) { return type != SQL_NULL && type != SQL_INVALID; };
+    if (types.size() < set.size()) types.resize(set.size(), SQL_NULL);
+    for (size_t i = 0; i < set.size(); ++i) {
+      auto type = set[i].type();
+      if (valued(type) && valued(types[i]) && types[i] != type) return false;
+    }
+    for (size_t i = 0; i < set.size(); ++i) {
+      if (valued(set[i].type())) types[i] = set[i].type();
+    }
+    return true;
+  }
+
+  // bind sets of the same types at once, by columns, NULL (and any
+  // other type) by indicator
+  unsigned do_bind_array(::MYSQL_STMT* stmt, std::vector<std::vector<sqlxx::field_type>> const& sets,
+                         std::vector<sql_type> const& types) {
+    auto cnt = ::mysql_stmt_param_count(stmt);
+    unsigned int size = unsigned(sets.size());
+    std::vector<MYSQL_BIND> mbinds(cnt);
+    std::vector<std::vector<char>> indicators(cnt, std::vector<char>(size, STMT_INDICATOR_NONE));
+    std::vector<std::vector<std::int64_t>> ints(cnt);
+    std::vector<std::vector<double>> floats(cnt);
+    std::vector<std::vector<char const*>> bytes(cnt);
+    std::vector<std::vector<unsigned long>> lengths(cnt);
+    for (size_t i = 0; i < cnt; ++i) {
+      auto& mbind = mbinds[i];
+      auto type = i < types.size() ? types[i] : SQL_NULL;
+      for (size_t s = 0; s < size; ++s) {
+        if (i >= sets[s].size() || sets[s][i].type() != type) indicators[i][s] = STMT_INDICATOR_NULL;
+      }
+      mbind.u.indicator = indicators[i].data();
+      if (type == SQL_INTEGER) {
+        ints[i].resize(size);
+        for (size_t s = 0; s < size; ++s) {
+          if (indicators[i][s] == STMT_INDICATOR_NONE) ints[i][s] = sets[s][i];
+        }
+        mbind.buffer_type = MYSQL_TYPE_LONGLONG;
+        mbind.buffer = ints[i].data();
+      }
+      else if (type == SQL_FLOAT) {
+        floats[i].resize(size);
+        for (size_t s = 0; s < size; ++s) {
+          if (indicators[i][s] == STMT_INDICATOR_NONE) floats[i][s] = sets[s][i];
+        }
+        mbind.buffer_type = MYSQL_TYPE_DOUBLE;
+        mbind.buffer = floats[i].data();
+      }
+      else if (type == SQL_TEXT || type == SQL_BLOB) {
+        // variable length columns are arrays of pointers and lengths
+        bytes[i].resize(size, nullptr);
+        lengths[i].resize(size, 0);
+        for (size_t s = 0; s < size; ++s) {
+          if (indicators[i][s] != STMT_INDICATOR_NONE) continue;
+          bytes[i][s] = sets[s][i].data();
+          lengths[i][s] = sets[s][i].size();
+        }
+        mbind.buffer_type = type == SQL_BLOB ? MYSQL_TYPE_BLOB : MYSQL_TYPE_STRING;
+        mbind.buffer = bytes[i].data();
+        mbind.length = lengths[i].data();
+      }
+      else {
+        mbind.buffer_type = MYSQL_TYPE_NULL;
+      }
+    }
+    unsigned err = 0;
+    if (::mysql_stmt_attr_set(stmt, STMT_ATTR_ARRAY_SIZE, &size)
+    ||  ::mysql_stmt_bind_param(stmt, mbinds.data())
+    ||  ::mysql_stmt_execute(stmt)) {
+      err = ::mysql_stmt_errno(stmt);
+      if (!err) err = CR_UNKNOWN_ERROR;
+    }
+    // statement is cached, 0 turns arrays off for the next run of one set
+    unsigned int reset = 0;
+    ::mysql_stmt_attr_set(stmt, STMT_ATTR_ARRAY_SIZE, &reset);
+    return err;
+  }
+#endif
+
   sqlxx::cursor execute_impl(char const* query, std::vector<sqlxx::field_type> bind) override {
+    std::string text;
+    size_t generation = 0;
+    bool retry = sqlxx::query_is_read(query);
     auto transaction_lock = [&]() {
       auto&& lock = db_();
-      transaction tr(lock);
-      ::MYSQL_STMT* stmt = ::mysql_stmt_init(lock);
-      if (sqlxx::query_has_results(query)) {
-        unsigned long attr = CURSOR_TYPE_READ_ONLY,
-        rows = std::numeric_limits<unsigned long>::max();
-        ::mysql_stmt_attr_set(stmt, STMT_ATTR_CURSOR_TYPE, &attr);
-        ::mysql_stmt_attr_set(stmt, STMT_ATTR_PREFETCH_ROWS, &rows);
+      // a read of an open transaction is not retried, the reconnect ended
+      // the transaction and the caller gets SQL_SERVER_LOST
+      retry = retry && db_.transactions().depth() == 0;
+      auto run = [&]() {
+        transaction tr(db_, lock);
+        text = query;
+        generation = db_.generation();
+        ::MYSQL_STMT* stmt = nullptr;
+        if (db_.acquire(text, &stmt) == 0) {
+          do_bind(stmt, bind) == 0 && tr.commit();
+        } else {
+          text.clear();
+        }
+        return stmt;
+      };
+      for (;;) {
+        auto* stmt = run();
+        bool lost = db::is_lost(stmt ? ::mysql_stmt_errno(stmt) : 0)
+                 || db::is_lost(::mysql_errno(lock));
+        if (!lost || !db_.reconnect() || !retry) return stmt;
+        // idempotent read is retried once on the new connection
+        db_.release(text, stmt, generation);
+        retry = false;
       }
-      if (::mysql_stmt_prepare(stmt, query, strlen(query)) == 0) {
-        do_bind(stmt, std::move(bind)) == 0 && tr.commit();
-      }
-      return stmt;
     };
-    return { std::make_shared<statement>(db_, transaction_lock()) };
+    auto* stmt = transaction_lock();
+    return { std::make_shared<statement>(db_, text, stmt, generation) };
+  }
+
+  // one prepared statement executed per set in one transaction, with
+  // MariaDB sets go in arrays unless rows are asked for per set (the
+  // server tells only the total of an array)
+  sqlxx::batch_result execute_many_impl(char const* query, bind_source const& next, bool per_set) override {
+    if (sqlxx::query_has_results(query)) {
+      return sqlxx::query::execute_many_impl(query, next, per_set);
+    }
+    sqlxx::batch_result result;
+    auto&& lock = db_();
+    transaction tr(db_, lock);
+    std::string text(query);
+    size_t generation = db_.generation();
+    ::MYSQL_STMT* stmt = nullptr;
+    unsigned err = db_.acquire(text, &stmt);
+    if (err) result.result = to_result(err);
+    std::vector<sqlxx::field_type> binds;
+    bool arrays = false;
+#if defined(MARIADB_PACKAGE_VERSION_ID) && MARIADB_PACKAGE_VERSION_ID >= 30000
+    arrays = !err && !per_set && array_binds(lock);
+    if (arrays) {
+      static constexpr size_t chunk = 1024;
+      std::vector<std::vector<sqlxx::field_type>> sets;
+      std::vector<sql_type> types;
+      // a chunk ends when it's full or a set changes the type of a column
+      auto flush = [&]() {
+        if (sets.empty()) return true;
+        err = do_bind_array(stmt, sets, types);
+        std::uint64_t rows = err ? 0 : ::mysql_stmt_affected_rows(stmt);
+        bool ok = result.add(to_result(err), rows, false);
+        if (ok) result.executed += sets.size() - 1;
+        err = 0;
+        sets.clear();
+        types.clear();
+        return ok;
+      };
+      bool ok = true;
+      while (ok && next(binds)) {
+        if (sets.size() == chunk || !same_types(types, binds)) {
+          ok = flush() && same_types(types, binds);
+        }
+        sets.emplace_back(std::move(binds));
+        binds.clear();
+      }
+      if (ok) flush();
+    }
+#endif
+    while (!arrays && !err && next(binds)) {
+      err = do_bind(stmt, binds) == 0 ? 0 : ::mysql_stmt_errno(stmt);
+      std::uint64_t rows = err ? 0 : ::mysql_stmt_affected_rows(stmt);
+      if (!result.add(to_result(err), rows, per_set)) break;
+      err = 0;
+      binds.clear();
+    }
+    if (result.result == SQL_OK && !tr.commit()) {
+      result.result = db_.transactions().result();
+    }
+    tr.rollback();
+    db::is_lost(::mysql_errno(lock)) && db_.reconnect();
+    db_.release(err ? std::string() : text, stmt, generation);
+    return result;
+  }
+
+  bool prepare_impl(char const* query) override {
+#ifdef USE_SHARED_CONNECTION
+    auto&& lock = db_();
+#endif
+    ::MYSQL_STMT* stmt = nullptr;
+    std::string text(query);
+    bool prepared = db_.acquire(text, &stmt) == 0;
+    db_.release(prepared ? text : std::string(), stmt, db_.generation());
+    return prepared;
   }
 
   db const& db_;
@@ -399,6 +724,31 @@ public:
     return std::unique_ptr<mysqlxx::query>{ new mysqlxx::query(db_, str) };
   }
 
+  bool session(std::string const& str) override { return db_.session(str); }
+  void reconnect(sqlxx::backoff const& policy) override { db_.reconnect(policy); }
+
+  size_t begin() override {
+    auto&& lock = db_();
+    return db_.transactions().begin(transaction::exec(lock));
+  }
+
+  bool commit(size_t level) override {
+    auto&& lock = db_();
+    return db_.transactions().commit(level, transaction::exec(lock));
+  }
+
+  bool rollback(size_t level) override {
+    auto&& lock = db_();
+    return db_.transactions().rollback(level, transaction::exec(lock));
+  }
+
+  result_type transaction_result() const override {
+#ifdef USE_SHARED_CONNECTION
+    auto&& lock = db_();
+#endif
+    return db_.transactions().result();
+  }
+
 private:
   db db_;
   connection(char const* host, char const* user, char const* pass, char const* name)
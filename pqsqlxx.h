@@ -28,7 +28,11 @@
 #include "sqlxx.h"
 
 #include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <poll.h>
 #include <libpq-fe.h>
+#include <unordered_map>
 
 namespace pqsqlxx {
 
@@ -46,14 +50,35 @@ private:
   ::PGresult* res_;
 };
 
+// failure by SQLSTATE, contention is told apart to be retried
+static inline
+result_type state_result(::PGresult const* res) {
+  char const* state = res ? ::PQresultErrorField(res, PG_DIAG_SQLSTATE) : nullptr;
+  if (!state) return SQL_UNKNOWN_ERROR;
+  if (!std::strcmp(state, "40001")) return SQL_SERIALIZATION;
+  if (!std::strcmp(state, "40P01")) return SQL_DEADLOCK;
+  if (!std::strcmp(state, "55P03")) return SQL_BUSY; // lock_not_available
+  return SQL_UNKNOWN_ERROR;
+}
+
 /*
  * Database class
  */
 class db {
 public:
   db(char const* conninfo) : db_(nullptr), open_(false) { open(conninfo); }
+  db(::PGconn* conn) : db_(conn), open_(!!conn) {
+    if (open_ && ::PQstatus(db_) != CONNECTION_OK) close();
+  }
   ~db() { close(); }
 
+  // server side prepared statement of a query
+  struct prepared {
+    std::string name;   // statement name, empty if not prepared
+    std::string cursor; // cursor name, empty if query has no results
+    size_t generation = 0; // connection generation it's prepared on
+  };
+
   // postgresql access
 #ifdef USE_SHARED_CONNECTION
   sqlxx::connection_lock<::PGconn> operator()() const {
@@ -84,6 +109,7 @@ public:
     sqlxx::connection_lock<::PGconn> lock(mutex_, db_);
 #endif
     if (!open_) return;
+    cache_.clear();
     ::PQfinish(db_);
     open_ = false;
     db_   = nullptr;
@@ -102,6 +128,82 @@ public:
   // database defragmentation
   void vacuum() { pqresult(::PQexec((*this)(), "VACUUM;")); }
 
+  // take prepared statement out of the cache (call it with lock held)
+  bool acquire(std::string const& query, prepared& stmt) const {
+    auto it = cache_.find(query);
+    if (it == cache_.end()) return false;
+    stmt = std::move(it->second);
+    cache_.erase(it);
+    return true;
+  }
+
+  // prepare built query on the server (call it with lock held)
+  bool prepare(std::string const& text, prepared& stmt) const {
+    std::stringstream s;
+    s << "sqlxx_" << ++prepared_;
+    pqresult res = ::PQprepare(db_, s.str().c_str(), text.c_str(), 0, nullptr);
+    if (!res || ::PQresultStatus(res) != PGRES_COMMAND_OK) return false;
+    stmt.name = s.str();
+    stmt.generation = generation_;
+    return true;
+  }
+
+  // give statement back to the cache, failed ones are deallocated
+  // since their plan may be stale (call it with lock held)
+  void release(std::string const& query, prepared stmt, bool ok = true) const {
+    if (stmt.name.empty() || !open_ || stmt.generation != generation_) return;
+    if (!ok || cache_.size() >= cache_size) {
+      pqresult(::PQexec(db_, ("DEALLOCATE " + stmt.name).c_str()));
+      return;
+    }
+    cache_.emplace(query, std::move(stmt));
+  }
+
+  // maximum number of idle prepared statements
+  static constexpr size_t cache_size = 64;
+
+  // open transaction levels (use it with lock held)
+  sqlxx::transaction_stack& transactions() const { return transactions_; }
+
+  // statements cached before reconnect are from older generation
+  inline size_t generation() const { return generation_; }
+
+  // statement run now and again after every reconnect
+  bool session(std::string const& query) {
+#ifdef USE_SHARED_CONNECTION
+    sqlxx::connection_lock<::PGconn> lock(mutex_, db_);
+#endif
+    session_.push_back(query);
+    if (!open_) return false;
+    pqresult res = ::PQexec(db_, query.c_str());
+    return res && ::PQresultStatus(res) == PGRES_COMMAND_OK;
+  }
+
+  // reconnect policy
+  void reconnect(sqlxx::backoff const& policy) { backoff_ = policy; }
+
+  // reconnect lost connection in place with backoff, session settings are
+  // applied again and cached statements are prepared lazily on next use
+  // (call it with lock held)
+  bool reconnect() const {
+    if (!open_) return false;
+    cache_.clear();
+    transactions_.reset();
+    ++generation_;
+    for (size_t attempt = 0; attempt < backoff_.attempts; ++attempt) {
+      backoff_.wait(attempt);
+      ::PQreset(db_);
+      if (::PQstatus(db_) != CONNECTION_OK) continue;
+      bool applied = true;
+      for (auto const& query : session_) {
+        pqresult res = ::PQexec(db_, query.c_str());
+        applied = applied && res && ::PQresultStatus(res) == PGRES_COMMAND_OK;
+      }
+      if (applied) return true;
+    }
+    return false;
+  }
+
 private:
   db(db&&) = delete;            // no move
   db(db const&) = delete;       // no copy
@@ -111,6 +213,12 @@ private:
 private:
   ::PGconn*           db_; // associated db
   bool              open_; // db open status
+  mutable size_t prepared_ = 0; // prepared statements counter
+  mutable std::unordered_multimap<std::string, prepared> cache_; // idle statements
+  mutable size_t generation_ = 0; // reconnects counter
+  mutable sqlxx::transaction_stack transactions_; // BEGIN and savepoints
+  std::vector<std::string> session_; // session settings
+  sqlxx::backoff backoff_;        // reconnect policy
 #ifdef USE_SHARED_CONNECTION
   mutable std::mutex mutex_;
 #endif
@@ -118,7 +226,10 @@ private:
 
 class statement : public sqlxx::statement {
 public:
-  statement(db const& db, pqresult res, std::string const& cur) : db_(db) {
+  statement(db const& db, pqresult res, std::string const& query,
+            db::prepared stmt, bool lost = false)
+    : db_(db), query_(query), stmt_(std::move(stmt)) {
+    auto const& cur = stmt_.cursor;
     result_ = SQL_NO_MEMORY;
     if (!res) return;
     switch(::PQresultStatus(res)) {
@@ -126,9 +237,10 @@ public:
       case PGRES_NONFATAL_ERROR: result_ = SQL_OK; break;
       case PGRES_BAD_RESPONSE: result_ = SQL_UNKNOWN_ERROR; return;
       case PGRES_EMPTY_QUERY: result_ = SQL_IMPROPER; return;
-      case PGRES_FATAL_ERROR: if (::PQstatus(db_()) != CONNECTION_OK) {
+      case PGRES_FATAL_ERROR: if (lost || ::PQstatus(db_()) != CONNECTION_OK) {
         result_ = SQL_SERVER_LOST; return;
-      } // fallthrough
+      }
+      result_ = state_result(res); return;
       default: result_ = SQL_UNKNOWN_ERROR; return;
     }
     close_ = "CLOSE " + cur;
@@ -144,52 +256,28 @@ public:
   statement& operator=(statement const&) = delete;
 
   ~statement() override {
-    if (close_.empty()) return;
-    pqresult(::PQexec(db_(), close_.c_str()));
+    auto&& lock = db_();
+    if (!close_.empty()) pqresult(::PQexec(lock, close_.c_str()));
+    db_.release(query_, std::move(stmt_), result_ == SQL_OK);
   }
 
   sqlxx::row next() override {
     if (fetch_next_.empty()) return {};
     pqresult res = ::PQexec(db_(), fetch_next_.c_str());
     if (!res) return {};
-    sqlxx::row row;
-    if (::PQresultStatus(res) == PGRES_TUPLES_OK && ::PQntuples(res) > 0)
-    for (int i = 0; i < ::PQnfields(res); ++i) {
-      auto *name = PQfname(res, i);
-      if (::PQgetisnull(res, 0, i)) {
-        row.emplace_back(name);
-        continue;
-      }
-      // binary format is unsupported
-      if (::PQfformat(res, i)) continue;
-      auto const* data = ::PQgetvalue(res, 0, i);
-      size_t const len = ::PQgetlength(res, 0, i);
-      if (!len || !data) {
-        row.emplace_back(name);
-        continue;
-      }
-      if (len > 1 && data[0] == '\\' && data[1] == 'x') {
-        std::string str;
-        for (size_t i = 2; i < len; i += 2) {
-          char buf[3] = { data[i], data[i+1] };
-          str.push_back(char(std::strtol(buf, nullptr, 16)));
-        }
-        row.emplace_back(blob(std::move(str)), name);
-        continue;
-      }
-      char *end = nullptr;
-      double d = std::strtod(data, &end);
-      if (data == end) {
-        row.emplace_back(std::string(data, len), name);
-        continue;
+    if (::PQresultStatus(res) != PGRES_TUPLES_OK || ::PQntuples(res) < 1) return {};
+    int const count = ::PQnfields(res);
+    if (lazy_) {
+      if (!names_) {
+        std::vector<std::string> names;
+        for (int i = 0; i < count; ++i) names.emplace_back(::PQfname(res, i));
+        names_ = std::make_shared<std::vector<std::string> const>(std::move(names));
       }
-      if (strchr(data, '.') || strchr(data, ',')) {
-        row.emplace_back(d, name);
-        continue;
-      }
-      std::int64_t i64 = std::strtoll(data, nullptr, 10);
-      row.emplace_back(i64, name);
+      return { std::make_shared<source>(std::move(res), names_) };
     }
+    sqlxx::row row;
+    row.reserve(count);
+    for (int i = 0; i < count; ++i) row.push_back(column(res, i, ::PQfname(res, i)));
     return row;
   }
 
@@ -201,28 +289,69 @@ public:
   result_type result() const override { return result_; };
   std::uint64_t last_id() const override { return last_id_; };
   std::uint64_t affected_rows() const override { return affected_rows_; };
+  void lazy(bool on) override { lazy_ = on; }
 
 private:
+  // text of a column is told apart as NULL, bytea, text, float or integer,
+  // binary format is unsupported and reads as NULL so columns keep their places
+  static sqlxx::field_type column(::PGresult* res, int i, std::string const& name) {
+    if (::PQgetisnull(res, 0, i) || ::PQfformat(res, i)) return { name };
+    auto const* data = ::PQgetvalue(res, 0, i);
+    size_t const len = ::PQgetlength(res, 0, i);
+    if (!len || !data) return { name };
+    if (len > 1 && data[0] == '\\' && data[1] == 'x') {
+      std::string str;
+      for (size_t i = 2; i < len; i += 2) {
+        char buf[3] = { data[i], data[i+1] };
+        str.push_back(char(std::strtol(buf, nullptr, 16)));
+      }
+      return sqlxx::field_type(blob(std::move(str)), name);
+    }
+    char *end = nullptr;
+    double d = std::strtod(data, &end);
+    if (data == end) return { std::string(data, len), name };
+    if (strchr(data, '.') || strchr(data, ',')) return { d, name };
+    return { std::int64_t(std::strtoll(data, nullptr, 10)), name };
+  }
+
+  // owns the fetched row
+  class source : public sqlxx::row_source {
+  public:
+    source(pqresult res, std::shared_ptr<std::vector<std::string> const> names)
+      : sqlxx::row_source(std::move(names)), res_(std::move(res)) {}
+
+  protected:
+    sqlxx::field_type decode(size_t idx, std::string const& name) override {
+      return column(res_, int(idx), name);
+    }
+
+  private:
+    pqresult res_;
+  };
+
   db const& db_;
+  std::string query_;
+  db::prepared stmt_;
   std::string close_;
   result_type result_;
   std::string fetch_next_;
   std::string move_first_;
   std::uint64_t last_id_ = 0;
   std::uint64_t affected_rows_ = 0;
+  bool lazy_ = false;
+  std::shared_ptr<std::vector<std::string> const> names_;
 };
 
 /*
- * Representation of a transaction
+ * Representation of a transaction, a nested one is a savepoint
  */
 class transaction {
 public:
-  transaction(::PGconn* db) : db_(db) {
-    finished_ = !begin();
-  }
+  transaction(db const& db, ::PGconn* handle)
+    : stack_(db.transactions()), db_(handle), level_(stack_.begin(exec(handle))) {}
 
-  transaction(transaction&& t) : db_(t.db_), finished_(t.finished_) {
-    t.finished_ = true;
+  transaction(transaction&& t) : stack_(t.stack_), db_(t.db_), level_(t.level_) {
+    t.level_ = 0;
   }
 
   ~transaction() { rollback(); }
@@ -231,28 +360,40 @@ public:
   transaction& operator=(transaction&&) = delete;
   transaction& operator=(transaction const&) = delete;
 
-  bool begin() {
-    pqresult res = ::PQexec(db_, "BEGIN;");
-    return res && ::PQresultStatus(res) == PGRES_COMMAND_OK;
-  }
+  // 0 if begin failed or it's finished
+  size_t level() const { return level_; }
 
   bool commit() {
-    if (finished_) return true;
-    pqresult res = ::PQexec(db_, "COMMIT;");
-    finished_ = res && ::PQresultStatus(res) == PGRES_COMMAND_OK;
-    return finished_;
+    if (!level_) return true;
+    if (stack_.commit(level_, exec(db_))) level_ = 0;
+    return !level_;
   }
 
   bool rollback() {
-    if (finished_) return true;
-    pqresult res = ::PQexec(db_, "ROLLBACK;");
-    finished_ = res && ::PQresultStatus(res) == PGRES_COMMAND_OK;
-    return finished_;
+    if (!level_) return true;
+    auto level = level_;
+    level_ = 0;
+    return stack_.rollback(level, exec(db_));
+  }
+
+  // statement runner of the transaction stack
+  static sqlxx::transaction_stack::exec_type exec(::PGconn* db) {
+    // COMMIT of a failed transaction is a ROLLBACK
+    return [db](char const* sql) -> result_type {
+      pqresult res = ::PQexec(db, sql);
+      if (!res) return SQL_NO_MEMORY;
+      if (::PQresultStatus(res) != PGRES_COMMAND_OK) {
+        return ::PQstatus(db) == CONNECTION_OK ? state_result(res) : SQL_SERVER_LOST;
+      }
+      bool rolled_back = !std::strncmp(sql, "COMMIT", 6) && std::strcmp(::PQcmdStatus(res), "COMMIT");
+      return rolled_back ? SQL_UNKNOWN_ERROR : SQL_OK;
+    };
   }
 
 private:
+  sqlxx::transaction_stack& stack_;
   ::PGconn* db_;
-  bool finished_;
+  size_t level_;
 };
 
 class query : public sqlxx::query {
@@ -266,15 +407,21 @@ private:
     using namespace std::regex_constants;
     std::regex blob("\\b(BLOB)\\b", ECMAScript | icase);
     query = std::regex_replace(query, blob, "BYTEA");
-    char buf[16] = {};
-    std::stringstream r;
-    size_t pos = 0, cnt = 0;
-    r.rdbuf()->pubsetbuf(buf, 15);
-    while ((pos = query.find('?')) != query.npos) {
-      r << '$' << ++cnt;
-      query.replace(pos, 1, buf);
-      r.seekp(0);
+    // ? in string literals is not a placeholder (as counted by SQLXX_SQL)
+    std::string numbered;
+    numbered.reserve(query.size() + 16);
+    size_t cnt = 0;
+    bool quoted = false;
+    for (char c : query) {
+      if (c == '\'') quoted = !quoted;
+      if (c != '?' || quoted) {
+        numbered += c;
+        continue;
+      }
+      numbered += '$';
+      numbered += std::to_string(++cnt);
     }
+    query = std::move(numbered);
     if (sqlxx::query_has_results(query.c_str())) {
 #ifdef USE_SHARED_CONNECTION
       static std::atomic<size_t> i(0);
@@ -289,61 +436,300 @@ private:
     return query;
   }
 
+  // text goes in place, blobs in binary format, only numbers are formatted
+  struct params {
+    std::vector<int> formats;
+    std::vector<int> lengths;
+    std::vector<std::string> numbers;
+    std::vector<char const*> values;
+
+    params(std::vector<sqlxx::field_type> const& binds) {
+      numbers.reserve(binds.size());
+      for (auto const& bind : binds) {
+        switch (bind.type()) {
+          case SQL_INTEGER: case SQL_FLOAT: {
+            char num[32];
+            if (bind.type() == SQL_INTEGER) {
+              std::snprintf(num, sizeof(num), "%lld", static_cast<long long>(std::int64_t(bind)));
+            } else {
+              std::snprintf(num, sizeof(num), "%.17g", double(bind));
+            }
+            numbers.push_back(num);
+            values.push_back(numbers.back().c_str());
+            lengths.push_back(numbers.back().size());
+            formats.push_back(0);
+          } break;
+          case SQL_TEXT: case SQL_BLOB: {
+            values.push_back(bind.data());
+            lengths.push_back(bind.size());
+            formats.push_back(bind.type() == SQL_BLOB ? 1 : 0);
+          } break;
+          case SQL_NULL: default: {
+            values.push_back(nullptr);
+            lengths.push_back(0);
+            formats.push_back(0);
+          } break;
+        }
+      }
+    }
+
+    int size() const { return int(values.size()); }
+  };
+
   sqlxx::cursor execute_impl(char const* query, std::vector<sqlxx::field_type> binds) override {
-    std::string cursor;
-    auto q = pq_build_query(query, cursor);
-    if (binds.empty()) {
-      auto trasaction_lock = [&]() {
-        auto&& lock = db_();
-        transaction tr(lock);
-        auto* res = ::PQexec(lock, q.c_str());
+    params param(binds);
+    db::prepared stmt;
+    bool lost = false;
+    bool retry = sqlxx::query_is_read(query);
+    auto trasaction_lock = [&]() {
+      auto&& lock = db_();
+      // a read of an open transaction is not retried, the reconnect ended
+      // the transaction and the caller gets SQL_SERVER_LOST
+      retry = retry && db_.transactions().depth() == 0;
+      auto run = [&]() {
+        std::string q;
+        if (!db_.acquire(query, stmt)) {
+          q = pq_build_query(query, stmt.cursor);
+          db_.prepare(q, stmt);
+        }
+        transaction tr(db_, lock);
+        ::PGresult* res;
+        if (!stmt.name.empty()) {
+          res = ::PQexecPrepared(lock, stmt.name.c_str(), binds.size(),
+                                 param.values.data(), param.lengths.data(),
+                                 param.formats.data(), 0);
+        } else if (binds.empty()) {
+          // i.e. multiple commands can't be prepared
+          res = ::PQexec(lock, q.c_str());
+        } else {
+          res = ::PQexecParams(lock, q.c_str(), binds.size(), nullptr,
+                               param.values.data(), param.lengths.data(),
+                               param.formats.data(), 0);
+        }
         res && ::PQresultStatus(res) == PGRES_COMMAND_OK && tr.commit();
         return res;
       };
-      return { std::make_shared<statement>(db_, trasaction_lock(), cursor) };
+      for (;;) {
+        auto* res = run();
+        if (::PQstatus(lock) == CONNECTION_OK) return res;
+        lost = true;
+        if (!db_.reconnect() || !retry) return res;
+        // idempotent read is retried once on the new connection
+        ::PQclear(res);
+        stmt = {};
+        retry = false;
+      }
+    };
+    auto* res = trasaction_lock();
+    return { std::make_shared<statement>(db_, res, query, std::move(stmt), lost) };
+  }
+
+  // one prepared statement for all sets in one transaction, pipelined
+  // where libpq supports it, so sets don't wait a round trip each
+  sqlxx::batch_result execute_many_impl(char const* query, bind_source const& next, bool per_set) override {
+    if (sqlxx::query_has_results(query)) {
+      return sqlxx::query::execute_many_impl(query, next, per_set);
     }
-    std::vector<int> paramFormats;
-    std::vector<int> paramLengths;
-    std::vector<std::string> values;
-    std::vector<char const*> paramValues;
-    for (auto const& bind : binds) {
-      switch (bind.type()) {
-        case SQL_INTEGER: case SQL_FLOAT:
-        case SQL_TEXT: case SQL_BLOB: {
-          auto str = bind.toString();
-          paramValues.push_back(nullptr);
-          paramLengths.push_back(str.size());
-          values.push_back(std::move(str));
+    sqlxx::batch_result result;
+    auto&& lock = db_();
+    db::prepared stmt;
+    if (!db_.acquire(query, stmt)
+    &&  !db_.prepare(pq_build_query(query, stmt.cursor), stmt)) {
+      result.result = ::PQstatus(lock) == CONNECTION_OK ? SQL_UNKNOWN_ERROR : SQL_SERVER_LOST;
+      return result;
+    }
+    auto status = [&](::PGresult* res) -> result_type {
+      if (res && ::PQresultStatus(res) == PGRES_COMMAND_OK) return SQL_OK;
+      return ::PQstatus(lock) == CONNECTION_OK ? state_result(res) : SQL_SERVER_LOST;
+    };
+    auto rows = [](::PGresult* res) -> std::uint64_t {
+      return res ? std::strtoull(::PQcmdTuples(res), nullptr, 10) : 0;
+    };
+    transaction tr(db_, lock);
+    std::vector<sqlxx::field_type> binds;
+#ifdef LIBPQ_HAS_PIPELINING
+    // bind sets are kept alive until their chunk is synced
+    static constexpr size_t chunk = 256;
+    std::vector<std::vector<sqlxx::field_type>> sets;
+    bool more = ::PQenterPipelineMode(lock) == 1;
+    if (!more) result.result = SQL_UNKNOWN_ERROR;
+    while (more) {
+      sets.clear();
+      while (sets.size() < chunk && (more = next(binds))) {
+        sets.emplace_back(std::move(binds));
+        binds.clear();
+        params param(sets.back());
+        if (!::PQsendQueryPrepared(lock, stmt.name.c_str(), param.size(),
+                                   param.values.data(), param.lengths.data(),
+                                   param.formats.data(), 0)) {
+          sets.pop_back();
+          result.result = status(nullptr);
+          more = false;
+          break;
+        }
+      }
+      if (sets.empty()) break;
+      ::PQpipelineSync(lock);
+      // one result per query, each followed by NULL, then the sync
+      for (size_t i = 0; i < sets.size(); ++i) {
+        pqresult res(::PQgetResult(lock));
+        while (pqresult(::PQgetResult(lock)));
+        if (result.result == SQL_OK) result.add(status(res), rows(res), per_set);
+      }
+      while (::PGresult* res = ::PQgetResult(lock)) {
+        bool synced = ::PQresultStatus(res) == PGRES_PIPELINE_SYNC;
+        ::PQclear(res);
+        if (synced) break;
+      }
+      more = more && result.result == SQL_OK;
+    }
+    ::PQexitPipelineMode(lock);
+#else
+    while (next(binds)) {
+      params param(binds);
+      pqresult res(::PQexecPrepared(lock, stmt.name.c_str(), param.size(),
+                                    param.values.data(), param.lengths.data(),
+                                    param.formats.data(), 0));
+      if (!result.add(status(res), rows(res), per_set)) break;
+      binds.clear();
+    }
+#endif
+    if (result.result == SQL_OK && !tr.commit()) result.result = db_.transactions().result();
+    tr.rollback();
+    if (::PQstatus(lock) != CONNECTION_OK) db_.reconnect();
+    db_.release(query, std::move(stmt), result.result == SQL_OK);
+    return result;
+  }
+
+  bool prepare_impl(char const* query) override {
+#ifdef USE_SHARED_CONNECTION
+    auto&& lock = db_();
+#endif
+    db::prepared stmt;
+    if (!db_.acquire(query, stmt)
+    &&  !db_.prepare(pq_build_query(query, stmt.cursor), stmt)) return false;
+    db_.release(query, std::move(stmt));
+    return true;
+  }
+
+  db const& db_;
+};
+
+/*
+ * Bulk load by COPY FROM STDIN in text format in a single transaction
+ */
+class bulk_insert : public sqlxx::bulk_insert {
+public:
+  static constexpr size_t buffer_size = 1 << 20;
+
+  bulk_insert(db const& db, std::string const& table, std::vector<std::string> const& columns)
+    : db_(db) {
+    auto&& handle = db_();
+    ok_ = (level_ = db_.transactions().begin(transaction::exec(handle))) != 0;
+    std::string text = "COPY " + table;
+    for (size_t i = 0; i < columns.size(); ++i) {
+      text += i ? ", " : " (";
+      text += columns[i];
+    }
+    if (!columns.empty()) text += ')';
+    text += " FROM STDIN";
+    if (!ok_) return;
+    pqresult copy = ::PQexec(handle, text.c_str());
+    ok_ = copying_ = copy && ::PQresultStatus(copy) == PGRES_COPY_IN;
+  }
+
+  ~bulk_insert() override {
+    if (finished_) return;
+    auto&& handle = db_();
+    end(handle, "aborted");
+    db_.transactions().rollback(level_, transaction::exec(handle));
+  }
+
+  bulk_insert(bulk_insert&&) = delete;
+  bulk_insert(bulk_insert const&) = delete;
+  bulk_insert& operator=(bulk_insert&&) = delete;
+  bulk_insert& operator=(bulk_insert const&) = delete;
+
+  bool write(std::vector<sqlxx::field_type> const& values) override {
+    if (!ok_) return false;
+    for (size_t i = 0; i < values.size(); ++i) {
+      if (i) buf_ += '\t';
+      auto const& v = values[i];
+      switch (v.type()) {
+        case SQL_INTEGER: buf_ += std::to_string(std::int64_t(v)); break;
+        case SQL_FLOAT: {
+          char num[32];
+          buf_.append(num, size_t(std::snprintf(num, sizeof(num), "%.17g", double(v))));
         } break;
-        case SQL_NULL: default: {
-          paramValues.push_back(nullptr);
-          paramLengths.push_back(0);
+        case SQL_TEXT: text(v.data(), v.size()); break;
+        case SQL_BLOB: {
+          static char const digits[] = "0123456789abcdef";
+          buf_ += "\\\\x";
+          for (size_t i = 0; i < v.size(); ++i) {
+            buf_ += digits[(v.data()[i] >> 4) & 0xF];
+            buf_ += digits[v.data()[i] & 0xF];
+          }
         } break;
+        default: buf_ += "\\N"; break;
       }
-      paramFormats.push_back(0);
     }
-    for (size_t i = 0, v = 0; i < binds.size(); i++) {
-      switch (binds[i].type()) {
-        case SQL_INTEGER: case SQL_FLOAT:
-        case SQL_TEXT: case SQL_BLOB: {
-          paramValues[i] = values[v++].data();
-        } break;
-        default: ;
+    buf_ += '\n';
+    if (buf_.size() >= buffer_size) flush();
+    return ok_;
+  }
+
+  bool finish() override {
+    if (finished_) return ok_;
+    finished_ = true;
+    flush();
+    auto&& handle = db_();
+    ok_ = end(handle, ok_ ? nullptr : "failed") && ok_;
+    auto& stack = db_.transactions();
+    ok_ = ok_ && stack.commit(level_, transaction::exec(handle));
+    if (!ok_) stack.rollback(level_, transaction::exec(handle));
+    return ok_;
+  }
+
+private:
+  // text format escaping
+  void text(char const* s, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+      char c = s[i];
+      switch (c) {
+        case '\\': buf_ += "\\\\"; break;
+        case '\t': buf_ += "\\t"; break;
+        case '\n': buf_ += "\\n"; break;
+        case '\r': buf_ += "\\r"; break;
+        default: buf_ += c; break;
       }
     }
-    auto trasaction_lock = [&]() {
-      auto&& lock = db_();
-      transaction tr(lock);
-      auto* res = ::PQexecParams(lock, q.c_str(), binds.size(), nullptr,
-                                paramValues.data(), paramLengths.data(),
-                                paramFormats.data(), 0);
-      res && ::PQresultStatus(res) == PGRES_COMMAND_OK && tr.commit();
-      return res;
-    };
-    return { std::make_shared<statement>(db_, trasaction_lock(), cursor) };
+  }
+
+  void flush() {
+    if (buf_.empty() || !ok_) return;
+    auto&& handle = db_();
+    ok_ = ::PQputCopyData(handle, buf_.data(), int(buf_.size())) == 1;
+    buf_.clear();
+  }
+
+  // end of COPY, error aborts it
+  bool end(::PGconn* handle, char const* error) {
+    if (!copying_) return false;
+    copying_ = false;
+    bool ok = ::PQputCopyEnd(handle, error) == 1;
+    while (::PGresult* res = ::PQgetResult(handle)) {
+      ok = ok && ::PQresultStatus(res) == PGRES_COMMAND_OK;
+      ::PQclear(res);
+    }
+    return ok;
   }
 
   db const& db_;
+  std::string buf_;
+  size_t level_ = 0;  // transaction level
+  bool ok_ = true;
+  bool copying_ = false;
+  bool finished_ = false;
 };
 
 class connection : public sqlxx::connection {
@@ -354,6 +740,55 @@ public:
     return con;
   }
 
+  // open count connections at once, TLS and auth handshakes are
+  // interleaved in a single poll loop, failed connections are skipped
+  static std::vector<std::unique_ptr<sqlxx::connection>> create(char const* conninfo,
+                                                                size_t count,
+                                                                int timeout_ms = -1) {
+    std::vector<::PGconn*> conns;
+    std::vector<::PostgresPollingStatusType> polls;
+    for (size_t i = 0; i < count; ++i) {
+      auto* conn = ::PQconnectStart(conninfo);
+      if (!conn) continue;
+      if (::PQstatus(conn) == CONNECTION_BAD) {
+        ::PQfinish(conn);
+        continue;
+      }
+      conns.push_back(conn);
+      polls.push_back(PGRES_POLLING_WRITING);
+    }
+    auto pending = [&]() {
+      return std::count_if(polls.begin(), polls.end(), [](::PostgresPollingStatusType p) {
+        return p == PGRES_POLLING_READING || p == PGRES_POLLING_WRITING;
+      }) > 0;
+    };
+    std::vector<pollfd> fds(conns.size());
+    while (pending()) {
+      for (size_t i = 0; i < conns.size(); ++i) {
+        fds[i].fd = -1; fds[i].revents = 0;
+        if (polls[i] != PGRES_POLLING_READING && polls[i] != PGRES_POLLING_WRITING) continue;
+        fds[i].fd = ::PQsocket(conns[i]);
+        fds[i].events = polls[i] == PGRES_POLLING_READING ? POLLIN : POLLOUT;
+      }
+      int ready = ::poll(fds.data(), fds.size(), timeout_ms);
+      if (ready < 0 && errno == EINTR) continue;
+      if (ready <= 0) break;
+      for (size_t i = 0; i < conns.size(); ++i) {
+        if (fds[i].fd < 0 || !fds[i].revents) continue;
+        polls[i] = ::PQconnectPoll(conns[i]);
+      }
+    }
+    std::vector<std::unique_ptr<sqlxx::connection>> cons;
+    for (size_t i = 0; i < conns.size(); ++i) {
+      if (polls[i] != PGRES_POLLING_OK) {
+        ::PQfinish(conns[i]);
+        continue;
+      }
+      cons.emplace_back(new connection(conns[i]));
+    }
+    return cons;
+  }
+
   void vacuum() override { db_.vacuum(); }
   std::string version() override { return db_.version(); }
 
@@ -361,9 +796,41 @@ public:
     return std::unique_ptr<pqsqlxx::query>{ new pqsqlxx::query(db_, str) };
   }
 
+  bool session(std::string const& str) override { return db_.session(str); }
+  void reconnect(sqlxx::backoff const& policy) override { db_.reconnect(policy); }
+
+  size_t begin() override {
+    auto&& lock = db_();
+    return db_.transactions().begin(transaction::exec(lock));
+  }
+
+  bool commit(size_t level) override {
+    auto&& lock = db_();
+    return db_.transactions().commit(level, transaction::exec(lock));
+  }
+
+  bool rollback(size_t level) override {
+    auto&& lock = db_();
+    return db_.transactions().rollback(level, transaction::exec(lock));
+  }
+
+  result_type transaction_result() const override {
+#ifdef USE_SHARED_CONNECTION
+    auto&& lock = db_();
+#endif
+    return db_.transactions().result();
+  }
+  bool row_values() const override { return true; }
+
+  std::unique_ptr<sqlxx::bulk_insert> bulk(std::string const& table,
+                                           std::vector<std::string> const& columns) override {
+    return std::unique_ptr<sqlxx::bulk_insert>{ new bulk_insert(db_, table, columns) };
+  }
+
 private:
   db db_;
   connection(char const* conninfo) : db_{ conninfo } {}
+  connection(::PGconn* conn) : db_{ conn } {}
 };
 
 } // namespace pqsqlxx
@@ -30,6 +30,11 @@
 #include "sqlxx.h"
 
 #include <sqlite3.h>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <condition_variable>
+#include <unordered_map>
 
 namespace sqlitexx {
 
@@ -72,6 +77,8 @@ public:
     sqlxx::connection_lock<::sqlite3> lock(mutex_, db_);
 #endif
     if (!open_) return;
+    for (auto& cached : cache_) ::sqlite3_finalize(cached.second);
+    cache_.clear();
     ::sqlite3_close_v2(db_);
     open_ = false;
     db_   = nullptr;
@@ -86,6 +93,35 @@ public:
   // database defragmentation
   int vacuum() { return ::sqlite3_exec((*this)(), "VACUUM;", nullptr, nullptr, nullptr); }
 
+  // take prepared statement out of the cache (call it with lock held)
+  int acquire(std::string const& query, ::sqlite3_stmt** stmt) const {
+    auto it = cache_.find(query);
+    if (it == cache_.end()) {
+      return ::sqlite3_prepare_v2(db_, query.c_str(), -1, stmt, nullptr);
+    }
+    *stmt = it->second;
+    cache_.erase(it);
+    return SQLITE_OK;
+  }
+
+  // give statement back to the cache (call it with lock held)
+  void release(std::string const& query, ::sqlite3_stmt* stmt) const {
+    if (!stmt) return;
+    if (!open_ || cache_.size() >= cache_size) {
+      ::sqlite3_finalize(stmt);
+      return;
+    }
+    ::sqlite3_reset(stmt);
+    ::sqlite3_clear_bindings(stmt);
+    cache_.emplace(query, stmt);
+  }
+
+  // maximum number of idle prepared statements
+  static constexpr size_t cache_size = 64;
+
+  // open transaction levels (use it with lock held)
+  sqlxx::transaction_stack& transactions() const { return transactions_; }
+
 private:
   db(db&&) = delete;            // no move
   db(db const&) = delete;       // no copy
@@ -96,29 +132,60 @@ private:
   ::sqlite3*        db_;    // associated db
   std::string const name_;  // db filename
   bool              open_;  // db open status
+  mutable std::unordered_multimap<std::string, ::sqlite3_stmt*> cache_; // idle statements
+  mutable sqlxx::transaction_stack transactions_; // BEGIN and savepoints
 #ifdef USE_SHARED_CONNECTION
   mutable std::mutex mutex_;
 #endif
 };
 
+static inline
+result_type to_result(int err) {
+  switch (err & 0xff) { // primary code of extended ones
+    case SQLITE_OK:
+    case SQLITE_ROW:
+    case SQLITE_DONE: return SQL_OK;
+    case SQLITE_NOMEM: return SQL_NO_MEMORY;
+    case SQLITE_EMPTY: return SQL_IMPROPER;
+    case SQLITE_BUSY:
+    case SQLITE_LOCKED: return SQL_BUSY;
+    default: return SQL_UNKNOWN_ERROR;
+  }
+}
+
+// decode column of the current row
+static inline
+sqlxx::field_type column(::sqlite3_stmt* stmt, int i, std::string const& name) {
+  switch (::sqlite3_column_type(stmt, i)) {
+    case SQLITE_INTEGER: return { std::int64_t(::sqlite3_column_int64(stmt, i)), name };
+    case SQLITE_FLOAT: return { ::sqlite3_column_double(stmt, i), name };
+    case SQLITE_BLOB: {
+      auto const* data = reinterpret_cast<std::uint8_t const*>(::sqlite3_column_blob(stmt, i));
+      return sqlxx::field_type(blob(data, ::sqlite3_column_bytes(stmt, i)), name);
+    }
+    case SQLITE_TEXT: {
+      auto const* text = reinterpret_cast<char const*>(::sqlite3_column_text(stmt, i));
+      return { std::string(text, ::sqlite3_column_bytes(stmt, i)), name };
+    }
+    case SQLITE_NULL: return { name };
+    default: return { std::int64_t(0), name };
+  }
+}
+
 class statement : public sqlxx::statement {
 public:
-  statement(::sqlite3* db_, ::sqlite3_stmt* stmt) : stmt_(stmt) {
+  statement(db const& db, ::sqlite3* handle, std::string const& query, ::sqlite3_stmt* stmt)
+    : db_(db), query_(query), stmt_(stmt) {
     int result;
     if (!stmt_) {
-      result = ::sqlite3_errcode(db_);
+      result = ::sqlite3_errcode(handle);
     } else {
       result = ::sqlite3_step(stmt_);
     }
-    switch(result) {
-      case SQLITE_OK:
-      case SQLITE_DONE: result_ = SQL_OK; break;
-      case SQLITE_NOMEM: result_ = SQL_NO_MEMORY; return;
-      case SQLITE_EMPTY: result_ = SQL_IMPROPER; return;
-      default: result_ = SQL_UNKNOWN_ERROR; return;
-    }
-    last_id_ = ::sqlite3_last_insert_rowid(db_);
-    affected_rows_ = ::sqlite3_changes(db_);
+    result_ = to_result(result);
+    if (result_ != SQL_OK) return;
+    last_id_ = ::sqlite3_last_insert_rowid(handle);
+    affected_rows_ = ::sqlite3_changes(handle);
   }
 
   statement(statement&&) = delete;
@@ -126,62 +193,88 @@ public:
   statement& operator=(statement&&) = delete;
   statement& operator=(statement const&) = delete;
 
-  ~statement() override { if (stmt_) ::sqlite3_finalize(stmt_); }
+  ~statement() override {
+    detach();
+#ifdef USE_SHARED_CONNECTION
+    auto&& lock = db_();
+#endif
+    db_.release(query_, stmt_);
+  }
 
   sqlxx::row next() override {
-    sqlxx::row row;
+    detach();
     if (!stmt_ || ::sqlite3_step(stmt_) != SQLITE_ROW) return {};
-    for (int i = 0; i < ::sqlite3_column_count(stmt_); ++i) {
-      switch (::sqlite3_column_type(stmt_, i))
-      {
-      case SQLITE_INTEGER:
-        row.emplace_back(std::int64_t(::sqlite3_column_int64(stmt_, i)), ::sqlite3_column_name(stmt_, i));
-        break;
-      case SQLITE_FLOAT:
-        row.emplace_back(::sqlite3_column_double(stmt_, i), ::sqlite3_column_name(stmt_, i));
-        break;
-      case SQLITE_BLOB: {
-        auto const* data = reinterpret_cast<std::uint8_t const*>(::sqlite3_column_blob(stmt_, i));
-        blob b(data, ::sqlite3_column_bytes(stmt_, i));
-        row.emplace_back(std::move(b), ::sqlite3_column_name(stmt_, i));
-      } break;
-      case SQLITE_TEXT: {
-        std::string text(reinterpret_cast<char const*>(::sqlite3_column_text(stmt_, i)));
-        row.emplace_back(std::move(text), ::sqlite3_column_name(stmt_, i));
-      } break;
-      case SQLITE_NULL:
-        row.emplace_back(::sqlite3_column_name(stmt_, i));
-        break;
-      default:
-        row.emplace_back(std::int64_t(0), ::sqlite3_column_name(stmt_, i));
-        break;
+    int const count = ::sqlite3_column_count(stmt_);
+    if (lazy_) {
+      if (!names_) {
+        std::vector<std::string> names;
+        for (int i = 0; i < count; ++i) names.emplace_back(::sqlite3_column_name(stmt_, i));
+        names_ = std::make_shared<std::vector<std::string> const>(std::move(names));
       }
+      current_ = std::make_shared<source>(stmt_, names_);
+      return { current_ };
+    }
+    sqlxx::row row;
+    row.reserve(count);
+    for (int i = 0; i < count; ++i) {
+      row.push_back(column(stmt_, i, ::sqlite3_column_name(stmt_, i)));
     }
     return row;
   }
-  void first() override { if (stmt_) ::sqlite3_reset(stmt_); }
+
+  void first() override {
+    detach();
+    if (stmt_) ::sqlite3_reset(stmt_);
+  }
+
+  void lazy(bool on) override { lazy_ = on; }
   result_type result() const override { return result_; };
   std::uint64_t last_id() const override { return last_id_; };
   std::uint64_t affected_rows() const override { return affected_rows_; };
 
 private:
+  // columns of the current row, valid until the next step or reset
+  class source : public sqlxx::row_source {
+  public:
+    source(::sqlite3_stmt* stmt, std::shared_ptr<std::vector<std::string> const> names)
+      : sqlxx::row_source(std::move(names)), stmt_(stmt) {}
+
+  protected:
+    sqlxx::field_type decode(size_t idx, std::string const& name) override {
+      return column(stmt_, int(idx), name);
+    }
+
+  private:
+    ::sqlite3_stmt* stmt_;
+  };
+
+  // a row still referenced is decoded before the statement moves
+  void detach() {
+    if (current_ && current_.use_count() > 1) current_->detach();
+    current_.reset();
+  }
+
+  db const& db_;
+  std::string query_;
   ::sqlite3_stmt* stmt_;
   result_type result_;
   std::uint64_t last_id_ = 0;
   std::uint64_t affected_rows_ = 0;
+  bool lazy_ = false;
+  std::shared_ptr<std::vector<std::string> const> names_;
+  std::shared_ptr<source> current_;
 };
 
 /*
- * Representation of a transaction
+ * Representation of a transaction, a nested one is a savepoint
  */
 class transaction {
 public:
-  transaction(::sqlite3* db) : db_(db) {
-    finished_ = !begin();
-  }
+  transaction(db const& db, ::sqlite3* handle)
+    : stack_(db.transactions()), db_(handle), level_(stack_.begin(exec(handle))) {}
 
-  transaction(transaction&& t) : db_(t.db_), finished_(t.finished_) {
-    t.finished_ = true;
+  transaction(transaction&& t) : stack_(t.stack_), db_(t.db_), level_(t.level_) {
+    t.level_ = 0;
   }
 
   ~transaction() { rollback(); }
@@ -190,28 +283,33 @@ public:
   transaction& operator=(transaction&&) = delete;
   transaction& operator=(transaction const&) = delete;
 
-  bool begin() {
-    auto err = ::sqlite3_exec(db_, "BEGIN;", nullptr, nullptr, nullptr);
-    return err == SQLITE_OK;
-  }
+  // 0 if begin failed or it's finished
+  size_t level() const { return level_; }
 
   bool commit() {
-    if (finished_) return true;
-    auto err = ::sqlite3_exec(db_, "COMMIT;", nullptr, nullptr, nullptr);
-    finished_ = err == SQLITE_OK;
-    return finished_;
+    if (!level_) return true;
+    if (stack_.commit(level_, exec(db_))) level_ = 0;
+    return !level_;
   }
 
   bool rollback() {
-    if (finished_) return true;
-    auto err = ::sqlite3_exec(db_, "ROLLBACK;", nullptr, nullptr, nullptr);
-    finished_ = err == SQLITE_OK;
-    return finished_;
+    if (!level_) return true;
+    auto level = level_;
+    level_ = 0;
+    return stack_.rollback(level, exec(db_));
+  }
+
+  // statement runner of the transaction stack
+  static sqlxx::transaction_stack::exec_type exec(::sqlite3* db) {
+    return [db](char const* sql) {
+      return to_result(::sqlite3_exec(db, sql, nullptr, nullptr, nullptr));
+    };
   }
 
 private:
+  sqlxx::transaction_stack& stack_;
   ::sqlite3* db_;
-  bool finished_;
+  size_t level_;
 };
 
 class query : public sqlxx::query {
@@ -221,19 +319,22 @@ public:
   query(db const& db, std::string const& str) : sqlxx::query(str), db_(db) {}
 
 private:
+  // referenced data is bound in place unless rows are read after execute
+  static ::sqlite3_destructor_type destructor(::sqlite3_stmt* stmt, sqlxx::field_type const& bind) {
+    return bind.is_ref() && !::sqlite3_column_count(stmt) ? SQLITE_STATIC : SQLITE_TRANSIENT;
+  }
+
   int do_bind(::sqlite3_stmt* stmt, std::vector<sqlxx::field_type> binds) {
     int err = SQLITE_OK; int idx = 1;
     for (auto it = binds.begin(); it != binds.end(); it = binds.erase(it), idx++) {
       auto const& bind = *it;
       if (bind.type() == SQL_BLOB) {
         auto name = bind.name();
-        std::string const& v = bind;
-        err = ::sqlite3_bind_blob(stmt, name.empty() ? idx : ::sqlite3_bind_parameter_index(stmt, name.c_str()), v.data(), v.size(), SQLITE_TRANSIENT);
+        err = ::sqlite3_bind_blob(stmt, name.empty() ? idx : ::sqlite3_bind_parameter_index(stmt, name.c_str()), bind.data(), bind.size(), destructor(stmt, bind));
       }
       else if (bind.type() == SQL_TEXT) {
         auto name = bind.name();
-        std::string const& s = bind;
-        err = ::sqlite3_bind_text(stmt, name.empty() ? idx : ::sqlite3_bind_parameter_index(stmt, name.c_str()), s.c_str(), s.size(), SQLITE_TRANSIENT);
+        err = ::sqlite3_bind_text(stmt, name.empty() ? idx : ::sqlite3_bind_parameter_index(stmt, name.c_str()), bind.data(), bind.size(), destructor(stmt, bind));
       }
       else if (bind.type() == SQL_NULL) {
         auto name = bind.name();
@@ -256,15 +357,859 @@ private:
 
   sqlxx::cursor execute_impl(char const* query, std::vector<sqlxx::field_type> bind) override {
     auto&& lock = db_();
-    transaction tr(lock);
+    transaction tr(db_, lock);
     ::sqlite3_stmt* stmt = nullptr;
-    int err = ::sqlite3_prepare_v2(lock, query, -1, &stmt, nullptr);
+    int err = db_.acquire(query, &stmt);
     err == SQLITE_OK && (err = do_bind(stmt, std::move(bind)));
     err == SQLITE_OK && tr.commit();
-    return { std::make_shared<statement>(lock, stmt) };
+    return { std::make_shared<statement>(db_, lock, query, stmt) };
   }
 
+  // one statement reset and bound per set, in one transaction
+  // (a savepoint in an open one)
+  sqlxx::batch_result execute_many_impl(char const* query, bind_source const& next, bool per_set) override {
+    sqlxx::batch_result result;
+    auto&& lock = db_();
+    transaction tr(db_, lock);
+    ::sqlite3_stmt* stmt = nullptr;
+    int err = db_.acquire(query, &stmt);
+    if (err != SQLITE_OK) result.result = to_result(err);
+    std::vector<sqlxx::field_type> binds;
+    while (err == SQLITE_OK && next(binds)) {
+      err = do_bind(stmt, std::move(binds));
+      if (err == SQLITE_OK) err = ::sqlite3_step(stmt);
+      if (!result.add(to_result(err), ::sqlite3_changes(lock), per_set)) break;
+      ::sqlite3_reset(stmt);
+      err = SQLITE_OK;
+      binds.clear();
+    }
+    if (result.result == SQL_OK && !tr.commit()) result.result = db_.transactions().result();
+    db_.release(query, stmt);
+    return result;
+  }
+
+  bool prepare_impl(char const* query) override {
+#ifdef USE_SHARED_CONNECTION
+    auto&& lock = db_();
+#endif
+    ::sqlite3_stmt* stmt = nullptr;
+    if (db_.acquire(query, &stmt) != SQLITE_OK) return false;
+    db_.release(query, stmt);
+    return true;
+  }
+
+  db const& db_;
+};
+
+/*
+ * Bulk load by one prepared INSERT stepped per row in a single transaction
+ */
+class bulk_insert : public sqlxx::bulk_insert {
+public:
+  bulk_insert(db const& db, std::string const& table, std::vector<std::string> const& columns)
+    : db_(db), table_(table), columns_(columns) {
+    auto&& handle = db_();
+    ok_ = (level_ = db_.transactions().begin(transaction::exec(handle))) != 0;
+  }
+
+  ~bulk_insert() override {
+    if (finished_) return;
+    auto&& handle = db_();
+    ::sqlite3_finalize(stmt_);
+    db_.transactions().rollback(level_, transaction::exec(handle));
+  }
+
+  bulk_insert(bulk_insert&&) = delete;
+  bulk_insert(bulk_insert const&) = delete;
+  bulk_insert& operator=(bulk_insert&&) = delete;
+  bulk_insert& operator=(bulk_insert const&) = delete;
+
+  bool write(std::vector<sqlxx::field_type> const& values) override {
+    if (!ok_) return false;
+    auto&& handle = db_();
+    if (!stmt_) {
+      auto text = sqlxx::insert_text(table_, columns_, values.size(), 1);
+      ok_ = ::sqlite3_prepare_v2(handle, text.c_str(), -1, &stmt_, nullptr) == SQLITE_OK;
+      if (!ok_) return false;
+    }
+    int err = SQLITE_OK;
+    for (size_t i = 0; i < values.size() && err == SQLITE_OK; ++i) {
+      auto const& v = values[i];
+      int idx = int(i + 1);
+      switch (v.type()) {
+        case SQL_INTEGER: err = ::sqlite3_bind_int64(stmt_, idx, std::int64_t(v)); break;
+        case SQL_FLOAT: err = ::sqlite3_bind_double(stmt_, idx, double(v)); break;
+        case SQL_TEXT: {
+          err = ::sqlite3_bind_text(stmt_, idx, v.data(), int(v.size()), SQLITE_STATIC);
+        } break;
+        case SQL_BLOB: {
+          err = ::sqlite3_bind_blob(stmt_, idx, v.data(), int(v.size()), SQLITE_STATIC);
+        } break;
+        default: err = ::sqlite3_bind_null(stmt_, idx); break;
+      }
+    }
+    ok_ = err == SQLITE_OK && ::sqlite3_step(stmt_) == SQLITE_DONE;
+    ::sqlite3_reset(stmt_);
+    return ok_;
+  }
+
+  bool finish() override {
+    if (finished_) return ok_;
+    finished_ = true;
+    auto&& handle = db_();
+    ::sqlite3_finalize(stmt_);
+    stmt_ = nullptr;
+    auto& stack = db_.transactions();
+    ok_ = ok_ && stack.commit(level_, transaction::exec(handle));
+    if (!ok_) stack.rollback(level_, transaction::exec(handle));
+    return ok_;
+  }
+
+private:
   db const& db_;
+  std::string const table_;
+  std::vector<std::string> const columns_;
+  ::sqlite3_stmt* stmt_ = nullptr;
+  size_t level_ = 0;  // transaction level
+  bool ok_ = true;
+  bool finished_ = false;
+};
+
+/*
+ * C++ values of SQL function arguments and results (and virtual table columns)
+ */
+template<class T, class Enable = void>
+struct value_traits;
+
+template<class T>
+struct value_traits<T, typename std::enable_if<std::is_integral<T>::value>::type> {
+  static char const* decl() { return "INTEGER"; }
+  static T get(::sqlite3_value* v) { return static_cast<T>(::sqlite3_value_int64(v)); }
+  static void set(::sqlite3_context* ctx, T t) { ::sqlite3_result_int64(ctx, ::sqlite3_int64(t)); }
+};
+
+template<class T>
+struct value_traits<T, typename std::enable_if<std::is_floating_point<T>::value>::type> {
+  static char const* decl() { return "REAL"; }
+  static T get(::sqlite3_value* v) { return static_cast<T>(::sqlite3_value_double(v)); }
+  static void set(::sqlite3_context* ctx, T t) { ::sqlite3_result_double(ctx, double(t)); }
+};
+
+template<>
+struct value_traits<std::string> {
+  static char const* decl() { return "TEXT"; }
+  static std::string get(::sqlite3_value* v) {
+    auto const* text = reinterpret_cast<char const*>(::sqlite3_value_text(v));
+    return text ? std::string(text, ::sqlite3_value_bytes(v)) : std::string();
+  }
+  static void set(::sqlite3_context* ctx, std::string const& s) {
+    ::sqlite3_result_text(ctx, s.data(), int(s.size()), SQLITE_TRANSIENT);
+  }
+};
+
+template<>
+struct value_traits<blob> {
+  static char const* decl() { return "BLOB"; }
+  static blob get(::sqlite3_value* v) {
+    auto const* data = reinterpret_cast<std::uint8_t const*>(::sqlite3_value_blob(v));
+    return data ? blob(data, ::sqlite3_value_bytes(v)) : blob(size_t(0));
+  }
+  static void set(::sqlite3_context* ctx, blob const& b) {
+    ::sqlite3_result_blob(ctx, b.data(), int(b.size()), SQLITE_TRANSIENT);
+  }
+};
+
+// any type, NULL included
+template<>
+struct value_traits<sqlxx::field_type> {
+  static char const* decl() { return ""; }
+  static sqlxx::field_type get(::sqlite3_value* v) {
+    switch (::sqlite3_value_type(v)) {
+      case SQLITE_INTEGER: return { std::int64_t(::sqlite3_value_int64(v)), {} };
+      case SQLITE_FLOAT: return { ::sqlite3_value_double(v), {} };
+      case SQLITE_BLOB: return sqlxx::field_type(value_traits<blob>::get(v), {});
+      case SQLITE_TEXT: return { value_traits<std::string>::get(v), {} };
+      default: return { std::string() };
+    }
+  }
+  static void set(::sqlite3_context* ctx, sqlxx::field_type const& f) {
+    switch (f.type()) {
+      case SQL_INTEGER: ::sqlite3_result_int64(ctx, std::int64_t(f)); break;
+      case SQL_FLOAT: ::sqlite3_result_double(ctx, double(f)); break;
+      case SQL_TEXT: ::sqlite3_result_text(ctx, f.data(), int(f.size()), SQLITE_TRANSIENT); break;
+      case SQL_BLOB: ::sqlite3_result_blob(ctx, f.data(), int(f.size()), SQLITE_TRANSIENT); break;
+      default: ::sqlite3_result_null(ctx); break;
+    }
+  }
+};
+
+/*
+ * Signature of a function, lambda or other callable
+ */
+template<class F>
+struct callable : callable<decltype(&F::operator())> {};
+
+template<class R, class... Args>
+struct callable<R (*)(Args...)> {
+  typedef typename std::decay<R>::type result;
+  static constexpr int arity = int(sizeof...(Args));
+  typedef std::tuple<typename std::decay<Args>::type...> args;
+};
+
+template<class C, class R, class... Args>
+struct callable<R (C::*)(Args...)> : callable<R (*)(Args...)> {};
+
+template<class C, class R, class... Args>
+struct callable<R (C::*)(Args...) const> : callable<R (*)(Args...)> {};
+
+template<size_t...> struct indices {};
+template<size_t N, size_t... I> struct make_indices : make_indices<N - 1, N - 1, I...> {};
+template<size_t... I> struct make_indices<0, I...> { typedef indices<I...> type; };
+
+// f(argv[0], ...) converted by types of Args, result set unless it's void
+template<class R, class Args>
+struct invoker;
+
+template<class R, class... Args>
+struct invoker<R, std::tuple<Args...>> {
+  template<class F, size_t... I>
+  static void call(F& f, ::sqlite3_context* ctx, ::sqlite3_value** argv, indices<I...>) {
+    (void)argv;
+    value_traits<R>::set(ctx, f(value_traits<Args>::get(argv[I])...));
+  }
+};
+
+template<class... Args>
+struct invoker<void, std::tuple<Args...>> {
+  template<class F, size_t... I>
+  static void call(F& f, ::sqlite3_context*, ::sqlite3_value** argv, indices<I...>) {
+    (void)argv;
+    f(value_traits<Args>::get(argv[I])...);
+  }
+};
+
+/*
+ * Scalar function of a callable, the callable is owned by SQLite
+ */
+template<class F>
+struct function {
+  typedef callable<F> traits;
+
+  static void call(::sqlite3_context* ctx, int, ::sqlite3_value** argv) {
+    auto& f = *static_cast<F*>(::sqlite3_user_data(ctx));
+    try {
+      invoker<typename traits::result, typename traits::args>::call(
+        f, ctx, argv, typename make_indices<traits::arity>::type());
+    } catch (...) {
+      ::sqlite3_result_error(ctx, "exception in function", -1);
+    }
+  }
+
+  static void destroy(void* f) { delete static_cast<F*>(f); }
+};
+
+/*
+ * Aggregate (and window) function of a State type with step(args...) and
+ * value(), window ones have inverse(args...) too. A state is created by
+ * the first row of a group, a group without rows has value of State()
+ */
+template<class State>
+struct aggregate {
+  typedef callable<decltype(&State::step)> traits;
+  typedef typename std::decay<decltype(std::declval<State&>().value())>::type result;
+
+  // step and inverse of a state
+  struct stepper {
+    State& state;
+    template<class... Args>
+    void operator()(Args&&... args) { state.step(std::forward<Args>(args)...); }
+  };
+
+  struct inverter {
+    State& state;
+    template<class... Args>
+    void operator()(Args&&... args) { state.inverse(std::forward<Args>(args)...); }
+  };
+
+  // state of the group, null before the first row if not created
+  static State* state(::sqlite3_context* ctx, bool create) {
+    auto** slot = static_cast<State**>(::sqlite3_aggregate_context(ctx, create ? int(sizeof(State*)) : 0));
+    if (!slot) return nullptr;
+    if (!*slot && create) *slot = new State();
+    return *slot;
+  }
+
+  template<class Call>
+  static void apply(::sqlite3_context* ctx, ::sqlite3_value** argv) {
+    try {
+      auto* s = state(ctx, true);
+      if (!s) {
+        ::sqlite3_result_error_nomem(ctx);
+        return;
+      }
+      Call call{ *s };
+      invoker<void, typename traits::args>::call(call, ctx, argv, typename make_indices<traits::arity>::type());
+    } catch (...) {
+      ::sqlite3_result_error(ctx, "exception in aggregate", -1);
+    }
+  }
+
+  static void step(::sqlite3_context* ctx, int, ::sqlite3_value** argv) { apply<stepper>(ctx, argv); }
+  static void inverse(::sqlite3_context* ctx, int, ::sqlite3_value** argv) { apply<inverter>(ctx, argv); }
+
+  static void value(::sqlite3_context* ctx) {
+    try {
+      auto* s = state(ctx, false);
+      value_traits<result>::set(ctx, s ? s->value() : State().value());
+    } catch (...) {
+      ::sqlite3_result_error(ctx, "exception in aggregate", -1);
+    }
+  }
+
+  static void final(::sqlite3_context* ctx) {
+    value(ctx);
+    delete state(ctx, false);
+  }
+};
+
+#if SQLITE_VERSION_NUMBER >= 3009000
+/*
+ * Ordering of key columns of virtual tables, numbers and text (BINARY)
+ */
+template<class T, class Enable = void>
+struct key_traits {
+  static bool key() { return false; }
+  static bool less(T const&, T const&) { return false; }
+  static bool usable(::sqlite3_value*) { return false; }
+  static int compare(T const&, ::sqlite3_value*) { return 0; }
+};
+
+template<class T>
+struct key_traits<T, typename std::enable_if<std::is_arithmetic<T>::value>::type> {
+  static bool key() { return true; }
+  static bool less(T const& a, T const& b) { return a < b; }
+
+  static bool usable(::sqlite3_value* v) {
+    auto type = ::sqlite3_value_type(v);
+    return type == SQLITE_INTEGER || type == SQLITE_FLOAT;
+  }
+
+  // exact for 64 bit integers where long double is wide enough
+  static int compare(T const& a, ::sqlite3_value* v) {
+    long double b = ::sqlite3_value_type(v) == SQLITE_INTEGER
+      ? static_cast<long double>(::sqlite3_value_int64(v))
+      : static_cast<long double>(::sqlite3_value_double(v));
+    return static_cast<long double>(a) < b ? -1 : b < static_cast<long double>(a) ? 1 : 0;
+  }
+};
+
+template<>
+struct key_traits<std::string> {
+  static bool key() { return true; }
+  static bool less(std::string const& a, std::string const& b) { return a < b; }
+  static bool usable(::sqlite3_value* v) { return ::sqlite3_value_type(v) == SQLITE_TEXT; }
+
+  static int compare(std::string const& a, ::sqlite3_value* v) {
+    auto const* text = reinterpret_cast<char const*>(::sqlite3_value_text(v));
+    size_t size = size_t(::sqlite3_value_bytes(v));
+    int cmp = std::memcmp(a.data(), text, std::min(a.size(), size));
+    return cmp ? cmp : a.size() < size ? -1 : a.size() > size ? 1 : 0;
+  }
+};
+
+/*
+ * Column i of a tuple by runtime index
+ */
+template<class Tuple, size_t I = 0, size_t N = std::tuple_size<Tuple>::value>
+struct tuple_columns {
+  typedef typename std::decay<typename std::tuple_element<I, Tuple>::type>::type type;
+  typedef tuple_columns<Tuple, I + 1, N> rest;
+
+  static char const* decl(size_t i) { return i == I ? value_traits<type>::decl() : rest::decl(i); }
+  static bool key(size_t i) { return i == I ? key_traits<type>::key() : rest::key(i); }
+
+  static void set(::sqlite3_context* ctx, Tuple const& t, size_t i) {
+    if (i == I) value_traits<type>::set(ctx, std::get<I>(t));
+    else rest::set(ctx, t, i);
+  }
+
+  static bool less(Tuple const& a, Tuple const& b, size_t i) {
+    return i == I ? key_traits<type>::less(std::get<I>(a), std::get<I>(b)) : rest::less(a, b, i);
+  }
+
+  static bool usable(size_t i, ::sqlite3_value* v) {
+    return i == I ? key_traits<type>::usable(v) : rest::usable(i, v);
+  }
+
+  static int compare(Tuple const& t, size_t i, ::sqlite3_value* v) {
+    return i == I ? key_traits<type>::compare(std::get<I>(t), v) : rest::compare(t, i, v);
+  }
+};
+
+template<class Tuple, size_t N>
+struct tuple_columns<Tuple, N, N> {
+  static char const* decl(size_t) { return ""; }
+  static bool key(size_t) { return false; }
+  static void set(::sqlite3_context* ctx, Tuple const&, size_t) { ::sqlite3_result_null(ctx); }
+  static bool less(Tuple const&, Tuple const&, size_t) { return false; }
+  static bool usable(size_t, ::sqlite3_value*) { return false; }
+  static int compare(Tuple const&, size_t, ::sqlite3_value*) { return 0; }
+};
+
+/*
+ * Rows of a random access range of tuples, every key column has its
+ * order (row positions sorted by it) built once, constraints on a key
+ * are binary searched in it
+ */
+template<class Range>
+class range_source {
+public:
+  typedef typename std::decay<decltype(*std::begin(std::declval<Range const&>()))>::type tuple;
+  typedef tuple_columns<tuple> columns;
+
+  // constraints of idxNum, the key is idxNum >> 5 (0 for a full scan)
+  enum { use_eq = 1, use_ge = 2, use_gt = 4, use_le = 8, use_lt = 16 };
+
+  range_source(std::shared_ptr<Range const> rows, std::vector<size_t> keys)
+    : rows_(std::move(rows)), keys_(std::move(keys)) {
+    for (size_t key : keys_) {
+      std::vector<size_t> order(size());
+      for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+      std::stable_sort(order.begin(), order.end(), [this, key](size_t a, size_t b) {
+        return columns::less(row(a), row(b), key);
+      });
+      orders_.push_back(std::move(order));
+    }
+  }
+
+  size_t size() const { return size_t(std::end(*rows_) - std::begin(*rows_)); }
+  tuple const& row(size_t i) const { return std::begin(*rows_)[i]; }
+
+  // cheapest key by its constraints, SQLite checks them again (omit is 0)
+  void best_index(::sqlite3_index_info* info) const {
+    double const rows = double(size()) + 1;
+    double best_cost = rows;
+    int best = 0;
+    int used[3] = { -1, -1, -1 }; // eq, lower, upper constraint of best key
+    for (size_t k = 0; k < keys_.size(); ++k) {
+      int eq = -1, lower = -1, upper = -1;
+      for (int c = 0; c < info->nConstraint; ++c) {
+        auto const& con = info->aConstraint[c];
+        if (!con.usable || con.iColumn < 0 || size_t(con.iColumn) != keys_[k]) continue;
+#if SQLITE_VERSION_NUMBER >= 3022000
+        // text keys are ordered by BINARY
+        auto const* coll = ::sqlite3_vtab_collation(info, c);
+        if (coll && ::sqlite3_stricmp(coll, "BINARY")) continue;
+#endif
+        switch (con.op) {
+          case SQLITE_INDEX_CONSTRAINT_EQ: eq = c; break;
+          case SQLITE_INDEX_CONSTRAINT_GT:
+          case SQLITE_INDEX_CONSTRAINT_GE: lower = c; break;
+          case SQLITE_INDEX_CONSTRAINT_LT:
+          case SQLITE_INDEX_CONSTRAINT_LE: upper = c; break;
+          default: break;
+        }
+      }
+      double cost = eq >= 0 ? std::log2(rows) + 1
+                  : lower >= 0 && upper >= 0 ? rows / 16
+                  : lower >= 0 || upper >= 0 ? rows / 4 : rows;
+      if (cost < best_cost) {
+        best_cost = cost;
+        best = int(k) + 1;
+        used[0] = eq;
+        used[1] = eq < 0 ? lower : -1;
+        used[2] = eq < 0 ? upper : -1;
+      }
+    }
+    // a single ascending ORDER BY key is the order of its scan
+    if (info->nOrderBy == 1 && !info->aOrderBy[0].desc) {
+      int col = info->aOrderBy[0].iColumn;
+      for (size_t k = 0; k < keys_.size() && !best; ++k) {
+        if (col >= 0 && size_t(col) == keys_[k]) best = int(k) + 1;
+      }
+      if (best && col >= 0 && size_t(col) == keys_[size_t(best) - 1]) info->orderByConsumed = 1;
+    }
+    int flags = 0, arg = 0;
+    for (int u = 0; u < 3; ++u) {
+      int c = used[u];
+      if (c < 0) continue;
+      info->aConstraintUsage[c].argvIndex = ++arg;
+      switch (info->aConstraint[c].op) {
+        case SQLITE_INDEX_CONSTRAINT_EQ: flags |= use_eq; break;
+        case SQLITE_INDEX_CONSTRAINT_GE: flags |= use_ge; break;
+        case SQLITE_INDEX_CONSTRAINT_GT: flags |= use_gt; break;
+        case SQLITE_INDEX_CONSTRAINT_LE: flags |= use_le; break;
+        default: flags |= use_lt; break;
+      }
+    }
+    info->idxNum = best << 5 | flags;
+    info->estimatedCost = best_cost;
+#if SQLITE_VERSION_NUMBER >= 3008002
+    info->estimatedRows = ::sqlite3_int64(best_cost < rows ? best_cost : rows);
+#endif
+  }
+
+  class cursor {
+  public:
+    void filter(range_source const& source, int idx, int, ::sqlite3_value** argv) {
+      order_ = nullptr;
+      at_ = 0;
+      end_ = source.size();
+      if (!(idx >> 5)) return;
+      size_t slot = size_t(idx >> 5) - 1;
+      size_t key = source.keys_[slot];
+      order_ = &source.orders_[slot];
+      auto first = order_->begin(), last = order_->end();
+      // first row of the order above (strict) or from v
+      auto from = [&](::sqlite3_value* v, bool strict) {
+        return std::partition_point(first, last, [&](size_t r) {
+          int cmp = columns::compare(source.row(r), key, v);
+          return strict ? cmp <= 0 : cmp < 0;
+        });
+      };
+      int arg = 0;
+      for (int flag : { use_eq, use_ge, use_gt, use_le, use_lt }) {
+        if (!(idx & flag)) continue;
+        auto* v = argv[arg++];
+        if (!columns::usable(key, v)) continue; // SQLite compares it with affinity
+        if (flag == use_eq) {
+          auto lo = from(v, false);
+          last = from(v, true);
+          first = lo;
+        }
+        if (flag == use_ge || flag == use_gt) first = from(v, flag == use_gt);
+        if (flag == use_le || flag == use_lt) last = from(v, flag == use_le);
+      }
+      at_ = size_t(first - order_->begin());
+      end_ = std::max(at_, size_t(last - order_->begin()));
+    }
+
+    bool eof() const { return at_ >= end_; }
+    void next() { ++at_; }
+    ::sqlite3_int64 rowid() const { return ::sqlite3_int64(order_ ? (*order_)[at_] : at_); }
+    tuple const& row(range_source const& source) const { return source.row(size_t(rowid())); }
+
+  private:
+    std::vector<size_t> const* order_ = nullptr;
+    size_t at_ = 0;
+    size_t end_ = 0;
+  };
+
+private:
+  std::shared_ptr<Range const> rows_;
+  std::vector<size_t> keys_;                // columns
+  std::vector<std::vector<size_t>> orders_; // of keys
+};
+
+/*
+ * Rows of a generator, every scan opens a new one
+ */
+template<class Tuple>
+class generator_source {
+public:
+  typedef Tuple tuple;
+  typedef tuple_columns<tuple> columns;
+  typedef std::function<bool(tuple&)> generator;  // next row, false at the end
+  typedef std::function<generator()> factory;
+
+  generator_source(factory open) : open_(std::move(open)) {}
+
+  void best_index(::sqlite3_index_info* info) const {
+    info->idxNum = 0;
+    info->estimatedCost = 1e6;
+  }
+
+  class cursor {
+  public:
+    void filter(generator_source const& source, int, int, ::sqlite3_value**) {
+      next_ = source.open_();
+      rowid_ = -1;
+      next();
+    }
+
+    bool eof() const { return eof_; }
+
+    void next() {
+      eof_ = !next_ || !next_(row_);
+      ++rowid_;
+    }
+
+    ::sqlite3_int64 rowid() const { return rowid_; }
+    tuple const& row(generator_source const&) const { return row_; }
+
+  private:
+    generator next_;
+    tuple row_;
+    ::sqlite3_int64 rowid_ = 0;
+    bool eof_ = true;
+  };
+
+private:
+  factory open_;
+};
+
+/*
+ * Read-only eponymous virtual table module of a source, the table is
+ * there by the name of the module (no CREATE VIRTUAL TABLE)
+ */
+template<class Source>
+struct vtab {
+  struct table : ::sqlite3_vtab {
+    Source const* source;
+    std::vector<std::string> const* names;
+  };
+
+  struct scan : ::sqlite3_vtab_cursor {
+    typename Source::cursor cursor;
+  };
+
+  // source and column names, owned by SQLite
+  struct aux {
+    Source source;
+    std::vector<std::string> names;
+  };
+
+  static int connect(::sqlite3* db, void* data, int, char const* const*, ::sqlite3_vtab** out, char**) {
+    auto* a = static_cast<aux*>(data);
+    std::string decl = "CREATE TABLE x(";
+    for (size_t i = 0; i < a->names.size(); ++i) {
+      if (i) decl += ", ";
+      decl += '"';
+      for (char c : a->names[i]) decl.append(c == '"' ? 2 : 1, c);
+      decl += "\" ";
+      decl += Source::columns::decl(i);
+    }
+    decl += ')';
+    int err = ::sqlite3_declare_vtab(db, decl.c_str());
+    if (err != SQLITE_OK) return err;
+    auto* t = new table();
+    t->source = &a->source;
+    t->names = &a->names;
+    *out = t;
+    return SQLITE_OK;
+  }
+
+  static int disconnect(::sqlite3_vtab* t) {
+    delete static_cast<table*>(t);
+    return SQLITE_OK;
+  }
+
+  static int best_index(::sqlite3_vtab* t, ::sqlite3_index_info* info) {
+    static_cast<table*>(t)->source->best_index(info);
+    return SQLITE_OK;
+  }
+
+  static int open(::sqlite3_vtab*, ::sqlite3_vtab_cursor** out) {
+    *out = new scan();
+    return SQLITE_OK;
+  }
+
+  static int close(::sqlite3_vtab_cursor* c) {
+    delete static_cast<scan*>(c);
+    return SQLITE_OK;
+  }
+
+  static Source const& source_of(::sqlite3_vtab_cursor* c) {
+    return *static_cast<table*>(c->pVtab)->source;
+  }
+
+  static int filter(::sqlite3_vtab_cursor* c, int idx, char const*, int argc, ::sqlite3_value** argv) {
+    try {
+      static_cast<scan*>(c)->cursor.filter(source_of(c), idx, argc, argv);
+    } catch (...) {
+      return SQLITE_ERROR;
+    }
+    return SQLITE_OK;
+  }
+
+  static int next(::sqlite3_vtab_cursor* c) {
+    try {
+      static_cast<scan*>(c)->cursor.next();
+    } catch (...) {
+      return SQLITE_ERROR;
+    }
+    return SQLITE_OK;
+  }
+
+  static int eof(::sqlite3_vtab_cursor* c) { return static_cast<scan*>(c)->cursor.eof(); }
+
+  static int column(::sqlite3_vtab_cursor* c, ::sqlite3_context* ctx, int i) {
+    Source::columns::set(ctx, static_cast<scan*>(c)->cursor.row(source_of(c)), size_t(i));
+    return SQLITE_OK;
+  }
+
+  static int rowid(::sqlite3_vtab_cursor* c, ::sqlite3_int64* id) {
+    *id = static_cast<scan*>(c)->cursor.rowid();
+    return SQLITE_OK;
+  }
+
+  static void destroy(void* a) { delete static_cast<aux*>(a); }
+
+  static ::sqlite3_module const* module() {
+    static ::sqlite3_module const m = make();
+    return &m;
+  }
+
+  static ::sqlite3_module make() {
+    ::sqlite3_module m;
+    std::memset(&m, 0, sizeof(m));
+    m.xConnect = &connect;     // no xCreate, eponymous only
+    m.xBestIndex = &best_index;
+    m.xDisconnect = &disconnect;
+    m.xDestroy = &disconnect;
+    m.xOpen = &open;
+    m.xClose = &close;
+    m.xFilter = &filter;
+    m.xNext = &next;
+    m.xEof = &eof;
+    m.xColumn = &column;
+    m.xRowid = &rowid;
+    return m;
+  }
+};
+#endif
+
+struct checkpoint_options {
+  std::chrono::milliseconds interval{1000};       // between PASSIVE checkpoints
+  int restart_frames = 4096;                      // WAL frames escalating to RESTART
+  int truncate_frames = 65536;                    // to TRUNCATE, WAL file shrinks to 0
+  std::chrono::milliseconds busy_timeout{100};    // RESTART and TRUNCATE wait for readers
+};
+
+struct checkpoint_stats {
+  std::uint64_t checkpoints = 0;   // PASSIVE ones that succeeded
+  std::uint64_t restarts = 0;      // escalated
+  std::uint64_t truncates = 0;
+  std::uint64_t busy = 0;          // not completed for readers or writers
+  std::uint64_t failed = 0;
+  std::int64_t wal_frames = 0;     // in WAL before the last checkpoint
+  std::int64_t wal_bytes = 0;
+  std::int64_t max_wal_bytes = 0;
+  std::chrono::microseconds last{0};   // duration of the last checkpoint run
+  std::chrono::microseconds max{0};
+  std::chrono::microseconds total{0};
+};
+
+/*
+ * Background WAL checkpoints on a handle of its own, PASSIVE every
+ * interval (never waits for anyone), RESTART or TRUNCATE once the WAL
+ * grows past a limit. Writers should have auto-checkpoint off so no
+ * commit runs one inline (see connection::background_checkpoints)
+ */
+class checkpointer {
+public:
+  explicit checkpointer(std::string const& path, checkpoint_options options = {})
+    : options_(options) {
+    if (::sqlite3_open_v2(path.c_str(), &db_, SQLITE_OPEN_READWRITE, nullptr) != SQLITE_OK) {
+      ::sqlite3_close_v2(db_);
+      db_ = nullptr;
+      return;
+    }
+    ::sqlite3_wal_autocheckpoint(db_, 0);
+    ::sqlite3_busy_timeout(db_, int(options_.busy_timeout.count()));
+    ::sqlite3_stmt* stmt = nullptr;
+    if (::sqlite3_prepare_v2(db_, "PRAGMA page_size;", -1, &stmt, nullptr) == SQLITE_OK
+     && ::sqlite3_step(stmt) == SQLITE_ROW) {
+      page_size_ = ::sqlite3_column_int64(stmt, 0);
+    }
+    ::sqlite3_finalize(stmt);
+    thread_ = std::thread([this]() { run(); });
+  }
+
+  ~checkpointer() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    wake_.notify_one();
+    if (thread_.joinable()) thread_.join();
+    ::sqlite3_close_v2(db_);
+    if (restore_) restore_();
+  }
+
+  checkpointer(checkpointer&&) = delete;
+  checkpointer(checkpointer const&) = delete;
+  checkpointer& operator=(checkpointer&&) = delete;
+  checkpointer& operator=(checkpointer const&) = delete;
+
+  // false if the database could not be opened
+  bool good() const { return !!db_; }
+
+  // run a checkpoint now instead of at the end of interval
+  void wake() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      now_ = true;
+    }
+    wake_.notify_one();
+  }
+
+  checkpoint_stats stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+  }
+
+private:
+  friend class connection;
+
+  void run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stop_) {
+      wake_.wait_for(lock, options_.interval, [this]() { return stop_ || now_; });
+      if (stop_) break;
+      now_ = false;
+      lock.unlock();
+      checkpoint_stats round;
+      auto start = std::chrono::steady_clock::now();
+      int log = 0;
+      bool ok = checkpoint(SQLITE_CHECKPOINT_PASSIVE, round, log);
+      if (ok && log < 0) {
+        // a handle knows WAL mode once it has read the database
+        ::sqlite3_exec(db_, "PRAGMA schema_version;", nullptr, nullptr, nullptr);
+        ok = checkpoint(SQLITE_CHECKPOINT_PASSIVE, round, log);
+      }
+      round.wal_frames = log;
+      if (ok && log >= options_.truncate_frames) {
+        if (checkpoint(SQLITE_CHECKPOINT_TRUNCATE, round, log)) ++round.truncates;
+      } else if (ok && log >= options_.restart_frames) {
+        if (checkpoint(SQLITE_CHECKPOINT_RESTART, round, log)) ++round.restarts;
+      }
+      auto took = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start);
+      lock.lock();
+      stats_.checkpoints += ok;
+      stats_.restarts += round.restarts;
+      stats_.truncates += round.truncates;
+      stats_.busy += round.busy;
+      stats_.failed += round.failed;
+      stats_.wal_frames = round.wal_frames;
+      stats_.wal_bytes = round.wal_frames > 0 ? 32 + round.wal_frames * (page_size_ + 24) : 0;
+      stats_.max_wal_bytes = std::max(stats_.max_wal_bytes, stats_.wal_bytes);
+      stats_.last = took;
+      stats_.max = std::max(stats_.max, took);
+      stats_.total += took;
+    }
+  }
+
+  // log is frames in WAL (-1 if not in WAL mode)
+  bool checkpoint(int mode, checkpoint_stats& round, int& log) {
+    int done = 0;
+    int err = ::sqlite3_wal_checkpoint_v2(db_, nullptr, mode, &log, &done);
+    if (err == SQLITE_BUSY) ++round.busy;
+    else if (err != SQLITE_OK) ++round.failed;
+    return err == SQLITE_OK;
+  }
+
+  ::sqlite3* db_ = nullptr;
+  checkpoint_options options_;
+  std::int64_t page_size_ = 4096;
+  bool stop_ = false;
+  bool now_ = false;
+  checkpoint_stats stats_;
+  mutable std::mutex mutex_;
+  std::condition_variable wake_;
+  std::thread thread_;
+  std::function<void()> restore_;   // auto-checkpoint of the connection
 };
 
 class connection : public sqlxx::connection {
@@ -273,6 +1218,11 @@ public:
     return std::unique_ptr<sqlxx::connection>{ new connection(name) };
   }
 
+  ~connection() override {
+    std::lock_guard<std::mutex> guard(self_->mutex);
+    self_->handle = nullptr;
+  }
+
   void vacuum() override { db_.vacuum(); }
   std::string version() override { return db_.version(); }
 
@@ -280,9 +1230,295 @@ public:
     return std::unique_ptr<sqlitexx::query>{ new sqlitexx::query(db_, str) };
   }
 
+  // local database never reconnects, settings (i.e. PRAGMA) are run once
+  bool session(std::string const& str) override {
+    return ::sqlite3_exec(db_(), str.c_str(), nullptr, nullptr, nullptr) == SQLITE_OK;
+  }
+
+  // since 3.15
+  bool row_values() const override { return SQLITE_VERSION_NUMBER >= 3015000; }
+
+  std::unique_ptr<sqlxx::bulk_insert> bulk(std::string const& table,
+                                           std::vector<std::string> const& columns) override {
+    return std::unique_ptr<sqlxx::bulk_insert>{ new bulk_insert(db_, table, columns) };
+  }
+
+  size_t begin() override {
+    auto&& lock = db_();
+    return db_.transactions().begin(transaction::exec(lock));
+  }
+
+  bool commit(size_t level) override {
+    auto&& lock = db_();
+    return db_.transactions().commit(level, transaction::exec(lock));
+  }
+
+  bool rollback(size_t level) override {
+    auto&& lock = db_();
+    return db_.transactions().rollback(level, transaction::exec(lock));
+  }
+
+  result_type transaction_result() const override {
+#ifdef USE_SHARED_CONNECTION
+    auto&& lock = db_();
+#endif
+    return db_.transactions().result();
+  }
+
+  /*
+   * SQL functions run by SQLite itself, argument and result types are
+   * deduced from the callable (integers, floats, std::string, blob or
+   * sqlxx::field_type for any and NULL). Deterministic by default, so
+   * SQLite may factor them out of loops and use them in indexes, pass
+   * flags 0 otherwise. Functions should not use the connection
+   */
+  template<class F>
+  bool create_function(std::string const& name, F fn, int flags = SQLITE_DETERMINISTIC) {
+    typedef function<F> udf;
+    auto&& lock = db_();
+    // SQLite owns the callable, it's deleted on failure too
+    return ::sqlite3_create_function_v2(lock, name.c_str(), udf::traits::arity, SQLITE_UTF8 | flags,
+                                        new F(std::move(fn)), &udf::call, nullptr, nullptr,
+                                        &udf::destroy) == SQLITE_OK;
+  }
+
+  // aggregate of State, see sqlitexx::aggregate
+  template<class State>
+  bool create_aggregate(std::string const& name, int flags = SQLITE_DETERMINISTIC) {
+    typedef aggregate<State> udf;
+    auto&& lock = db_();
+    return ::sqlite3_create_function_v2(lock, name.c_str(), udf::traits::arity, SQLITE_UTF8 | flags,
+                                        nullptr, nullptr, &udf::step, &udf::final,
+                                        nullptr) == SQLITE_OK;
+  }
+
+#if SQLITE_VERSION_NUMBER >= 3025000
+  // aggregate of State usable as window function (OVER ...), State has inverse
+  template<class State>
+  bool create_window(std::string const& name, int flags = SQLITE_DETERMINISTIC) {
+    typedef aggregate<State> udf;
+    auto&& lock = db_();
+    return ::sqlite3_create_window_function(lock, name.c_str(), udf::traits::arity, SQLITE_UTF8 | flags,
+                                            nullptr, &udf::step, &udf::final, &udf::value,
+                                            &udf::inverse, nullptr) == SQLITE_OK;
+  }
+#endif
+
+
+#if SQLITE_VERSION_NUMBER >= 3009000
+  /*
+   * Random access range of tuples as read-only table name (columns in
+   * order of the tuple), shared so it's alive while SQLite reads it.
+   * Key columns are numbers or text with equality and range constraints
+   * (and ORDER BY) served by binary search, their orders are built here
+   */
+  template<class Range>
+  bool register_vtab(std::string const& name, std::shared_ptr<Range> rows,
+                     std::vector<std::string> const& columns,
+                     std::vector<std::string> const& keys = {}) {
+    typedef range_source<typename std::remove_const<Range>::type> source;
+    if (!rows || columns.size() != std::tuple_size<typename source::tuple>::value) return false;
+    std::vector<size_t> key_columns;
+    for (auto const& key : keys) {
+      size_t i = size_t(std::find(columns.begin(), columns.end(), key) - columns.begin());
+      if (i == columns.size() || !source::columns::key(i)) return false;
+      key_columns.push_back(i);
+    }
+    return register_module<source>(name, source(std::move(rows), std::move(key_columns)), columns);
+  }
+
+  // generator of tuples as read-only table name, a scan is a full run of a new generator
+  template<class Tuple>
+  bool register_vtab(std::string const& name,
+                     typename generator_source<Tuple>::factory open,
+                     std::vector<std::string> const& columns) {
+    if (!open || columns.size() != std::tuple_size<Tuple>::value) return false;
+    return register_module<generator_source<Tuple>>(name, generator_source<Tuple>(std::move(open)), columns);
+  }
+#endif
+
+  /*
+   * WAL checkpoints of this database moved to a checkpointer thread,
+   * auto-checkpoint of this connection is off until the checkpointer is
+   * destroyed (if the connection is still there), null for an in-memory
+   * database
+   */
+  std::unique_ptr<checkpointer> background_checkpoints(checkpoint_options options = {}) {
+    std::string path;
+    {
+      auto&& lock = db_();
+      auto const* name = ::sqlite3_db_filename(lock, "main");
+      if (!name || !*name) return {};
+      path = name;
+    }
+    std::unique_ptr<checkpointer> wal{ new checkpointer(path, options) };
+    if (!wal->good()) return {};
+    auto&& lock = db_();
+    int pages = 1000;  // SQLite default
+    ::sqlite3_stmt* stmt = nullptr;
+    if (::sqlite3_prepare_v2(lock, "PRAGMA wal_autocheckpoint;", -1, &stmt, nullptr) == SQLITE_OK
+     && ::sqlite3_step(stmt) == SQLITE_ROW) {
+      pages = ::sqlite3_column_int(stmt, 0);
+    }
+    ::sqlite3_finalize(stmt);
+    ::sqlite3_wal_autocheckpoint(lock, 0);
+    auto self = self_;
+    wal->restore_ = [self, pages]() {
+      std::lock_guard<std::mutex> guard(self->mutex);
+      if (!self->handle) return;
+      auto&& lock = (*self->handle)();
+      ::sqlite3_wal_autocheckpoint(lock, pages);
+    };
+    return wal;
+  }
+
+  // progress of a backup after a step, pages left of the total, false stops it
+  typedef std::function<bool(int remaining, int total)> backup_progress;
+
+  /*
+   * Online copy of the database into another one by sqlite3_backup,
+   * pages_per_step pages at a time (-1 for all at once). The connection
+   * is locked by a step only so writers go on between steps; a step
+   * busy by another handle is retried with backoff (SQL_BUSY after
+   * busy_retries) and pages written by others (or any write to an
+   * in-memory database) restart the copy, after a few restarts the rest
+   * is copied in one step. The destination is replaced, a stopped copy
+   * returns SQL_IMPROPER and leaves it as it was
+   */
+  result_type backup_to(connection& other, int pages_per_step = 256, backup_progress progress = {}) {
+    if (&other == this) return SQL_IMPROPER;
+    // both locked by every step, in address order
+    bool mine = this < &other;
+    db const* first = mine ? &db_ : &other.db_;
+    db const* second = mine ? &other.db_ : &db_;
+    return backup(pages_per_step, progress, [first, second, mine](backup_step const& fn) {
+      auto&& a = (*first)();
+      auto&& b = (*second)();
+      ::sqlite3* source = mine ? a : b;
+      ::sqlite3* dest = mine ? b : a;
+      fn(source, dest);
+    });
+  }
+
+  // copy into database file path (created if missing)
+  result_type backup_to(std::string const& path, int pages_per_step = 256, backup_progress progress = {}) {
+    ::sqlite3* file = nullptr;
+    int err = ::sqlite3_open_v2(path.c_str(), &file, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, nullptr);
+    if (err != SQLITE_OK) {
+      ::sqlite3_close_v2(file);
+      return to_result(err);
+    }
+    auto result = backup(pages_per_step, progress, [this, file](backup_step const& fn) {
+      auto&& source = db_();
+      fn(source, file);
+    });
+    ::sqlite3_close_v2(file);
+    return result;
+  }
+
+  // in-memory copy of database file path to serve reads from RAM, null on failure
+  static std::unique_ptr<sqlxx::connection> load_into_memory(std::string const& path,
+                                                             int pages_per_step = -1,
+                                                             backup_progress progress = {}) {
+    ::sqlite3* file = nullptr;
+    if (::sqlite3_open_v2(path.c_str(), &file, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK) {
+      ::sqlite3_close_v2(file);
+      return {};
+    }
+    std::unique_ptr<connection> memory{ new connection(":memory:") };
+    auto result = backup(pages_per_step, progress, [&memory, file](backup_step const& fn) {
+      auto&& dest = memory->db_();
+      fn(file, dest);
+    });
+    ::sqlite3_close_v2(file);
+    if (result != SQL_OK) return {};
+    return std::unique_ptr<sqlxx::connection>{ memory.release() };
+  }
+
 private:
+  typedef std::function<void(::sqlite3* source, ::sqlite3* dest)> backup_step;
+
+  // restarts of a backup by writes before it copies the rest at once
+  static constexpr int max_restarts = 3;
+
+  // waits for a busy step, 10 ms doubling up to 1 s, about 3 s in all
+  static sqlxx::backoff busy_retries() {
+    sqlxx::backoff policy;
+    policy.attempts = 10;
+    return policy;
+  }
+
+  // backup by steps, with runs a step on source and dest locked
+  template<class With>
+  static result_type backup(int pages, backup_progress const& progress, With const& with) {
+    ::sqlite3_backup* b = nullptr;
+    int err = SQLITE_OK;
+    with([&b, &err](::sqlite3* source, ::sqlite3* dest) {
+      b = ::sqlite3_backup_init(dest, "main", source, "main");
+      if (!b) err = ::sqlite3_errcode(dest);
+    });
+    if (!b) return to_result(err == SQLITE_OK ? SQLITE_ERROR : err);
+    int remaining = 0, total = 0, restarts = 0;
+    size_t busy_waits = 0;
+    auto const retries = busy_retries();
+    bool stopped = false;
+    for (;;) {
+      int left = remaining;
+      // copy restarted too often by writes, the rest goes in one step
+      int step = pages > 0 && restarts < max_restarts ? pages : -1;
+      with([b, step, &err, &remaining, &total](::sqlite3*, ::sqlite3*) {
+        err = ::sqlite3_backup_step(b, step);
+        remaining = ::sqlite3_backup_remaining(b);
+        total = ::sqlite3_backup_pagecount(b);
+      });
+      if (remaining > left && left) ++restarts;
+      bool busy = err == SQLITE_BUSY || err == SQLITE_LOCKED;
+      if (err != SQLITE_OK && err != SQLITE_DONE && !busy) break;
+      if (progress && !progress(remaining, total) && err != SQLITE_DONE) {
+        stopped = true;
+        break;
+      }
+      if (err == SQLITE_DONE) break;
+      if (!busy) {
+        busy_waits = 0;
+        std::this_thread::yield();
+      } else if (++busy_waits < retries.attempts) {
+        // source or destination is written by another handle
+        retries.wait(busy_waits);
+      } else {
+        break;
+      }
+    }
+    int done = SQLITE_OK;
+    with([b, &done](::sqlite3*, ::sqlite3*) { done = ::sqlite3_backup_finish(b); });
+    if (stopped) return SQL_IMPROPER;
+    return to_result(err == SQLITE_DONE ? done : err);
+  }
+
+#if SQLITE_VERSION_NUMBER >= 3009000
+  template<class Source>
+  bool register_module(std::string const& name, Source&& source, std::vector<std::string> const& columns) {
+    typedef vtab<typename std::decay<Source>::type> module;
+    auto&& lock = db_();
+    // SQLite owns aux, it's deleted on failure too
+    return ::sqlite3_create_module_v2(lock, name.c_str(), module::module(),
+                                      new typename module::aux{ std::move(source), columns },
+                                      &module::destroy) == SQLITE_OK;
+  }
+#endif
+
+  // the database while the connection lives, for objects that may outlive it
+  struct self_ref {
+    std::mutex mutex;
+    db const* handle = nullptr;
+  };
+
   db db_;
-  connection(std::string const& name) : db_{ name } {}
+  std::shared_ptr<self_ref> self_;
+
+  connection(std::string const& name) : db_{ name }, self_(std::make_shared<self_ref>()) {
+    self_->handle = &db_;
+  }
 };
 
 } // namespace sqlitexx
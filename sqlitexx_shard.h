@@ -0,0 +1,293 @@
+///////////////////////////////////////////////////////////////////////////////
+/// \author (c) Anthony Fieroni (bvbfan@abv.bg)
+///             2017, Plovdiv, Bulgaria
+///
+/// \license The MIT License (MIT)
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights
+/// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+/// copies of the Software, and to permit persons to whom the Software is
+/// furnished to do so, subject to the following conditions:
+///
+/// The above copyright notice and this permission notice shall be included in
+/// all copies or substantial portions of the Software.
+///
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+/// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+/// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+/// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+/// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+/// THE SOFTWARE.
+///////////////////////////////////////////////////////////////////////////////
+
+
+
+#ifndef _SQLITEXX_SHARD_H_
+#define _SQLITEXX_SHARD_H_
+
+#include "sqlitexx.h"
+#include "sqlxx_sql.h"
+#include "sqlxx_write.h"
+#include "sqlxx_router.h"
+
+#include <deque>
+#include <future>
+
+namespace sqlitexx {
+
+/*
+ * Logical database over N SQLite files (path.0 ... path.N-1) sharded by
+ * a key of the binds (see sqlxx::shard_router::hash_key). SQLite has one
+ * writer per file, so shards write in parallel: every shard has its own
+ * handle and writer thread (write_buffer) for write(), and a bulk load
+ * runs a thread per shard. Queries with the key run on its shard, reads
+ * and DDL without it on all shards at once with rows concatenated or
+ * merged in order, writes without it fail. Writer threads use the
+ * shards too, define USE_SHARED_CONNECTION to query while they write
+ */
+class sharded_connection : public sqlxx::connection {
+public:
+  typedef sqlxx::shard_router::shard_key shard_key;
+
+  static std::unique_ptr<sharded_connection> create(std::string const& path, size_t shards,
+                                                    shard_key key,
+                                                    sqlxx::write_options options = {}) {
+    if (!shards || !key) return {};
+    std::unique_ptr<sharded_connection> con{ new sharded_connection(std::move(key)) };
+    std::vector<std::unique_ptr<sqlxx::connection>> all;
+    for (size_t i = 0; i < shards; ++i) {
+      // every in-memory shard is a database of its own
+      all.push_back(sqlitexx::connection::create(path == ":memory:" ? path : path + "." + std::to_string(i)));
+      con->shards_.push_back(static_cast<sqlitexx::connection*>(all.back().get()));
+    }
+    con->router_ = sqlxx::shard_router::create(std::move(all), con->key_);
+    if (!con->router_) return {};
+    for (auto* shard : con->shards_) {
+      con->writers_.emplace_back(new sqlxx::write_buffer(*shard, options));
+    }
+    return con;
+  }
+
+  ~sharded_connection() override {
+    writers_.clear(); // flushed before the shards close
+  }
+
+  void vacuum() override { router_->vacuum(); }
+  std::string version() override { return router_->version(); }
+
+  std::unique_ptr<sqlxx::query> query(std::string const& str) override {
+    return router_->query(str);
+  }
+
+  // rows of all shards merged in order of a column (see shard_router)
+  std::unique_ptr<sqlxx::query> query(std::string const& str, std::string const& order_by,
+                                      bool descending = false) {
+    return router_->query(str, order_by, descending);
+  }
+
+  bool session(std::string const& str) override { return router_->session(str); }
+  bool row_values() const override { return router_->row_values(); }
+
+  // rows are handed to a loader thread of their shard, a row without the
+  // key fails. The key reads the values by column position, so a key of
+  // write() by bind position routes a row of the same columns the same
+  std::unique_ptr<sqlxx::bulk_insert> bulk(std::string const& table,
+                                           std::vector<std::string> const& columns) override {
+    return std::unique_ptr<sqlxx::bulk_insert>{ new parallel_insert(*this, table, columns) };
+  }
+
+  // fire and forget write by the writer of its shard, a write without
+  // the key fails (counted in stats). The text is trusted, it is sent as
+  // written and not escaped (see write_buffer)
+  template<class... Args>
+  void write(std::string const& text, Args&&... args) {
+    auto set = binds(std::forward<Args>(args)...);
+    size_t shard = shard_of(set);
+    if (shard == sqlxx::shard_router::all) {
+      ++keyless_;
+      return;
+    }
+    writers_[shard]->write_set(text, std::move(set));
+  }
+
+  // ready once committed, SQL_IMPROPER without the key
+  template<class... Args>
+  std::future<result_type> write_acked(std::string const& text, Args&&... args) {
+    auto set = binds(std::forward<Args>(args)...);
+    size_t shard = shard_of(set);
+    if (shard == sqlxx::shard_router::all) {
+      ++keyless_;
+      std::promise<result_type> failed;
+      failed.set_value(SQL_IMPROPER);
+      return failed.get_future();
+    }
+    return writers_[shard]->write_set_acked(text, std::move(set));
+  }
+
+  // waits until writes queued before are committed on all shards
+  void flush() {
+    for (auto& writer : writers_) writer->flush();
+  }
+
+  // of all writers
+  sqlxx::write_stats stats() const {
+    sqlxx::write_stats total;
+    total.writes = total.failed = keyless_;
+    for (auto const& writer : writers_) {
+      auto s = writer->stats();
+      total.writes += s.writes;
+      total.failed += s.failed;
+      total.commits += s.commits;
+      total.batches += s.batches;
+    }
+    return total;
+  }
+
+  // number of shards
+  size_t size() const { return shards_.size(); }
+
+  // a shard, i.e. for its functions or checkpoints
+  sqlitexx::connection& shard(size_t i) { return *shards_[i]; }
+
+private:
+  template<class... Args>
+  static std::vector<sqlxx::field_type> binds(Args&&... args) {
+    std::vector<sqlxx::field_type> binds;
+    binds.reserve(sizeof...(Args));
+    using expand = int[];
+    (void)expand{ 0, (binds.push_back(sqlxx::bind_field(std::forward<Args>(args))), 0)... };
+    return binds;
+  }
+
+  size_t shard_of(std::vector<sqlxx::field_type> const& binds) const {
+    size_t shard = key_(binds, shards_.size());
+    return shard == sqlxx::shard_router::all ? shard : shard % shards_.size();
+  }
+
+  /*
+   * Bulk load of all shards at once, rows go in batches to a thread per
+   * shard which writes them to the bulk load of its shard
+   */
+  class parallel_insert : public sqlxx::bulk_insert {
+  public:
+    parallel_insert(sharded_connection& con, std::string const& table,
+                    std::vector<std::string> const& columns) : con_(con) {
+      for (auto* shard : con_.shards_) {
+        lanes_.emplace_back(new lane());
+        auto* l = lanes_.back().get();
+        l->thread = std::thread([l, shard, table, columns]() { l->run(*shard, table, columns); });
+      }
+    }
+
+    // not finished is rolled back
+    ~parallel_insert() override { stop(); }
+
+    bool write(std::vector<sqlxx::field_type> const& values) override {
+      size_t shard = con_.shard_of(values);
+      if (!ok_ || shard == sqlxx::shard_router::all) return ok_ = false;
+      auto& l = *lanes_[shard];
+      l.pending.push_back(values);
+      if (l.pending.size() >= batch_rows) ok_ = l.hand_off();
+      return ok_;
+    }
+
+    // shards commit one by one, a failed shard does not undo the others
+    bool finish() override {
+      for (auto& l : lanes_) {
+        if (ok_ && !l->pending.empty()) ok_ = l->hand_off();
+      }
+      stop();
+      for (auto& l : lanes_) {
+        if (!l->load) continue;
+        if (ok_) ok_ = l->ok && l->load->finish();
+        else l->load.reset(); // rolled back
+      }
+      return ok_;
+    }
+
+  private:
+    // rows handed to a thread at once, and batches queued before write waits
+    static constexpr size_t batch_rows = 512;
+    static constexpr size_t max_batches = 16;
+
+    typedef std::vector<std::vector<sqlxx::field_type>> batch;
+
+    struct lane {
+      batch pending;                  // of the writing thread
+      std::deque<batch> queue;
+      std::unique_ptr<sqlxx::bulk_insert> load;
+      bool ok = true;
+      bool done = false;
+      std::mutex mutex;
+      std::condition_variable ready;  // for the loader
+      std::condition_variable room;   // for the writer
+      std::thread thread;
+
+      // false if the loader failed
+      bool hand_off() {
+        std::unique_lock<std::mutex> lock(mutex);
+        room.wait(lock, [this]() { return queue.size() < max_batches || !ok; });
+        if (!ok) return false;
+        queue.push_back(std::move(pending));
+        pending.clear();
+        ready.notify_one();
+        return true;
+      }
+
+      void run(sqlxx::connection& shard, std::string const& table, std::vector<std::string> const& columns) {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+          ready.wait(lock, [this]() { return done || !queue.empty(); });
+          if (queue.empty()) return;
+          auto rows = std::move(queue.front());
+          queue.pop_front();
+          room.notify_one();
+          lock.unlock();
+          if (!load) load = shard.bulk(table, columns);
+          bool good = !!load;
+          for (size_t i = 0; good && i < rows.size(); ++i) good = load->write(rows[i]);
+          lock.lock();
+          if (!good) {
+            ok = false;
+            queue.clear();
+            room.notify_one();
+          }
+        }
+      }
+    };
+
+    void stop() {
+      for (auto& l : lanes_) {
+        {
+          std::lock_guard<std::mutex> lock(l->mutex);
+          l->done = true;
+        }
+        l->ready.notify_one();
+        if (l->thread.joinable()) l->thread.join();
+      }
+    }
+
+    sharded_connection& con_;
+    std::vector<std::unique_ptr<lane>> lanes_;
+    bool ok_ = true;
+  };
+
+  sharded_connection(shard_key key) : key_(std::move(key)) {}
+
+  sharded_connection(sharded_connection&&) = delete;
+  sharded_connection(sharded_connection const&) = delete;
+  sharded_connection& operator=(sharded_connection&&) = delete;
+  sharded_connection& operator=(sharded_connection const&) = delete;
+
+  shard_key key_;
+  std::vector<sqlitexx::connection*> shards_;         // owned by router
+  std::unique_ptr<sqlxx::shard_router> router_;
+  std::vector<std::unique_ptr<sqlxx::write_buffer>> writers_;
+  std::atomic<std::uint64_t> keyless_{ 0 };  // failed writes without the key
+};
+
+} // namespace sqlitexx
+
+#endif  // _SQLITEXX_SHARD_H_
@@ -30,10 +30,15 @@
 #include <tuple>
 #include <cmath>
 #include <regex>
+#include <cctype>
 #include <limits>
 #include <memory>
 #include <vector>
 #include <string>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <atomic>
 #include <utility>
 #include <sstream>
 #include <cstdint>
@@ -41,11 +46,11 @@
 #include <iomanip>
 #include <iterator>
 #include <algorithm>
+#include <functional>
 #include <initializer_list>
 
 #ifdef USE_SHARED_CONNECTION
 #include <mutex>
-#include <atomic>
 #endif
 
 typedef std::initializer_list<std::string> format;
@@ -75,8 +80,16 @@ enum result_type {
   SQL_NO_MEMORY,
   SQL_SERVER_LOST,
   SQL_UNKNOWN_ERROR,
+  SQL_BUSY,           // lock not granted in time (i.e. SQLITE_BUSY)
+  SQL_DEADLOCK,       // chosen as deadlock victim, transaction rolled back
+  SQL_SERIALIZATION,  // serializable transaction conflict
 };
 
+// transaction failed on contention, running it again may succeed
+static inline bool is_retryable(result_type result) {
+  return result == SQL_BUSY || result == SQL_DEADLOCK || result == SQL_SERIALIZATION;
+}
+
 class blob {
 public:
   typedef std::uint8_t value_type;
@@ -116,6 +129,39 @@ private:
   std::string data_;
 };
 
+/*
+ * Non-owning text or blob bind, the data must stay alive until execute() returns
+ */
+class bind_ref {
+public:
+  bind_ref(std::string const& s) : data_(s.c_str()), size_(s.size()), type_(SQL_TEXT) {}
+  bind_ref(char const* s) : data_(s), size_(std::strlen(s)), type_(SQL_TEXT) {}
+  bind_ref(blob const& b)
+    : data_(reinterpret_cast<char const*>(b.data())), size_(b.size()), type_(SQL_BLOB) {}
+  bind_ref(void const* p, size_t size)
+    : data_(static_cast<char const*>(p)), size_(size), type_(SQL_BLOB) {}
+
+  char const* data() const { return data_; }
+  size_t size() const { return size_; }
+  sql_type type() const { return type_; }
+
+private:
+  char const* data_;
+  size_t size_;
+  sql_type type_;
+};
+
+// strings and blobs are bound by reference, other values by value
+template<class T> inline
+T const& as_ref(T const& t) { return t; }
+inline bind_ref as_ref(std::string const& s) { return s; }
+inline bind_ref as_ref(blob const& b) { return b; }
+
+template<class...Args> inline
+auto values_ref(Args const&... p) -> decltype(std::make_tuple(as_ref(p)...)) {
+  return std::make_tuple(as_ref(p)...);
+}
+
 namespace sqlxx {
 
 #ifdef USE_SHARED_CONNECTION
@@ -136,27 +182,207 @@ private:
 };
 #endif
 
+/*
+ * Transaction stack of a connection, level 1 is BEGIN/COMMIT and nested
+ * levels are savepoints, so an inner scope never ends its caller's
+ * transaction, exec runs a statement (call it with lock held)
+ */
+class transaction_stack {
+public:
+  typedef std::function<result_type(char const*)> exec_type;
+
+  size_t depth() const { return depth_; }
+
+  // result of the last begin, commit or rollback
+  result_type result() const { return result_; }
+
+  // opens the next level, returns it or 0 on failure
+  size_t begin(exec_type const& exec) {
+    if (!run(exec, depth_ ? savepoint("SAVEPOINT ", depth_ + 1).c_str() : "BEGIN;")) return 0;
+    return ++depth_;
+  }
+
+  // closes level with the ones above it, open on failure
+  bool commit(size_t level, exec_type const& exec) {
+    if (!level || level > depth_) return fail();
+    if (!run(exec, level == 1 ? "COMMIT;" : savepoint("RELEASE SAVEPOINT ", level).c_str())) return false;
+    depth_ = level - 1;
+    return true;
+  }
+
+  // level is closed even on failure
+  bool rollback(size_t level, exec_type const& exec) {
+    if (!level || level > depth_) return fail();
+    depth_ = level - 1;
+    if (level == 1) return run(exec, "ROLLBACK;");
+    return run(exec, savepoint("ROLLBACK TO SAVEPOINT ", level).c_str())
+        && run(exec, savepoint("RELEASE SAVEPOINT ", level).c_str());
+  }
+
+  // server dropped the transaction (i.e. reconnect)
+  void reset() { depth_ = 0; }
+
+private:
+  bool run(exec_type const& exec, char const* sql) {
+    result_ = exec(sql);
+    return result_ == SQL_OK;
+  }
+
+  // level is gone (i.e. reconnect)
+  bool fail() {
+    result_ = SQL_IMPROPER;
+    return false;
+  }
+
+  static std::string savepoint(char const* verb, size_t level) {
+    return verb + std::string("sqlxx_") + std::to_string(level) + ';';
+  }
+
+  size_t depth_ = 0;
+  result_type result_ = SQL_OK;
+};
+
+/*
+ * Exponential backoff with jitter
+ */
+struct backoff {
+  size_t attempts = 5;  // 0 disables it
+  std::chrono::milliseconds initial = std::chrono::milliseconds(10);
+  std::chrono::milliseconds maximum = std::chrono::milliseconds(1000);
+  double jitter = 0.5;  // random part of the delay [0, 1]
+
+  // delay before attempt, the first one is immediate
+  std::chrono::milliseconds delay(size_t attempt) const {
+    if (!attempt) return std::chrono::milliseconds(0);
+    std::int64_t d = initial.count();
+    d <<= std::min<size_t>(attempt - 1, 30);
+    d = std::min<std::int64_t>(d, maximum.count());
+    static thread_local std::minstd_rand rnd(std::random_device{}());
+    std::uniform_real_distribution<double> part(1.0 - jitter, 1.0);
+    return std::chrono::milliseconds(std::int64_t(d * part(rnd)));
+  }
+
+  void wait(size_t attempt) const {
+    auto d = delay(attempt);
+    if (d.count()) std::this_thread::sleep_for(d);
+  }
+};
+
+/*
+ * Upper cased words of a query with their parenthesis depth,
+ * comments, literals, quoted identifiers and numbers are skipped
+ */
+class query_words {
+public:
+  query_words(char const* query) : p_(query ? query : "") {}
+
+  // next word, false at the end
+  bool next(std::string& word, int& depth) {
+    word.clear();
+    while (*p_) {
+      char c = *p_;
+      if (c == '-' && p_[1] == '-') {
+        while (*p_ && *p_ != '\n') ++p_;
+      } else if (c == '/' && p_[1] == '*') {
+        auto* end = strstr(p_ + 2, "*/");
+        p_ = end ? end + 2 : p_ + strlen(p_);
+      } else if (c == '\'' || c == '"' || c == '`') {
+        // doubled quote is an escaped one
+        for (++p_; *p_; ++p_) {
+          if (*p_ == '\\' && c == '\'' && p_[1]) ++p_;
+          else if (*p_ == c && p_[1] == c) ++p_;
+          else if (*p_ == c) break;
+        }
+        if (*p_) ++p_;
+      } else if (c == '(') {
+        ++depth_; ++p_;
+      } else if (c == ')') {
+        depth_ > 0 && --depth_; ++p_;
+      } else if (std::isalpha(static_cast<unsigned char>(c)) || c == '_') {
+        depth = depth_;
+        while (std::isalnum(static_cast<unsigned char>(*p_)) || *p_ == '_' || *p_ == '$') {
+          word.push_back(char(std::toupper(static_cast<unsigned char>(*p_++))));
+        }
+        return true;
+      } else if (std::isdigit(static_cast<unsigned char>(c)) || c == '$') {
+        while (std::isalnum(static_cast<unsigned char>(*p_)) || *p_ == '.' || *p_ == '$') ++p_;
+      } else {
+        ++p_;
+      }
+    }
+    return false;
+  }
+
+private:
+  char const* p_;
+  int depth_ = 0;
+};
+
+/*
+ * Main statement keyword, leading parenthesis and WITH clauses are skipped
+ */
+static inline
+std::string query_keyword(char const* query) {
+  static char const* const main[] = {
+    "SELECT", "INSERT", "UPDATE", "DELETE", "REPLACE", "MERGE", "VALUES", "TABLE",
+  };
+  query_words words(query);
+  std::string word; int depth = 0, top = -1;
+  bool with = false;
+  while (words.next(word, depth)) {
+    if (top < 0) top = depth;
+    if (depth != top) continue;
+    if (!with) {
+      if (word != "WITH") return word;
+      with = true;
+      continue;
+    }
+    for (auto const* keyword : main) {
+      if (word == keyword) return word;
+    }
+  }
+  return {};
+}
+
 /*
  * Test query produce results
  */
 static
 bool query_has_results(char const* query) {
-  using namespace std::regex_constants;
-  std::regex const expect_results[] = {
-    std::regex("\\b(DESC)\\b", ECMAScript | icase),
-    std::regex("\\b(SHOW)\\b", ECMAScript | icase),
-    std::regex("\\b(EXPLAIN)\\b", ECMAScript | icase),
-    std::regex("\\b(DESCRIBE)\\b", ECMAScript | icase),
-    std::regex("\\b(SELECT)\\b(?![^\\(]*\\))", ECMAScript | icase),
+  static char const* const expect_results[] = {
+    "SELECT", "SHOW", "EXPLAIN", "DESC", "DESCRIBE", "VALUES", "TABLE",
   };
-  for (auto const& expect : expect_results) {
-    if (std::regex_search(query, expect)) {
+  auto keyword = query_keyword(query);
+  for (auto const* expect : expect_results) {
+    if (keyword == expect) {
       return true;
     }
   }
   return false;
 }
 
+/*
+ * Test query only reads, it's safe to run it on a replica or retry it,
+ * locking reads, SELECT INTO and EXPLAIN ANALYZE are not
+ */
+static inline
+bool query_is_read(char const* query) {
+  if (!query_has_results(query)) {
+    return false;
+  }
+  query_words words(query);
+  std::string word, prev; int depth = 0;
+  while (words.next(word, depth)) {
+    if (word == "INTO" || word == "ANALYZE" || word == "LOCK"
+    || (prev == "FOR" && (word == "UPDATE" || word == "SHARE"
+                       || word == "NO" || word == "KEY"))) {
+      return false;
+    }
+    prev = std::move(word);
+  }
+  return true;
+}
+
 /*
  * Representation of a single result field
  */
@@ -164,7 +390,7 @@ struct field_type {
   // ctors
   field_type() {}
   field_type(field_type const& other) { operator=(other); }
-  field_type(field_type&& other) { operator=(std::move(other)); }
+  field_type(field_type&& other) noexcept { operator=(std::move(other)); }
   field_type(std::string const& name) : name_(name), type_(SQL_NULL) {}
   field_type(std::int64_t i, std::string const& name)
     : name_(name), type_(SQL_INTEGER) { int_ = i;  float_ = double(int_); }
@@ -174,14 +400,22 @@ struct field_type {
     : name_(name), type_(SQL_TEXT) { str_ = std::move(s); }
   field_type(std::string const& s, std::string const& name)
     : name_(name), type_(SQL_TEXT) { str_ = s; }
+  // C-strings are copied, bind_ref is only for explicit references
+  field_type(char const* s, std::string const& name)
+    : name_(name), type_(SQL_TEXT) { str_ = s; }
   explicit field_type(blob&& b, std::string const& name)
-    : name_(name), type_(SQL_BLOB) { str_ = std::move(b); }
+    : name_(name), type_(SQL_BLOB) { str_ = static_cast<std::string&&>(std::move(b)); }
   explicit field_type(blob const& b, std::string const& name)
     : name_(name), type_(SQL_BLOB) { str_ = b; }
+  field_type(bind_ref const& r, std::string const& name)
+    : ref_(r.data()), ref_size_(r.size()), name_(name), type_(r.type()) {}
 
+  // a copy owns the bytes of a referenced field, only a move shares them
   field_type& operator=(field_type const& other) {
     if (this != &other) {
-      str_ = other.str_;
+      str_.assign(other.data(), other.size());
+      ref_ = nullptr;
+      ref_size_ = 0;
       int_ = other.int_;
       name_ = other.name_;
       type_ = other.type_;
@@ -190,9 +424,11 @@ struct field_type {
     return *this;
   }
 
-  field_type& operator=(field_type&& other) {
+  field_type& operator=(field_type&& other) noexcept {
     if (this != &other) {
       str_ = std::move(other.str_);
+      ref_ = other.ref_;
+      ref_size_ = other.ref_size_;
       int_ = std::move(other.int_);
       name_ = std::move(other.name_);
       type_ = std::move(other.type_);
@@ -207,10 +443,20 @@ struct field_type {
   operator short() const { return static_cast<short>(int_); }
   operator float() const { return static_cast<float>(float_); }
   operator double const&() const { return float_; }
-  operator std::string const&() const { return str_; }
+  // a referenced text or blob is copied in the field first
+  operator std::string const&() const {
+    if (ref_) {
+      str_.assign(ref_, ref_size_);
+      ref_ = nullptr;
+      ref_size_ = 0;
+    }
+    return str_;
+  }
   operator std::int64_t const&() const { return int_; }
 
-  bool operator==(std::string const& str) const { return type_ == SQL_TEXT && str == str_; }
+  bool operator==(std::string const& str) const {
+    return type_ == SQL_TEXT && str.size() == size() && !str.compare(0, str.npos, data(), size());
+  }
   bool operator==(std::int64_t i64) const { return type_ == SQL_INTEGER && i64 == int_; }
   bool operator==(short i16) const { return type_ == SQL_INTEGER && i16 == short(int_); }
   bool operator==(int i32) const { return type_ == SQL_INTEGER && i32 == int(int_); }
@@ -220,16 +466,24 @@ struct field_type {
 
   std::string toString() const {
     switch (type_) {
-      case SQL_TEXT    : return str_;
+      case SQL_TEXT    : return { data(), size() };
       case SQL_INTEGER : { std::stringstream s; s << int_; return s.str(); }
       case SQL_FLOAT   : { std::stringstream s; s << float_; return s.str(); }
       case SQL_BLOB    : { std::stringstream s; s << "\\x" << std::hex << std::setfill('0');
-                             for (auto const& v : str_) s << (int(v)&0xFF); return s.str(); }
+                             for (size_t i = 0; i < size(); ++i) s << std::setw(2) << (int(data()[i])&0xFF);
+                             return s.str(); }
       case SQL_NULL    : return "NULL";
       default          : return "INVALID";
     }
   }
 
+  // text or blob bytes, owned or referenced
+  inline char const* data() const { return ref_ ? ref_ : str_.data(); }
+  inline size_t size() const { return ref_ ? ref_size_ : str_.size(); }
+
+  // text or blob is referenced, not owned (see bind_ref)
+  inline bool is_ref() const { return !!ref_; }
+
   // column name
   inline std::string name() const { return name_; }
 
@@ -239,16 +493,30 @@ struct field_type {
   // returns true if field is NULL
   inline bool is_null() const { return type_ == SQL_NULL; }
 
+  // copy under another name (i.e. empty to bind it by position),
+  // referenced data is copied
+  field_type renamed(std::string const& name) const {
+    field_type f;
+    f.int_ = int_;
+    f.float_ = float_;
+    f.str_.assign(data(), size());
+    f.name_ = name;
+    f.type_ = type_;
+    return f;
+  }
+
   bool operator==(field_type const& f) const {
     return type_ == f.type_ && int_ == f.int_
-        && str_ == f.str_ && name_ == f.name_
+        && size() == f.size() && !std::memcmp(data(), f.data(), size()) && name_ == f.name_
         && std::fabs(float_ - f.float_) < std::numeric_limits<double>::epsilon();
   }
 
 private:
   std::int64_t          int_ = {};   // int data
   double                float_ = {}; // float data
-  std::string           str_;        // string (blob) data
+  mutable std::string   str_;        // string (blob) data
+  mutable char const*   ref_ = nullptr; // referenced string (blob) data
+  mutable size_t        ref_size_ = 0;
   std::string           name_;       // field (col) name
   sql_type              type_ = SQL_INVALID; // sqlte type
 };
@@ -262,18 +530,69 @@ T const& invalid() {
   return invalid_ref;
 }
 
+/*
+ * Backend row decoded column by column on first access, a backend whose
+ * row goes away on next step detaches it before (decodes the rest)
+ */
+class row_source {
+public:
+  row_source(std::shared_ptr<std::vector<std::string> const> names)
+    : names_(std::move(names)), fields_(names_->size()), decoded_(names_->size()) {}
+
+  virtual ~row_source() {}
+
+  size_t size() const { return fields_.size(); }
+
+  // memoized
+  field_type const& field(size_t idx) {
+    if (!decoded_[idx]) {
+      fields_[idx] = decode(idx, (*names_)[idx]);
+      decoded_[idx] = true;
+    }
+    return fields_[idx];
+  }
+
+  size_t index(char const* name) const {
+    auto const& names = *names_;
+    for (size_t i = 0; name && i < names.size(); ++i) {
+      if (names[i] == name) return i;
+    }
+    return size();
+  }
+
+  void detach() {
+    for (size_t i = 0; i < size(); ++i) field(i);
+  }
+
+protected:
+  virtual field_type decode(size_t idx, std::string const& name) = 0;
+
+private:
+  std::shared_ptr<std::vector<std::string> const> names_; // of the statement
+  std::vector<field_type> fields_;
+  std::vector<bool> decoded_;
+};
+
 /*
  * Representation of a result row
  */
 class row : public std::vector<field_type> {
 public:
+  row() {}
+
+  // lazy row, columns are decoded by source when accessed
+  row(std::shared_ptr<row_source> source)
+    : std::vector<field_type>(source->size()), source_(std::move(source)) {}
+
   // access field by index
   const_reference operator[](size_type idx) const {
-    return idx < size() ? std::vector<field_type>::operator[](idx) : invalid<field_type>();
+    if (idx >= size()) return invalid<field_type>();
+    return source_ ? source_->field(idx) : std::vector<field_type>::operator[](idx);
   }
 
   // access field by name
   const_reference operator[](char const* colname) const {
+    if (source_) return operator[](source_->index(colname));
     for (row::const_iterator it = begin(); it != end(); ++it) {
       if (colname && it->name() == colname) {
         return *it;
@@ -285,6 +604,28 @@ public:
   bool operator==(row const& r) const {
     return size() == r.size() && std::equal(begin(), end(), r.begin());
   }
+
+  // iterating a lazy row decodes all of it
+  iterator begin() { materialize(); return std::vector<field_type>::begin(); }
+  iterator end() { materialize(); return std::vector<field_type>::end(); }
+  const_iterator begin() const { materialize(); return std::vector<field_type>::begin(); }
+  const_iterator end() const { materialize(); return std::vector<field_type>::end(); }
+
+  bool is_lazy() const { return !!source_; }
+
+  // decode every column, use it before the row is taken as a plain vector
+  row const& materialize() const {
+    if (!source_) return *this;
+    auto& fields = const_cast<row&>(*this);
+    for (size_t i = 0; i < size(); ++i) {
+      fields.std::vector<field_type>::operator[](i) = source_->field(i);
+    }
+    source_.reset();
+    return *this;
+  }
+
+private:
+  mutable std::shared_ptr<row_source> source_;
 };
 
 /*
@@ -313,6 +654,9 @@ public:
   virtual result_type result() const = 0;
   virtual std::uint64_t last_id() const = 0;
   virtual std::uint64_t affected_rows() const = 0;
+
+  // rows are decoded column by column on access (where the backend allows it)
+  virtual void lazy(bool) {}
 };
 
 class iterator {
@@ -352,8 +696,10 @@ public:
 
 private:
   void next() {
-    if (auto stmt = stmt_.lock())
+    if (auto stmt = stmt_.lock()) {
+      row_ = row(); // the backend row of a lazy one is not referenced any more
       row_ = stmt->next();
+    }
   }
 
   row row_;
@@ -378,10 +724,72 @@ public:
   std::uint64_t last_id() const { return stmt_->last_id(); }
   std::uint64_t affected_rows() const { return stmt_->affected_rows(); }
 
+  // underlying statement
+  std::shared_ptr<statement> const& get() const { return stmt_; }
+
 private:
   std::shared_ptr<statement> stmt_;
 };
 
+/*
+ * Statement failed before reaching the backend
+ */
+class error_statement : public statement {
+public:
+  error_statement(result_type result) : result_(result) {}
+  row next() override { return {}; }
+  void first() override {}
+  result_type result() const override { return result_; }
+  std::uint64_t last_id() const override { return 0; }
+  std::uint64_t affected_rows() const override { return 0; }
+
+private:
+  result_type result_;
+};
+
+/*
+ * Statement which keeps alive a resource (i.e. pooled connection)
+ * until the last cursor over it is gone
+ */
+class holder_statement : public statement {
+public:
+  holder_statement(std::shared_ptr<statement> stmt, std::shared_ptr<void> hold)
+    : stmt_(std::move(stmt)), hold_(std::move(hold)) {}
+  ~holder_statement() override { stmt_.reset(); }
+  row next() override { return stmt_->next(); }
+  void first() override { stmt_->first(); }
+  result_type result() const override { return stmt_->result(); }
+  std::uint64_t last_id() const override { return stmt_->last_id(); }
+  std::uint64_t affected_rows() const override { return stmt_->affected_rows(); }
+  void lazy(bool on) override { stmt_->lazy(on); }
+
+private:
+  std::shared_ptr<statement> stmt_;
+  std::shared_ptr<void> hold_;
+};
+
+/*
+ * Outcome of a statement run once per bind set
+ */
+struct batch_result {
+  result_type result = SQL_OK;          // first failure, later sets are not run
+  size_t executed = 0;                  // bind sets run successfully
+  std::uint64_t affected_rows = 0;      // in total
+  std::vector<std::uint64_t> affected;  // per bind set, if asked for
+
+  // account a bind set, false on failure
+  bool add(result_type r, std::uint64_t rows, bool per_set) {
+    if (r != SQL_OK) {
+      result = r;
+      return false;
+    }
+    ++executed;
+    affected_rows += rows;
+    if (per_set) affected.push_back(rows);
+    return true;
+  }
+};
+
 /*
  * Representation of a query
  */
@@ -454,18 +862,27 @@ public:
   }
 
   query& operator<< (format str) {
-    char buf[16] = {};
-    std::stringstream r;
-    size_t pos = 0, i = 0;
-    auto q = query_.str(); query_.str({});
-    r.rdbuf()->pubsetbuf(buf, 15);
-    for (auto const&s : str) {
-      r << '{' << i++ << '}';
-      while ((pos = q.find(buf)) != q.npos)
-        q.replace(pos, strlen(buf), s);
-      r.seekp(0);
+    std::vector<std::string> args(str);
+    std::string q;
+    q.reserve(query_.size());
+    for (size_t pos = 0; pos < query_.size(); ) {
+      size_t open = query_.find('{', pos);
+      if (open == query_.npos) open = query_.size();
+      q.append(query_, pos, open - pos);
+      if (open == query_.size()) break;
+      size_t close = open + 1, idx = 0;
+      while (close < query_.size() && std::isdigit(static_cast<unsigned char>(query_[close]))) {
+        idx = idx * 10 + size_t(query_[close++] - '0');
+      }
+      if (close > open + 1 && close < query_.size() && query_[close] == '}' && idx < args.size()) {
+        q += args[idx];
+        pos = close + 1;
+      } else {
+        q += '{';
+        pos = open + 1;
+      }
     }
-    query_ << std::move(q);
+    query_.swap(q);
     return *this;
   }
 
@@ -474,24 +891,80 @@ public:
     if (!text || !*text) {
       return *this;
     }
-    if (!strpbrk(text, "'\\")) {
-      query_ << text;
-      return *this;
-    }
-    for (size_t i = 0; text[i]; ++i) {
-      query_ << text[i];
-      if (text[i] == '\'') query_ << '\'';
-      if (text[i] == '\\') query_ << '\\';
+    // copy runs between quotes and backslashes, doubling them
+    for (;;) {
+      size_t run = std::strcspn(text, "'\\");
+      query_.append(text, run);
+      text += run;
+      if (!*text) break;
+      query_.append(2, *text++);
     }
     return *this;
   }
 
   cursor execute() {
-    auto cursor = execute_impl(query_.str().c_str(), std::move(bind_));
-    query_.str({});
+    auto cursor = execute_impl(query_.c_str(), std::move(bind_));
+    if (lazy_) cursor.get()->lazy(true);
+    clear();
     return cursor;
   }
 
+  // decode columns of rows when they are accessed, i.e. SELECT * when only
+  // a few columns are read, materialize a row before it's used as a plain
+  // std::vector<field_type>
+  query& lazy(bool on = true) {
+    lazy_ = on;
+    return *this;
+  }
+
+  // next bind set, false when there are no more
+  typedef std::function<bool(std::vector<field_type>&)> bind_source;
+
+  // run query once per bind set (tuples or vectors of fields) in one transaction
+  // with one prepared statement where the backend allows it
+  template<class Range>
+  batch_result execute_many(Range const& sets, bool per_set = false) {
+    auto it = std::begin(sets);
+    auto end = std::end(sets);
+    bind_source next = [this, &it, &end](std::vector<field_type>& binds) -> bool {
+      if (it == end) return false;
+      bind_.clear();
+      bind_set(*it++);
+      binds.swap(bind_);
+      return true;
+    };
+    auto result = execute_many_impl(query_.c_str(), next, per_set);
+    clear();
+    return result;
+  }
+
+  // drop text and binds, buffer capacity is kept for the next query
+  void clear() {
+    query_.clear();
+    bind_.clear();
+  }
+
+  // query text built so far
+  std::string const& text() const { return query_; }
+
+  // prepare query in connection statement cache without executing it
+  bool prepare() {
+    return prepare_impl(query_.c_str());
+  }
+
+  // forward already built query to another query (i.e. in a pool)
+  static cursor dispatch(query& q, char const* text, std::vector<field_type> bind) {
+    return q.execute_impl(text, std::move(bind));
+  }
+
+  static bool dispatch_prepare(query& q, char const* text) {
+    return q.prepare_impl(text);
+  }
+
+  static batch_result dispatch_many(query& q, char const* text, bind_source const& next, bool per_set) {
+    return q.execute_many_impl(text, next, per_set);
+  }
+
   // bind to query
   template<class T>
   query& bind(T&& t) {
@@ -533,19 +1006,285 @@ protected:
   // bind function
   virtual cursor execute_impl(char const* query, std::vector<field_type> bind) = 0;
 
+  // prepare function, false when backend has no statement cache
+  virtual bool prepare_impl(char const*) { return false; }
+
+  // bind sets function, every set is a statement of its own by default
+  virtual batch_result execute_many_impl(char const* query, bind_source const& next, bool per_set) {
+    batch_result result;
+    std::vector<field_type> binds;
+    while (next(binds)) {
+      auto cur = execute_impl(query, std::move(binds));
+      if (!result.add(cur.result(), cur.affected_rows(), per_set)) break;
+      binds.clear();
+    }
+    return result;
+  }
+
 private:
-  std::stringstream query_;
+  template<class... Args>
+  void bind_set(std::tuple<Args...> const& set) { *this << set; }
+
+  void bind_set(std::vector<field_type> const& set) { bind_ = set; }
+
+  std::string query_;
   std::vector<field_type> bind_;
+  bool lazy_ = false;
 };
 
+/*
+ * Bulk load of rows into a table, rows are visible after finish,
+ * a load which is not finished is rolled back
+ */
+class bulk_insert {
+public:
+  virtual ~bulk_insert() {}
+
+  // values of a row in order of columns, false on error
+  virtual bool write(std::vector<field_type> const& values) = 0;
+
+  // commit, false if any write failed
+  virtual bool finish() = 0;
+};
+
+// INSERT INTO table (columns) VALUES (?, ...), ... of rows
+static inline
+std::string insert_text(std::string const& table, std::vector<std::string> const& columns,
+                        size_t width, size_t rows) {
+  std::string text = "INSERT INTO " + table;
+  for (size_t i = 0; i < columns.size(); ++i) {
+    text += i ? ", " : " (";
+    text += columns[i];
+  }
+  if (!columns.empty()) text += ')';
+  text += " VALUES ";
+  for (size_t r = 0; r < rows; ++r) {
+    text += r ? ", (" : "(";
+    for (size_t i = 0; i < width; ++i) text += i ? ", ?" : "?";
+    text += ')';
+  }
+  return text;
+}
+
 class connection {
 public:
   virtual ~connection() {}
   virtual void vacuum() = 0;
   virtual std::string version() = 0;
   virtual std::unique_ptr<sqlxx::query> query(std::string const& str = {}) = 0;
+
+  // warm statement cache with a hot query
+  bool prepare(std::string const& str) { return query(str)->prepare(); }
+
+  // statement run now and again after every reconnect (i.e. SET ...)
+  virtual bool session(std::string const&) { return false; }
+
+  // reconnect policy when server is lost
+  virtual void reconnect(backoff const&) {}
+
+  // backend compares row values, (a, b) > (?, ?), with an index range
+  virtual bool row_values() const { return false; }
+
+  // transaction stack of the connection, begin returns the new level
+  // (1 is BEGIN, deeper ones are savepoints) or 0 if not supported
+  virtual size_t begin() { return 0; }
+  virtual bool commit(size_t /*level*/) { return false; }
+  virtual bool rollback(size_t /*level*/) { return false; }
+
+  // result of the last begin, commit or rollback
+  virtual result_type transaction_result() const { return SQL_IMPROPER; }
+
+  // fastest way of the backend to load rows, multi-row INSERT in a transaction by default
+  virtual std::unique_ptr<bulk_insert> bulk(std::string const& table,
+                                            std::vector<std::string> const& columns = {});
 };
 
+/*
+ * Transaction scope of a connection, nested scopes are savepoints and a
+ * scope left without commit is rolled back. The stack belongs to the
+ * connection, not to the thread
+ */
+class transaction {
+public:
+  explicit transaction(connection& con) : con_(con), level_(con.begin()) {
+    if (!level_) result_ = con_.transaction_result();
+  }
+
+  ~transaction() { rollback(); }
+
+  transaction(transaction&&) = delete;
+  transaction(transaction const&) = delete;
+  transaction& operator=(transaction&&) = delete;
+  transaction& operator=(transaction const&) = delete;
+
+  // false if begin failed or the scope is over
+  bool good() const { return level_ != 0; }
+  size_t level() const { return level_; }
+
+  // why begin or commit failed
+  result_type result() const { return result_; }
+
+  bool commit() {
+    if (!level_) return false;
+    if (!con_.commit(level_)) {
+      result_ = con_.transaction_result();
+      return false;
+    }
+    level_ = 0;
+    return true;
+  }
+
+  bool rollback() {
+    if (!level_) return false;
+    auto level = level_;
+    level_ = 0;
+    return con_.rollback(level);
+  }
+
+private:
+  connection& con_;
+  size_t level_;
+  result_type result_ = SQL_OK;
+};
+
+/*
+ * Counters of run_transaction, shared by many calls
+ */
+struct transaction_metrics {
+  std::atomic<std::uint64_t> transactions{0};   // runs
+  std::atomic<std::uint64_t> committed{0};
+  std::atomic<std::uint64_t> retries{0};        // attempts after the first
+  std::atomic<std::uint64_t> busy{0};           // failed attempts by result
+  std::atomic<std::uint64_t> deadlocks{0};
+  std::atomic<std::uint64_t> serialization{0};
+
+  void count(result_type result) {
+    switch (result) {
+      case SQL_BUSY: ++busy; break;
+      case SQL_DEADLOCK: ++deadlocks; break;
+      case SQL_SERIALIZATION: ++serialization; break;
+      default: break;
+    }
+  }
+};
+
+struct retry_policy {
+  backoff delays;                          // attempts and jittered delays
+  transaction_metrics* metrics = nullptr;  // optional
+};
+
+/*
+ * Run fn(con) in a transaction, committed if it returns SQL_OK. Runs that
+ * fail on contention (busy, deadlock, serialization) are rolled back and
+ * run again with backoff. Inside an open transaction fn runs once in a
+ * savepoint, the failure is for the outer transaction to retry
+ */
+template<class Fn>
+result_type run_transaction(connection& con, Fn&& fn, retry_policy const& policy = {}) {
+  auto* metrics = policy.metrics;
+  if (metrics) ++metrics->transactions;
+  size_t const attempts = std::max<size_t>(1, policy.delays.attempts);
+  result_type result = SQL_OK;
+  for (size_t attempt = 0; attempt < attempts; ++attempt) {
+    if (attempt) {
+      if (metrics) ++metrics->retries;
+      policy.delays.wait(attempt);
+    }
+    transaction tr(con);
+    bool const nested = tr.level() > 1;
+    if (!tr.good()) {
+      result = tr.result();
+    } else {
+      result = fn(con);
+      if (result == SQL_OK && !tr.commit()) result = tr.result();
+    }
+    if (result == SQL_OK) {
+      if (metrics) ++metrics->committed;
+      break;
+    }
+    if (metrics) metrics->count(result);
+    if (!is_retryable(result) || nested) break;
+  }
+  return result;
+}
+
+/*
+ * Bulk load by multi-row INSERT statements in a transaction
+ */
+class batch_insert : public bulk_insert {
+public:
+  // rows per statement are limited to stay under bind limits of all backends
+  static constexpr size_t max_binds = 30000;
+
+  batch_insert(connection& con, std::string const& table,
+               std::vector<std::string> const& columns, size_t batch = 1000)
+    : con_(con), table_(table), columns_(columns), batch_(batch) {
+    ok_ = (level_ = con_.begin()) != 0;
+  }
+
+  ~batch_insert() override {
+    if (!finished_) con_.rollback(level_);
+  }
+
+  batch_insert(batch_insert&&) = delete;
+  batch_insert(batch_insert const&) = delete;
+  batch_insert& operator=(batch_insert&&) = delete;
+  batch_insert& operator=(batch_insert const&) = delete;
+
+  bool write(std::vector<field_type> const& values) override {
+    if (!ok_) return false;
+    if (!width_) {
+      width_ = values.empty() ? 1 : values.size();
+      batch_ = std::max<size_t>(1, std::min(batch_, max_binds / width_));
+    }
+    if (values.size() != width_) return ok_ = false;
+    binds_.insert(binds_.end(), values.begin(), values.end());
+    if (++rows_ == batch_) flush();
+    return ok_;
+  }
+
+  bool finish() override {
+    if (finished_) return ok_;
+    flush();
+    finished_ = true;
+    ok_ = ok_ && con_.commit(level_);
+    if (!ok_) con_.rollback(level_);
+    return ok_;
+  }
+
+private:
+  void flush() {
+    if (!rows_ || !ok_) return;
+    if (rows_ != text_rows_) {
+      text_ = insert_text(table_, columns_, width_, rows_);
+      text_rows_ = rows_;
+    }
+    auto q = con_.query();
+    ok_ = query::dispatch(*q, text_.c_str(), std::move(binds_)).result() == SQL_OK;
+    binds_.clear();
+    rows_ = 0;
+  }
+
+  connection& con_;
+  std::string const table_;
+  std::vector<std::string> const columns_;
+  size_t batch_;
+  size_t width_ = 0;
+  size_t rows_ = 0;                 // pending rows
+  std::vector<field_type> binds_;   // pending values
+  std::string text_;                // statement of text_rows_ rows
+  size_t text_rows_ = 0;
+  size_t level_ = 0;                // transaction level
+  bool ok_ = true;
+  bool finished_ = false;
+};
+
+inline
+std::unique_ptr<bulk_insert> connection::bulk(std::string const& table,
+                                              std::vector<std::string> const& columns) {
+  return std::unique_ptr<bulk_insert>{ new batch_insert(*this, table, columns) };
+}
+
 } // namespace sqlxx
 
 #endif  // _SQL_XX_H_
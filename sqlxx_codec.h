@@ -0,0 +1,284 @@
+///////////////////////////////////////////////////////////////////////////////
+/// \author (c) Anthony Fieroni (bvbfan@abv.bg)
+///             2017, Plovdiv, Bulgaria
+///
+/// \license The MIT License (MIT)
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights
+/// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+/// copies of the Software, and to permit persons to whom the Software is
+/// furnished to do so, subject to the following conditions:
+///
+/// The above copyright notice and this permission notice shall be included in
+/// all copies or substantial portions of the Software.
+///
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+/// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+/// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+/// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+/// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+/// THE SOFTWARE.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _SQLXX_CODEC_H_
+#define _SQLXX_CODEC_H_
+
+#include "sqlxx.h"
+
+#include <cstdio>
+
+#include <unistd.h>
+#include <sys/mman.h>
+
+namespace sqlxx {
+
+/*
+ * Compact binary encoding of rows, a field is a type tag followed by
+ * zigzag varint integer, raw little endian double or length prefixed bytes
+ */
+namespace codec {
+
+static inline
+void put_varint(std::string& out, std::uint64_t v) {
+  while (v >= 0x80) {
+    out.push_back(char(v | 0x80));
+    v >>= 7;
+  }
+  out.push_back(char(v));
+}
+
+static inline
+bool get_varint(char const*& p, char const* end, std::uint64_t& v) {
+  v = 0;
+  for (int shift = 0; p < end && shift < 64; shift += 7) {
+    auto b = static_cast<unsigned char>(*p++);
+    v |= std::uint64_t(b & 0x7F) << shift;
+    if (!(b & 0x80)) return true;
+  }
+  return false;
+}
+
+static inline
+void put_field(std::string& out, field_type const& f) {
+  out.push_back(char(f.type()));
+  switch (f.type()) {
+    case SQL_INTEGER: {
+      std::int64_t const& i = f;
+      put_varint(out, (std::uint64_t(i) << 1) ^ std::uint64_t(i >> 63));
+    } break;
+    case SQL_FLOAT: {
+      double const& d = f;
+      std::uint64_t bits;
+      std::memcpy(&bits, &d, sizeof(bits));
+      for (int i = 0; i < 8; ++i) out.push_back(char(bits >> (8 * i)));
+    } break;
+    case SQL_TEXT: case SQL_BLOB: {
+      put_varint(out, f.size());
+      out.append(f.data(), f.size());
+    } break;
+    default: break;
+  }
+}
+
+static inline
+bool get_field(char const*& p, char const* end, std::string const& name, field_type& f) {
+  if (p >= end) return false;
+  switch (sql_type(*p++)) {
+    case SQL_NULL: f = field_type(name); return true;
+    case SQL_INTEGER: {
+      std::uint64_t v;
+      if (!get_varint(p, end, v)) return false;
+      f = field_type(std::int64_t((v >> 1) ^ (~(v & 1) + 1)), name);
+      return true;
+    }
+    case SQL_FLOAT: {
+      if (end - p < 8) return false;
+      std::uint64_t bits = 0;
+      for (int i = 0; i < 8; ++i) bits |= std::uint64_t(static_cast<unsigned char>(*p++)) << (8 * i);
+      double d;
+      std::memcpy(&d, &bits, sizeof(d));
+      f = field_type(d, name);
+      return true;
+    }
+    case SQL_TEXT: case SQL_BLOB: {
+      auto type = sql_type(p[-1]);
+      std::uint64_t size;
+      if (!get_varint(p, end, size) || std::uint64_t(end - p) < size) return false;
+      std::string s(p, size);
+      p += size;
+      if (type == SQL_TEXT) f = field_type(std::move(s), name);
+      else f = field_type(blob(std::move(s)), name);
+      return true;
+    }
+    default: return false;
+  }
+}
+
+// move past an encoded field without decoding it
+static inline
+bool skip_field(char const*& p, char const* end) {
+  if (p >= end) return false;
+  std::uint64_t v;
+  switch (sql_type(*p++)) {
+    case SQL_NULL: return true;
+    case SQL_INTEGER: return get_varint(p, end, v);
+    case SQL_FLOAT:
+      if (end - p < 8) return false;
+      p += 8;
+      return true;
+    case SQL_TEXT: case SQL_BLOB:
+      if (!get_varint(p, end, v) || std::uint64_t(end - p) < v) return false;
+      p += v;
+      return true;
+    default: return false;
+  }
+}
+
+static inline
+bool skip_row(char const*& p, char const* end) {
+  std::uint64_t size;
+  if (!get_varint(p, end, size)) return false;
+  for (std::uint64_t i = 0; i < size; ++i) {
+    if (!skip_field(p, end)) return false;
+  }
+  return true;
+}
+
+static inline
+void put_row(std::string& out, row const& r) {
+  put_varint(out, r.size());
+  for (auto const& f : r) put_field(out, f);
+}
+
+// names are column names, missing ones are left empty
+static inline
+bool get_row(char const*& p, char const* end, std::vector<std::string> const& names, row& r) {
+  static std::string const unnamed;
+  std::uint64_t size;
+  if (!get_varint(p, end, size)) return false;
+  r.clear();
+  r.reserve(size);
+  for (std::uint64_t i = 0; i < size; ++i) {
+    field_type f;
+    if (!get_field(p, end, i < names.size() ? names[i] : unnamed, f)) return false;
+    r.push_back(std::move(f));
+  }
+  return true;
+}
+
+// column names of a row
+static inline
+std::vector<std::string> names(row const& r) {
+  std::vector<std::string> names;
+  for (auto const& f : r) names.push_back(f.name());
+  return names;
+}
+
+} // namespace codec
+
+/*
+ * Anonymous temporary file of length prefixed encoded rows
+ */
+class row_file {
+public:
+  row_file() : file_(std::tmpfile()) {}
+  ~row_file() { if (file_) std::fclose(file_); }
+
+  row_file(row_file&&) = delete;
+  row_file(row_file const&) = delete;
+  row_file& operator=(row_file&&) = delete;
+  row_file& operator=(row_file const&) = delete;
+
+  // returns true if the file is open
+  bool is_open() const { return !!file_; }
+
+  bool write(row const& r) {
+    buf_.clear();
+    codec::put_row(buf_, r);
+    std::string size;
+    codec::put_varint(size, buf_.size());
+    ++count_;
+    return file_ && std::fwrite(size.data(), 1, size.size(), file_) == size.size()
+        && std::fwrite(buf_.data(), 1, buf_.size(), file_) == buf_.size();
+  }
+
+  // start reading from the first row
+  void rewind() { if (file_) std::fseek(file_, 0, SEEK_SET); }
+
+  // false at the end
+  bool read(std::vector<std::string> const& names, row& r) {
+    if (!file_) return false;
+    std::uint64_t size = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      int c = std::fgetc(file_);
+      if (c == EOF) return false;
+      size |= std::uint64_t(c & 0x7F) << shift;
+      if (!(c & 0x80)) break;
+    }
+    buf_.resize(size);
+    if (size && std::fread(&buf_[0], 1, size, file_) != size) return false;
+    char const* p = buf_.data();
+    return codec::get_row(p, p + size, names, r);
+  }
+
+  // number of written rows
+  size_t size() const { return count_; }
+
+private:
+  std::FILE* file_;
+  std::string buf_;
+  size_t count_ = 0;
+};
+
+/*
+ * Read only memory mapping of a file
+ */
+class mapping {
+public:
+  mapping() {}
+  mapping(int fd, size_t size) { map(fd, size); }
+  ~mapping() { unmap(); }
+
+  mapping(mapping&& other) { operator=(std::move(other)); }
+  mapping(mapping const&) = delete;
+  mapping& operator=(mapping const&) = delete;
+
+  mapping& operator=(mapping&& other) {
+    if (this != &other) {
+      unmap();
+      std::swap(data_, other.data_);
+      std::swap(size_, other.size_);
+    }
+    return *this;
+  }
+
+  // map first size bytes of fd
+  bool map(int fd, size_t size) {
+    unmap();
+    if (fd < 0 || !size) return false;
+    void* data = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) return false;
+    data_ = static_cast<char const*>(data);
+    size_ = size;
+    return true;
+  }
+
+  void unmap() {
+    if (data_) ::munmap(const_cast<char*>(data_), size_);
+    data_ = nullptr;
+    size_ = 0;
+  }
+
+  char const* data() const { return data_; }
+  size_t size() const { return size_; }
+
+private:
+  char const* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+} // namespace sqlxx
+
+#endif  // _SQLXX_CODEC_H_
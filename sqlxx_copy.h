@@ -0,0 +1,143 @@
+///////////////////////////////////////////////////////////////////////////////
+/// \author (c) Anthony Fieroni (bvbfan@abv.bg)
+///             2017, Plovdiv, Bulgaria
+///
+/// \license The MIT License (MIT)
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights
+/// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+/// copies of the Software, and to permit persons to whom the Software is
+/// furnished to do so, subject to the following conditions:
+///
+/// The above copyright notice and this permission notice shall be included in
+/// all copies or substantial portions of the Software.
+///
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+/// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+/// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+/// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+/// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+/// THE SOFTWARE.
+///////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef _SQLXX_COPY_H_
+#define _SQLXX_COPY_H_
+
+#include "sqlxx.h"
+#include "sqlxx_queue.h"
+
+#include <thread>
+#include <functional>
+
+namespace sqlxx {
+
+struct copy_progress {
+  std::uint64_t rows = 0;
+  double seconds = 0;
+
+  double throughput() const { return seconds > 0 ? rows / seconds : 0; } // rows/s
+};
+
+struct copy_options {
+  bool create = true;               // CREATE TABLE IF NOT EXISTS from the first row
+  size_t batch_rows = 1024;         // rows passed between threads at once
+  size_t queue_batches = 8;         // read ahead limit of the pipeline
+  std::function<void(copy_progress const&)> progress; // after every batch
+};
+
+struct copy_stats : copy_progress {
+  result_type result = SQL_OK;      // source result
+  bool ok = true;                   // false if source or destination failed
+};
+
+// column type understood by all backends (BLOB is BYTEA in PostgreSQL)
+static inline
+char const* column_type(sql_type type) {
+  switch (type) {
+    case SQL_INTEGER: return "BIGINT";
+    case SQL_FLOAT: return "DOUBLE PRECISION";
+    case SQL_BLOB: return "BLOB";
+    default: return "TEXT";
+  }
+}
+
+// CREATE TABLE IF NOT EXISTS of row columns, NULL columns are TEXT
+static inline
+std::string create_text(std::string const& table, row const& r) {
+  std::string text = "CREATE TABLE IF NOT EXISTS " + table + " (";
+  for (size_t i = 0; i < r.size(); ++i) {
+    if (i) text += ", ";
+    text += r[i].name();
+    text += ' ';
+    text += column_type(r[i].type());
+  }
+  return text + ')';
+}
+
+/*
+ * Copy rows of a source query into a destination table, the source is read
+ * on its own thread while the caller writes through the destination bulk
+ * path, at most queue_batches batches are held in between
+ */
+static inline
+copy_stats copy_table(connection& src, connection& dst, std::string const& src_query,
+                      std::string const& dst_table, copy_options const& options = copy_options()) {
+  copy_stats stats;
+  auto start = std::chrono::steady_clock::now();
+  size_t const batch_rows = std::max<size_t>(options.batch_rows, 1);
+  bounded_queue<std::vector<row>> queue(options.queue_batches);
+  result_type src_result = SQL_OK;
+  std::thread reader([&]() {
+    auto q = src.query();
+    auto cur = query::dispatch(*q, src_query.c_str(), {});
+    src_result = cur.result();
+    std::vector<row> batch;
+    for (auto const& r : cur) {
+      batch.push_back(r);
+      if (batch.size() < batch_rows) continue;
+      if (!queue.push(std::move(batch))) break;
+      batch.clear();
+    }
+    if (!batch.empty()) queue.push(std::move(batch));
+    queue.close();
+  });
+
+  std::unique_ptr<bulk_insert> load;
+  std::vector<row> batch;
+  while (queue.pop(batch)) {
+    if (!load) {
+      auto const& first = batch.front();
+      if (options.create) {
+        auto q = dst.query();
+        stats.ok = query::dispatch(*q, create_text(dst_table, first).c_str(), {}).result() == SQL_OK;
+      }
+      std::vector<std::string> columns;
+      for (auto const& f : first) columns.push_back(f.name());
+      if (stats.ok) load = dst.bulk(dst_table, columns);
+      stats.ok = stats.ok && load;
+    }
+    for (size_t i = 0; stats.ok && i < batch.size(); ++i) {
+      stats.ok = load->write(batch[i].materialize());
+    }
+    if (!stats.ok) {
+      queue.close();
+      break;
+    }
+    stats.rows += batch.size();
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (options.progress) options.progress(stats);
+  }
+  reader.join();
+  stats.result = src_result;
+  if (load) stats.ok = load->finish() && stats.ok;
+  stats.ok = stats.ok && src_result == SQL_OK;
+  stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return stats;
+}
+
+} // namespace sqlxx
+
+#endif  // _SQLXX_COPY_H_
@@ -0,0 +1,401 @@
+///////////////////////////////////////////////////////////////////////////////
+/// \author (c) Anthony Fieroni (bvbfan@abv.bg)
+///             2017, Plovdiv, Bulgaria
+///
+/// \license The MIT License (MIT)
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights
+/// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+/// copies of the Software, and to permit persons to whom the Software is
+/// furnished to do so, subject to the following conditions:
+///
+/// The above copyright notice and this permission notice shall be included in
+/// all copies or substantial portions of the Software.
+///
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+/// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+/// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+/// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+/// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+/// THE SOFTWARE.
+///////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef _SQLXX_EXPORT_H_
+#define _SQLXX_EXPORT_H_
+
+#include "sqlxx.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <ostream>
+
+#include <unistd.h>
+#include <sys/uio.h>
+
+namespace sqlxx {
+
+struct export_options {
+  char delimiter = ',';           // csv only
+  bool header = true;             // column names line, csv and tsv
+  std::string null;               // text of NULL, csv only (tsv writes \N)
+  size_t buffer_size = 1 << 20;   // output buffer
+};
+
+struct export_stats {
+  std::uint64_t rows = 0;
+  std::uint64_t bytes = 0;
+  bool ok = true;                 // false if a write failed
+};
+
+/*
+ * Buffered output to a file descriptor or an ostream, big pieces go
+ * straight to the descriptor along the buffer in one writev
+ */
+class export_buffer {
+public:
+  export_buffer(int fd, size_t size) : fd_(fd) { buf_.reserve(size); }
+  export_buffer(std::ostream& os, size_t size) : os_(&os) { buf_.reserve(size); }
+
+  ~export_buffer() { flush(); }
+
+  export_buffer(export_buffer&&) = delete;
+  export_buffer(export_buffer const&) = delete;
+  export_buffer& operator=(export_buffer&&) = delete;
+  export_buffer& operator=(export_buffer const&) = delete;
+
+  void put(char c) {
+    if (buf_.size() == buf_.capacity()) flush();
+    buf_.push_back(c);
+  }
+
+  void put(char const* p, size_t n) {
+    if (buf_.size() + n <= buf_.capacity()) {
+      buf_.append(p, n);
+      return;
+    }
+    if (os_ || n < buf_.capacity() / 2) {
+      flush();
+      if (n < buf_.capacity()) buf_.append(p, n);
+      else write(p, n);
+      return;
+    }
+    struct iovec iov[2] = {
+      { const_cast<char*>(buf_.data()), buf_.size() },
+      { const_cast<char*>(p), n }
+    };
+    writev(iov, 2);
+    buf_.clear();
+  }
+
+  void put(std::string const& s) { put(s.data(), s.size()); }
+
+  void put(std::int64_t i) {
+    char buf[24];
+    char* end = buf + sizeof(buf);
+    char* p = end;
+    std::uint64_t v = i < 0 ? ~std::uint64_t(i) + 1 : std::uint64_t(i);
+    do {
+      *--p = char('0' + v % 10);
+      v /= 10;
+    } while (v);
+    if (i < 0) *--p = '-';
+    put(p, size_t(end - p));
+  }
+
+  // shortest of %.15g and %.17g which reads back the same
+  bool put(double d) {
+    if (!std::isfinite(d)) return false;
+    if (d == std::floor(d) && std::fabs(d) < 1e15) {
+      put(std::int64_t(d));
+      return true;
+    }
+    char buf[32];
+    int n = std::snprintf(buf, sizeof(buf), "%.15g", d);
+    if (std::strtod(buf, nullptr) != d) n = std::snprintf(buf, sizeof(buf), "%.17g", d);
+    put(buf, size_t(n));
+    return true;
+  }
+
+  void flush() {
+    if (buf_.empty()) return;
+    write(buf_.data(), buf_.size());
+    buf_.clear();
+  }
+
+  std::uint64_t bytes() const { return bytes_ + buf_.size(); }
+  bool ok() const { return ok_; }
+
+private:
+  void write(char const* p, size_t n) {
+    struct iovec iov = { const_cast<char*>(p), n };
+    writev(&iov, 1);
+  }
+
+  void writev(struct iovec* iov, int count) {
+    for (int i = 0; i < count; ++i) bytes_ += iov[i].iov_len;
+    if (os_) {
+      for (int i = 0; i < count; ++i) {
+        os_->write(static_cast<char const*>(iov[i].iov_base), std::streamsize(iov[i].iov_len));
+      }
+      ok_ = ok_ && !!*os_;
+      return;
+    }
+    while (count && ok_) {
+      ssize_t n = ::writev(fd_, iov, count);
+      if (n < 0) {
+        if (errno != EINTR) ok_ = false;
+        continue;
+      }
+      while (count && size_t(n) >= iov->iov_len) {
+        n -= ssize_t(iov->iov_len);
+        ++iov;
+        --count;
+      }
+      if (count) {
+        iov->iov_base = static_cast<char*>(iov->iov_base) + n;
+        iov->iov_len -= size_t(n);
+      }
+    }
+  }
+
+  int fd_ = -1;
+  std::ostream* os_ = nullptr;
+  std::string buf_;
+  std::uint64_t bytes_ = 0;
+  bool ok_ = true;
+};
+
+/*
+ * Row writers of export formats
+ */
+struct export_csv_format {
+  static void header(export_buffer& out, row const& r, export_options const& options) {
+    if (!options.header) return;
+    for (size_t i = 0; i < r.size(); ++i) {
+      if (i) out.put(options.delimiter);
+      text(out, r[i].name(), options);
+    }
+    out.put('\n');
+  }
+
+  static void write(export_buffer& out, row const& r, export_options const& options) {
+    for (size_t i = 0; i < r.size(); ++i) {
+      if (i) out.put(options.delimiter);
+      auto const& f = r[i];
+      switch (f.type()) {
+        case SQL_INTEGER: out.put(static_cast<std::int64_t const&>(f)); break;
+        case SQL_FLOAT: if (!out.put(static_cast<double const&>(f))) out.put(options.null); break;
+        case SQL_TEXT: text(out, f, options); break;
+        case SQL_BLOB: hex(out, f); break;
+        default: out.put(options.null); break;
+      }
+    }
+    out.put('\n');
+  }
+
+  // quoted when it has a delimiter, quote or line break, quotes are doubled
+  static void text(export_buffer& out, std::string const& s, export_options const& options) {
+    bool quote = false;
+    for (char c : s) {
+      if (c == options.delimiter || c == '"' || c == '\n' || c == '\r') {
+        quote = true;
+        break;
+      }
+    }
+    if (!quote) return out.put(s);
+    out.put('"');
+    size_t begin = 0;
+    for (size_t i = 0; i < s.size(); ++i) {
+      if (s[i] != '"') continue;
+      out.put(s.data() + begin, i + 1 - begin);
+      out.put('"');
+      begin = i + 1;
+    }
+    out.put(s.data() + begin, s.size() - begin);
+    out.put('"');
+  }
+
+  // \x followed by hex digits, as PostgreSQL bytea
+  static void hex(export_buffer& out, std::string const& s) {
+    static char const digits[] = "0123456789abcdef";
+    out.put("\\x", 2);
+    for (char c : s) {
+      out.put(digits[(c >> 4) & 0xF]);
+      out.put(digits[c & 0xF]);
+    }
+  }
+};
+
+// tab separated, backslash escaped, NULL is \N (PostgreSQL text format)
+struct export_tsv_format {
+  static void header(export_buffer& out, row const& r, export_options const& options) {
+    if (!options.header) return;
+    for (size_t i = 0; i < r.size(); ++i) {
+      if (i) out.put('\t');
+      text(out, r[i].name());
+    }
+    out.put('\n');
+  }
+
+  static void write(export_buffer& out, row const& r, export_options const&) {
+    for (size_t i = 0; i < r.size(); ++i) {
+      if (i) out.put('\t');
+      auto const& f = r[i];
+      switch (f.type()) {
+        case SQL_INTEGER: out.put(static_cast<std::int64_t const&>(f)); break;
+        case SQL_FLOAT: if (!out.put(static_cast<double const&>(f))) out.put("\\N", 2); break;
+        case SQL_TEXT: text(out, f); break;
+        case SQL_BLOB: out.put('\\'); export_csv_format::hex(out, f); break;
+        default: out.put("\\N", 2); break;
+      }
+    }
+    out.put('\n');
+  }
+
+  static void text(export_buffer& out, std::string const& s) {
+    size_t begin = 0;
+    for (size_t i = 0; i < s.size(); ++i) {
+      char e;
+      switch (s[i]) {
+        case '\t': e = 't'; break;
+        case '\n': e = 'n'; break;
+        case '\r': e = 'r'; break;
+        case '\\': e = '\\'; break;
+        default: continue;
+      }
+      out.put(s.data() + begin, i - begin);
+      out.put('\\');
+      out.put(e);
+      begin = i + 1;
+    }
+    out.put(s.data() + begin, s.size() - begin);
+  }
+};
+
+// one object per line, blobs are hex strings, NaN and infinity are null
+class export_jsonl_format {
+public:
+  // keys are escaped once
+  void header(export_buffer&, row const& r, export_options const&) {
+    for (auto const& f : r) {
+      std::ostringstream os;
+      export_buffer out(os, 64);
+      text(out, f.name());
+      out.put(':');
+      out.flush();
+      keys_.push_back(os.str());
+    }
+  }
+
+  void write(export_buffer& out, row const& r, export_options const&) const {
+    out.put('{');
+    for (size_t i = 0; i < r.size(); ++i) {
+      if (i) out.put(',');
+      auto const& f = r[i];
+      if (i < keys_.size()) {
+        out.put(keys_[i]);
+      } else {
+        text(out, f.name());
+        out.put(':');
+      }
+      switch (f.type()) {
+        case SQL_INTEGER: out.put(static_cast<std::int64_t const&>(f)); break;
+        case SQL_FLOAT: if (!out.put(static_cast<double const&>(f))) out.put("null", 4); break;
+        case SQL_TEXT: text(out, f); break;
+        case SQL_BLOB: out.put("\"\\", 2); export_csv_format::hex(out, f); out.put('"'); break;
+        default: out.put("null", 4); break;
+      }
+    }
+    out.put("}\n", 2);
+  }
+
+  static void text(export_buffer& out, std::string const& s) {
+    static char const digits[] = "0123456789abcdef";
+    out.put('"');
+    size_t begin = 0;
+    for (size_t i = 0; i < s.size(); ++i) {
+      auto c = static_cast<unsigned char>(s[i]);
+      if (c >= 0x20 && c != '"' && c != '\\') continue;
+      out.put(s.data() + begin, i - begin);
+      out.put('\\');
+      switch (c) {
+        case '"': out.put('"'); break;
+        case '\\': out.put('\\'); break;
+        case '\n': out.put('n'); break;
+        case '\r': out.put('r'); break;
+        case '\t': out.put('t'); break;
+        default:
+          out.put("u00", 3);
+          out.put(digits[c >> 4]);
+          out.put(digits[c & 0xF]);
+          break;
+      }
+      begin = i + 1;
+    }
+    out.put(s.data() + begin, s.size() - begin);
+    out.put('"');
+  }
+
+private:
+  std::vector<std::string> keys_;
+};
+
+template<class Format>
+export_stats export_rows(cursor& cur, export_buffer& out, export_options const& options) {
+  export_stats stats;
+  Format format;
+  for (auto const& r : cur) {
+    if (!stats.rows) format.header(out, r, options);
+    format.write(out, r, options);
+    ++stats.rows;
+    if (!out.ok()) break;
+  }
+  out.flush();
+  stats.bytes = out.bytes();
+  stats.ok = out.ok();
+  return stats;
+}
+
+static inline
+export_stats export_csv(cursor cur, int fd, export_options const& options = export_options()) {
+  export_buffer out(fd, options.buffer_size);
+  return export_rows<export_csv_format>(cur, out, options);
+}
+
+static inline
+export_stats export_csv(cursor cur, std::ostream& os, export_options const& options = export_options()) {
+  export_buffer out(os, options.buffer_size);
+  return export_rows<export_csv_format>(cur, out, options);
+}
+
+static inline
+export_stats export_tsv(cursor cur, int fd, export_options const& options = export_options()) {
+  export_buffer out(fd, options.buffer_size);
+  return export_rows<export_tsv_format>(cur, out, options);
+}
+
+static inline
+export_stats export_tsv(cursor cur, std::ostream& os, export_options const& options = export_options()) {
+  export_buffer out(os, options.buffer_size);
+  return export_rows<export_tsv_format>(cur, out, options);
+}
+
+static inline
+export_stats export_jsonl(cursor cur, int fd, export_options const& options = export_options()) {
+  export_buffer out(fd, options.buffer_size);
+  return export_rows<export_jsonl_format>(cur, out, options);
+}
+
+static inline
+export_stats export_jsonl(cursor cur, std::ostream& os, export_options const& options = export_options()) {
+  export_buffer out(os, options.buffer_size);
+  return export_rows<export_jsonl_format>(cur, out, options);
+}
+
+} // namespace sqlxx
+
+#endif  // _SQLXX_EXPORT_H_
@@ -0,0 +1,271 @@
+///////////////////////////////////////////////////////////////////////////////
+/// \author (c) Anthony Fieroni (bvbfan@abv.bg)
+///             2017, Plovdiv, Bulgaria
+///
+/// \license The MIT License (MIT)
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights
+/// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+/// copies of the Software, and to permit persons to whom the Software is
+/// furnished to do so, subject to the following conditions:
+///
+/// The above copyright notice and this permission notice shall be included in
+/// all copies or substantial portions of the Software.
+///
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+/// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+/// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+/// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+/// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+/// THE SOFTWARE.
+///////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef _SQLXX_IMPORT_H_
+#define _SQLXX_IMPORT_H_
+
+#include "sqlxx.h"
+#include "sqlxx_codec.h"
+#include "sqlxx_queue.h"
+
+#include <atomic>
+#include <thread>
+#include <functional>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+namespace sqlxx {
+
+struct import_progress {
+  std::uint64_t rows = 0;
+  std::uint64_t bytes = 0;        // parsed bytes of the file written so far
+  std::uint64_t total = 0;        // file size
+  double seconds = 0;
+
+  double throughput() const { return seconds > 0 ? bytes / seconds / (1 << 20) : 0; } // MB/s
+};
+
+struct import_options {
+  char delimiter = ',';
+  char quote = '"';
+  bool header = true;                 // first record has column names
+  std::vector<std::string> columns;   // target columns, header names if empty
+  bool empty_null = true;             // unquoted empty field is NULL
+  size_t threads = 0;                 // parser threads, 0 for all cores
+  size_t chunk_size = 4 << 20;        // bytes per parsed chunk
+  size_t batch_rows = 4096;           // rows handed to the writer at once
+  std::function<void(import_progress const&)> progress; // after every batch
+};
+
+struct import_stats : import_progress {
+  bool ok = true;                     // false if open, parse or write failed
+};
+
+/*
+ * CSV (RFC 4180) scanning over a mapped file, quotes, delimiters and line
+ * breaks are found with memchr which libc vectorizes
+ */
+class csv_scanner {
+public:
+  csv_scanner(char delimiter, char quote, bool empty_null)
+    : delimiter_(delimiter), quote_(quote), empty_null_(empty_null) {}
+
+  // record starts after begin..end, split at line breaks outside of quotes
+  std::vector<size_t> chunks(char const* data, size_t begin, size_t end, size_t chunk) const {
+    std::vector<size_t> bounds{ begin };
+    size_t pos = begin;
+    bool quoted = false;  // state at pos
+    while (end - bounds.back() > chunk) {
+      size_t target = bounds.back() + chunk;
+      quoted ^= quotes(data + pos, data + target);
+      pos = target;
+      for (;;) {
+        auto* nl = static_cast<char const*>(std::memchr(data + pos, '\n', end - pos));
+        if (!nl) return finish(bounds, end);
+        quoted ^= quotes(data + pos, nl);
+        pos = size_t(nl - data) + 1;
+        if (!quoted) break;
+      }
+      if (pos >= end) break;
+      bounds.push_back(pos);
+    }
+    return finish(bounds, end);
+  }
+
+  // next record, p is moved past it, false at the end
+  bool record(char const*& p, char const* end, std::vector<field_type>& fields) const {
+    fields.clear();
+    while (p < end && (*p == '\n' || (*p == '\r' && p + 1 < end && p[1] == '\n'))) ++p; // blank lines
+    if (p >= end) return false;
+    static std::string const unnamed;
+    char const* eol = nullptr;  // line break after p (or end), past quoted ones
+    for (;;) {
+      std::string value;
+      bool quoted = p < end && *p == quote_;
+      if (quoted) {
+        ++p;
+        for (;;) {
+          auto* q = static_cast<char const*>(std::memchr(p, quote_, end - p));
+          if (!q) {
+            value.append(p, end);
+            p = end;
+            break;
+          }
+          value.append(p, q);
+          p = q + 1;
+          if (p < end && *p == quote_) {
+            value += quote_;
+            ++p;
+            continue;
+          }
+          break;
+        }
+      }
+      char const* begin = p;
+      if (!eol || eol < p) {
+        eol = static_cast<char const*>(std::memchr(p, '\n', end - p));
+        if (!eol) eol = end;
+      }
+      auto* delimiter = static_cast<char const*>(std::memchr(p, delimiter_, eol - p));
+      p = delimiter ? delimiter : eol;
+      char const* stop = p;
+      if (stop > begin && stop[-1] == '\r') --stop;
+      value.append(begin, stop);
+      if (!quoted && value.empty() && empty_null_) fields.emplace_back(unnamed);
+      else fields.emplace_back(std::move(value), unnamed);
+      if (p >= end || *p == '\n') break;
+      ++p;
+    }
+    if (p < end) ++p;
+    return true;
+  }
+
+private:
+  // odd number of quotes in begin..end
+  bool quotes(char const* begin, char const* end) const {
+    bool odd = false;
+    while (auto* q = static_cast<char const*>(std::memchr(begin, quote_, end - begin))) {
+      odd = !odd;
+      begin = q + 1;
+    }
+    return odd;
+  }
+
+  static std::vector<size_t>& finish(std::vector<size_t>& bounds, size_t end) {
+    bounds.push_back(end);
+    return bounds;
+  }
+
+  char const delimiter_;
+  char const quote_;
+  bool const empty_null_;
+};
+
+/*
+ * Parallel CSV load into a table, chunks of the mapped file are parsed on
+ * worker threads while the caller feeds the backend bulk path (one
+ * transaction of a prepared INSERT on SQLite, COPY on PostgreSQL, multi-row
+ * INSERT elsewhere), rows of different chunks are not kept in file order
+ */
+static inline
+import_stats import_csv(connection& con, std::string const& table, std::string const& path,
+                        import_options const& options = import_options()) {
+  import_stats stats;
+  auto start = std::chrono::steady_clock::now();
+  mapping map;
+  int fd = ::open(path.c_str(), O_RDONLY);
+  struct stat st;
+  if (fd < 0 || ::fstat(fd, &st)) {
+    if (fd >= 0) ::close(fd);
+    stats.ok = false;
+    return stats;
+  }
+  stats.total = std::uint64_t(st.st_size);
+  if (st.st_size) stats.ok = map.map(fd, size_t(st.st_size));
+  ::close(fd);
+  if (!stats.ok || !map.size()) return stats;
+  ::madvise(const_cast<char*>(map.data()), map.size(), MADV_SEQUENTIAL);
+
+  char const* data = map.data();
+  char const* end = data + map.size();
+  char const* p = data;
+  if (map.size() >= 3 && !std::memcmp(p, "\xEF\xBB\xBF", 3)) p += 3;
+  csv_scanner scanner(options.delimiter, options.quote, options.empty_null);
+  auto columns = options.columns;
+  if (options.header) {
+    std::vector<field_type> names;
+    scanner.record(p, end, names);
+    if (columns.empty()) {
+      for (auto const& name : names) columns.push_back(name);
+    }
+  }
+
+  auto load = con.bulk(table, columns);
+  if (!load) {
+    stats.ok = false;
+    return stats;
+  }
+
+  struct batch {
+    std::vector<std::vector<field_type>> rows;
+    size_t bytes = 0;
+  };
+  size_t threads = options.threads ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+  auto bounds = scanner.chunks(data, size_t(p - data), map.size(), std::max<size_t>(options.chunk_size, 1));
+  bounded_queue<batch> queue(threads * 2);
+  std::atomic<size_t> next{ 0 };
+  std::atomic<size_t> running{ threads };
+  std::vector<std::thread> workers;
+  for (size_t t = 0; t < threads; ++t) {
+    workers.emplace_back([&]() {
+      for (size_t chunk = next++; chunk + 1 < bounds.size(); chunk = next++) {
+        char const* q = data + bounds[chunk];
+        char const* stop = data + bounds[chunk + 1];
+        batch b;
+        char const* mark = q;
+        std::vector<field_type> fields;
+        while (scanner.record(q, stop, fields)) {
+          b.rows.push_back(std::move(fields));
+          if (b.rows.size() < options.batch_rows) continue;
+          b.bytes = size_t(q - mark);
+          mark = q;
+          if (!queue.push(std::move(b))) return;
+          b = batch();
+        }
+        b.bytes = size_t(q - mark);
+        if (!queue.push(std::move(b))) return;
+      }
+      if (!--running) queue.close();
+    });
+  }
+
+  batch b;
+  while (queue.pop(b)) {
+    for (auto const& row : b.rows) {
+      if (!load->write(row)) {
+        stats.ok = false;
+        break;
+      }
+    }
+    if (!stats.ok) {
+      queue.close();
+      break;
+    }
+    stats.rows += b.rows.size();
+    stats.bytes += b.bytes;
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (options.progress) options.progress(stats);
+  }
+  for (auto& worker : workers) worker.join();
+  stats.ok = load->finish() && stats.ok;
+  stats.bytes += size_t(p - data);
+  stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return stats;
+}
+
+} // namespace sqlxx
+
+#endif  // _SQLXX_IMPORT_H_
@@ -0,0 +1,659 @@
+///////////////////////////////////////////////////////////////////////////////
+/// \author (c) Anthony Fieroni (bvbfan@abv.bg)
+///             2017, Plovdiv, Bulgaria
+///
+/// \license The MIT License (MIT)
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights
+/// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+/// copies of the Software, and to permit persons to whom the Software is
+/// furnished to do so, subject to the following conditions:
+///
+/// The above copyright notice and this permission notice shall be included in
+/// all copies or substantial portions of the Software.
+///
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+/// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+/// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+/// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+/// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+/// THE SOFTWARE.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _SQLXX_OPS_H_
+#define _SQLXX_OPS_H_
+
+#include "sqlxx.h"
+#include "sqlxx_codec.h"
+
+#include <unordered_map>
+
+namespace sqlxx {
+
+/*
+ * Compare fields the SQLite way, NULL < numbers < text < blob
+ */
+static inline
+int compare(field_type const& a, field_type const& b) {
+  auto rank = [](sql_type t) -> int {
+    switch (t) {
+      case SQL_NULL    : return 0;
+      case SQL_INTEGER :
+      case SQL_FLOAT   : return 1;
+      case SQL_TEXT    : return 2;
+      case SQL_BLOB    : return 3;
+      default          : return -1;
+    }
+  };
+  int ra = rank(a.type()), rb = rank(b.type());
+  if (ra != rb) return ra < rb ? -1 : 1;
+  switch (a.type()) {
+    case SQL_INTEGER: case SQL_FLOAT: {
+      if (a.type() == SQL_INTEGER && b.type() == SQL_INTEGER) {
+        std::int64_t const& x = a; std::int64_t const& y = b;
+        return x < y ? -1 : (y < x ? 1 : 0);
+      }
+      double const& x = a; double const& y = b;
+      return x < y ? -1 : (y < x ? 1 : 0);
+    }
+    case SQL_TEXT: case SQL_BLOB: {
+      int c = std::memcmp(a.data(), b.data(), std::min(a.size(), b.size()));
+      if (c) return c < 0 ? -1 : 1;
+      return a.size() < b.size() ? -1 : (b.size() < a.size() ? 1 : 0);
+    }
+    default: return 0;
+  }
+}
+
+/*
+ * Stable 64-bit FNV-1a hash of a field value, same on every host,
+ * integral floats hash as integers since they compare equal
+ */
+static inline
+std::uint64_t field_hash(field_type const& f, std::uint64_t h = 14695981039346656037ULL) {
+  auto mix = [&h](unsigned char const* p, size_t n) {
+    for (size_t i = 0; i < n; ++i) { h ^= p[i]; h *= 1099511628211ULL; }
+  };
+  auto mix_int = [&mix](std::uint64_t v) {
+    unsigned char b[8];
+    for (int i = 0; i < 8; ++i) b[i] = static_cast<unsigned char>(v >> (8 * i));
+    mix(b, 8);
+  };
+  switch (f.type()) {
+    case SQL_INTEGER: mix_int(std::uint64_t(std::int64_t(f))); break;
+    case SQL_FLOAT: {
+      double const& d = f;
+      if (d == std::floor(d) && std::fabs(d) < 9.2e18) {
+        mix_int(std::uint64_t(std::int64_t(d)));
+      } else {
+        std::uint64_t bits;
+        std::memcpy(&bits, &d, sizeof(bits));
+        mix_int(bits);
+      }
+    } break;
+    case SQL_TEXT: case SQL_BLOB: {
+      mix(reinterpret_cast<unsigned char const*>(f.data()), f.size());
+    } break;
+    default: {
+      unsigned char t = static_cast<unsigned char>(f.type());
+      mix(&t, 1);
+    } break;
+  }
+  return h;
+}
+
+/*
+ * Column index in a row by name, row size if there is no such column
+ */
+static inline
+size_t column_index(row const& r, std::string const& name) {
+  size_t idx = 0;
+  for (; idx < r.size() && r[idx].name() != name; ++idx);
+  return idx;
+}
+
+/*
+ * Rows of several statements one after another
+ */
+class concat_statement : public statement {
+public:
+  concat_statement(std::vector<std::shared_ptr<statement>> stmts) : stmts_(std::move(stmts)) {
+    for (auto const& stmt : stmts_) {
+      if (stmt->result() != SQL_OK && result_ == SQL_OK) result_ = stmt->result();
+      affected_rows_ += stmt->affected_rows();
+      last_id_ = std::max(last_id_, stmt->last_id());
+    }
+  }
+
+  row next() override {
+    for (; current_ < stmts_.size(); ++current_) {
+      auto r = stmts_[current_]->next();
+      if (!r.empty()) return r;
+    }
+    return {};
+  }
+
+  void first() override {
+    current_ = 0;
+    for (auto const& stmt : stmts_) stmt->first();
+  }
+
+  result_type result() const override { return result_; }
+  std::uint64_t last_id() const override { return last_id_; }
+  std::uint64_t affected_rows() const override { return affected_rows_; }
+
+private:
+  std::vector<std::shared_ptr<statement>> stmts_;
+  size_t current_ = 0;
+  result_type result_ = SQL_OK;
+  std::uint64_t last_id_ = 0;
+  std::uint64_t affected_rows_ = 0;
+};
+
+/*
+ * Heap based k-way merge of statements sorted by the same column
+ */
+class merge_statement : public statement {
+public:
+  merge_statement(std::vector<std::shared_ptr<statement>> stmts,
+                  std::string column, bool descending = false)
+    : stmts_(std::move(stmts)), column_(std::move(column)), descending_(descending) {
+    for (auto const& stmt : stmts_) {
+      if (stmt->result() != SQL_OK && result_ == SQL_OK) result_ = stmt->result();
+      affected_rows_ += stmt->affected_rows();
+    }
+  }
+
+  row next() override {
+    if (!primed_) {
+      primed_ = true;
+      for (size_t i = 0; i < stmts_.size(); ++i) push(stmts_[i]->next(), i);
+    }
+    if (heap_.empty()) return {};
+    std::pop_heap(heap_.begin(), heap_.end(), greater());
+    auto top = std::move(heap_.back());
+    heap_.pop_back();
+    push(stmts_[top.source]->next(), top.source);
+    return std::move(top.value);
+  }
+
+  void first() override {
+    heap_.clear();
+    primed_ = false;
+    for (auto const& stmt : stmts_) stmt->first();
+  }
+
+  result_type result() const override { return result_; }
+  std::uint64_t last_id() const override { return 0; }
+  std::uint64_t affected_rows() const override { return affected_rows_; }
+
+private:
+  struct entry {
+    row value;
+    size_t source;
+  };
+
+  // min heap on the column, ties are broken by source to keep it stable
+  struct order {
+    merge_statement const* self;
+    bool operator()(entry const& a, entry const& b) const {
+      int c = compare(a.value[self->index_], b.value[self->index_]);
+      if (self->descending_) c = -c;
+      return c ? c > 0 : a.source > b.source;
+    }
+  };
+
+  order greater() const { return { this }; }
+
+  void push(row r, size_t source) {
+    if (r.empty()) return;
+    if (index_ == npos) index_ = column_index(r, column_);
+    heap_.push_back({ std::move(r), source });
+    std::push_heap(heap_.begin(), heap_.end(), greater());
+  }
+
+  static constexpr size_t npos = size_t(-1);
+
+  std::vector<std::shared_ptr<statement>> stmts_;
+  std::string const column_;
+  bool const descending_;
+  size_t index_ = npos;
+  bool primed_ = false;
+  std::vector<entry> heap_;
+  result_type result_ = SQL_OK;
+  std::uint64_t affected_rows_ = 0;
+};
+
+/*
+ * k-way merge of cursors sorted by the same key column
+ */
+static inline
+cursor merge_sorted(std::vector<cursor> cursors, std::string const& key, bool descending = false) {
+  std::vector<std::shared_ptr<statement>> stmts;
+  for (auto const& cur : cursors) stmts.push_back(cur.get());
+  return { std::make_shared<merge_statement>(std::move(stmts), key, descending) };
+}
+
+// collects cursors of merge_sorted, key is the last argument
+struct merge_args {
+  static void collect(std::vector<cursor>&, std::string& key, std::string const& k) { key = k; }
+
+  template<class... Args>
+  static void collect(std::vector<cursor>& cursors, std::string& key, cursor&& c, Args&&... rest) {
+    cursors.push_back(std::move(c));
+    collect(cursors, key, std::forward<Args>(rest)...);
+  }
+};
+
+// merge_sorted(c1, c2, ..., cn, key)
+template<class... Args>
+cursor merge_sorted(cursor&& c, Args&&... rest) {
+  std::vector<cursor> cursors;
+  std::string key;
+  merge_args::collect(cursors, key, std::move(c), std::forward<Args>(rest)...);
+  return merge_sorted(std::move(cursors), key);
+}
+
+// join key columns, build side column and probe side column
+typedef std::vector<std::pair<std::string, std::string>> join_keys;
+
+/*
+ * Inner hash join, build rows are kept encoded in a compact open addressing
+ * table, over the memory budget both sides are partitioned to temporary
+ * files and joined partition by partition, joined rows are probe then build
+ * fields, NULL keys never match
+ */
+class hash_join_statement : public statement {
+public:
+  hash_join_statement(std::shared_ptr<statement> build, std::shared_ptr<statement> probe,
+                      join_keys keys, size_t budget)
+    : build_(std::move(build)), probe_(std::move(probe)), keys_(std::move(keys))
+    , budget_(budget) {
+    result_ = build_->result() != SQL_OK ? build_->result() : probe_->result();
+  }
+
+  row next() override {
+    if (!built_) build();
+    for (;;) {
+      while (match_ < matches_.size()) {
+        row build_row;
+        char const* p = table_.arena().data() + matches_[match_++];
+        codec::get_row(p, table_.arena().data() + table_.arena().size(), build_names_, build_row);
+        if (!equal(probe_row_, probe_idx_, build_row, build_idx_)) continue;
+        row joined = probe_row_;
+        joined.insert(joined.end(), build_row.begin(), build_row.end());
+        return joined;
+      }
+      matches_.clear();
+      match_ = 0;
+      if (!next_probe(probe_row_)) return {};
+      std::uint64_t hash;
+      if (!key_hash(probe_row_, probe_idx_, hash)) continue;
+      table_.find(hash, matches_);
+    }
+  }
+
+  void first() override {
+    matches_.clear();
+    match_ = 0;
+    if (!built_) return;
+    if (partitions_.empty()) {
+      probe_->first();
+    } else {
+      partition_ = 0;
+      loaded_ = false;
+    }
+  }
+
+  result_type result() const override { return result_; }
+  std::uint64_t last_id() const override { return 0; }
+  std::uint64_t affected_rows() const override { return 0; }
+
+private:
+  /*
+   * Open addressing (linear probing) table of hash -> arena offset
+   */
+  class table {
+  public:
+    void insert(std::uint64_t hash, std::uint64_t offset) {
+      if ((used_ + 1) * 2 > slots_.size()) grow();
+      size_t mask = slots_.size() - 1;
+      for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+        if (slots_[i].hash) continue;
+        slots_[i] = { hash, offset };
+        ++used_;
+        return;
+      }
+    }
+
+    void find(std::uint64_t hash, std::vector<std::uint64_t>& offsets) const {
+      if (slots_.empty()) return;
+      size_t mask = slots_.size() - 1;
+      for (size_t i = hash & mask; slots_[i].hash; i = (i + 1) & mask) {
+        if (slots_[i].hash == hash) offsets.push_back(slots_[i].offset);
+      }
+    }
+
+    void clear() {
+      slots_.clear();
+      arena_.clear();
+      used_ = 0;
+    }
+
+    // encoded rows
+    std::string& arena() { return arena_; }
+
+    size_t memory() const { return arena_.size() + slots_.size() * sizeof(slot); }
+
+  private:
+    struct slot {
+      std::uint64_t hash;   // 0 is an empty slot
+      std::uint64_t offset;
+    };
+
+    void grow() {
+      std::vector<slot> old(std::max<size_t>(16, slots_.size() * 2));
+      old.swap(slots_);
+      used_ = 0;
+      for (auto const& s : old) {
+        if (s.hash) insert(s.hash, s.offset);
+      }
+    }
+
+    std::vector<slot> slots_;
+    std::string arena_;
+    size_t used_ = 0;
+  };
+
+  static constexpr size_t partitions = 16;
+
+  static size_t partition(std::uint64_t hash) { return size_t(hash >> 56) % partitions; }
+
+  std::vector<size_t> key_index(row const& r, bool build) const {
+    std::vector<size_t> idx;
+    for (auto const& key : keys_) idx.push_back(column_index(r, build ? key.first : key.second));
+    return idx;
+  }
+
+  // false if any key is NULL
+  static bool key_hash(row const& r, std::vector<size_t> const& idx, std::uint64_t& hash) {
+    hash = 14695981039346656037ULL;
+    for (auto i : idx) {
+      if (r[i].is_null() || r[i].type() == SQL_INVALID) return false;
+      hash = field_hash(r[i], hash);
+    }
+    if (!hash) hash = 1;
+    return true;
+  }
+
+  static bool equal(row const& a, std::vector<size_t> const& ia,
+                    row const& b, std::vector<size_t> const& ib) {
+    for (size_t k = 0; k < ia.size(); ++k) {
+      if (compare(a[ia[k]], b[ib[k]])) return false;
+    }
+    return true;
+  }
+
+  void insert(row const& r, std::uint64_t hash) {
+    auto& arena = table_.arena();
+    auto offset = arena.size();
+    codec::put_row(arena, r);
+    table_.insert(hash, offset);
+  }
+
+  void build() {
+    built_ = true;
+    build_->first();
+    for (row r = build_->next(); !r.empty(); r = build_->next()) {
+      if (build_names_.empty()) {
+        build_names_ = codec::names(r);
+        build_idx_ = key_index(r, true);
+      }
+      std::uint64_t hash;
+      if (!key_hash(r, build_idx_, hash)) continue;
+      if (!partitions_.empty()) {
+        partitions_[partition(hash)].build.write(r);
+        continue;
+      }
+      insert(r, hash);
+      if (table_.memory() > budget_) spill();
+    }
+    probe_->first();
+    if (partitions_.empty()) return;
+    for (row r = probe_->next(); !r.empty(); r = probe_->next()) {
+      if (probe_names_.empty()) {
+        probe_names_ = codec::names(r);
+        probe_idx_ = key_index(r, false);
+      }
+      std::uint64_t hash;
+      if (!key_hash(r, probe_idx_, hash)) continue;
+      partitions_[partition(hash)].probe.write(r);
+    }
+    partition_ = 0;
+    loaded_ = false;
+  }
+
+  // move build rows from memory to partition files
+  void spill() {
+    partitions_ = std::vector<spill_partition>(partitions);
+    auto const& arena = table_.arena();
+    char const* p = arena.data();
+    char const* end = p + arena.size();
+    row r;
+    while (p < end && codec::get_row(p, end, build_names_, r)) {
+      std::uint64_t hash;
+      key_hash(r, build_idx_, hash);
+      partitions_[partition(hash)].build.write(r);
+    }
+    table_.clear();
+  }
+
+  bool next_probe(row& r) {
+    if (partitions_.empty()) {
+      r = probe_->next();
+      if (!r.empty() && probe_idx_.empty()) probe_idx_ = key_index(r, false);
+      return !r.empty();
+    }
+    while (partition_ < partitions_.size()) {
+      if (loaded_ && partitions_[partition_].probe.read(probe_names_, r)) return true;
+      if (loaded_) ++partition_;
+      if (partition_ < partitions_.size()) load(partition_);
+    }
+    return false;
+  }
+
+  // build table of a partition
+  void load(size_t idx) {
+    loaded_ = true;
+    table_.clear();
+    auto& part = partitions_[idx];
+    part.build.rewind();
+    part.probe.rewind();
+    row r;
+    while (part.build.read(build_names_, r)) {
+      std::uint64_t hash;
+      if (key_hash(r, build_idx_, hash)) insert(r, hash);
+    }
+  }
+
+  struct spill_partition {
+    row_file build;
+    row_file probe;
+  };
+
+  std::shared_ptr<statement> build_;
+  std::shared_ptr<statement> probe_;
+  join_keys const keys_;
+  size_t const budget_;
+  result_type result_;
+  bool built_ = false;
+  table table_;
+  std::vector<std::string> build_names_, probe_names_;
+  std::vector<size_t> build_idx_, probe_idx_;
+  std::vector<spill_partition> partitions_;
+  size_t partition_ = 0;  // partition being joined
+  bool loaded_ = false;   // its build rows are in the table
+  row probe_row_;
+  std::vector<std::uint64_t> matches_;
+  size_t match_ = 0;
+};
+
+static inline
+cursor hash_join(cursor build, cursor probe, join_keys keys, size_t budget = 64 << 20) {
+  return { std::make_shared<hash_join_statement>(build.get(), probe.get(), std::move(keys), budget) };
+}
+
+// join on columns named the same on both sides
+static inline
+cursor hash_join(cursor build, cursor probe, std::vector<std::string> const& keys,
+                 size_t budget = 64 << 20) {
+  join_keys pairs;
+  for (auto const& key : keys) pairs.emplace_back(key, key);
+  return hash_join(std::move(build), std::move(probe), std::move(pairs), budget);
+}
+
+/*
+ * Aggregate of a group, NULL values are ignored like in SQL
+ */
+struct aggregate {
+  enum kind_type { COUNT, SUM, MIN, MAX, AVG };
+
+  kind_type kind;
+  std::string column; // empty for COUNT(*)
+  std::string name;   // result column name
+
+  static aggregate count(std::string const& column = {}) {
+    return { COUNT, column, "count(" + (column.empty() ? "*" : column) + ')' };
+  }
+  static aggregate sum(std::string const& column) { return { SUM, column, "sum(" + column + ')' }; }
+  static aggregate min(std::string const& column) { return { MIN, column, "min(" + column + ')' }; }
+  static aggregate max(std::string const& column) { return { MAX, column, "max(" + column + ')' }; }
+  static aggregate avg(std::string const& column) { return { AVG, column, "avg(" + column + ')' }; }
+
+  // rename result column
+  aggregate as(std::string const& alias) const { return { kind, column, alias }; }
+};
+
+/*
+ * Hash aggregation, groups are returned in order of first appearance,
+ * only groups are kept in memory, not the input rows
+ */
+class group_statement : public statement {
+public:
+  group_statement(std::shared_ptr<statement> input, std::vector<std::string> keys,
+                  std::vector<aggregate> aggregates)
+    : input_(std::move(input)), keys_(std::move(keys)), aggregates_(std::move(aggregates))
+    , result_(input_->result()) {}
+
+  row next() override {
+    if (!done_) run();
+    if (current_ >= groups_.size()) return {};
+    auto const& g = groups_[current_++];
+    row r = g.keys;
+    for (size_t i = 0; i < aggregates_.size(); ++i) {
+      auto const& a = aggregates_[i];
+      auto const& s = g.states[i];
+      switch (a.kind) {
+        case aggregate::COUNT: r.emplace_back(s.count, a.name); break;
+        case aggregate::SUM:
+          if (!s.count) r.emplace_back(a.name);
+          else if (s.integral) r.emplace_back(s.isum, a.name);
+          else r.emplace_back(s.sum, a.name);
+          break;
+        case aggregate::AVG:
+          if (!s.count) r.emplace_back(a.name);
+          else r.emplace_back(s.sum / double(s.count), a.name);
+          break;
+        case aggregate::MIN: case aggregate::MAX:
+          r.push_back(s.value.renamed(a.name));
+          break;
+      }
+    }
+    return r;
+  }
+
+  void first() override { current_ = 0; }
+  result_type result() const override { return result_; }
+  std::uint64_t last_id() const override { return 0; }
+  std::uint64_t affected_rows() const override { return 0; }
+
+private:
+  struct state {
+    std::int64_t count = 0;
+    std::int64_t isum = 0;
+    double sum = 0;
+    bool integral = true;
+    field_type value;
+  };
+
+  struct group {
+    row keys;
+    std::vector<state> states;
+  };
+
+  void run() {
+    done_ = true;
+    input_->first();
+    std::vector<size_t> key_idx, agg_idx;
+    std::unordered_map<std::string, size_t> index;
+    std::string encoded;
+    for (row r = input_->next(); !r.empty(); r = input_->next()) {
+      if (key_idx.empty() && agg_idx.empty()) {
+        for (auto const& key : keys_) key_idx.push_back(column_index(r, key));
+        for (auto const& a : aggregates_) agg_idx.push_back(column_index(r, a.column));
+      }
+      encoded.clear();
+      for (auto i : key_idx) codec::put_field(encoded, r[i]);
+      auto it = index.find(encoded);
+      if (it == index.end()) {
+        it = index.emplace(encoded, groups_.size()).first;
+        group g;
+        for (auto i : key_idx) g.keys.push_back(r[i]);
+        g.states.resize(aggregates_.size());
+        groups_.push_back(std::move(g));
+      }
+      auto& g = groups_[it->second];
+      for (size_t i = 0; i < aggregates_.size(); ++i) {
+        auto const& a = aggregates_[i];
+        auto const& f = r[agg_idx[i]];
+        auto& s = g.states[i];
+        if (a.kind == aggregate::COUNT && a.column.empty()) { ++s.count; continue; }
+        if (f.is_null() || f.type() == SQL_INVALID) continue;
+        switch (a.kind) {
+          case aggregate::COUNT: break;
+          case aggregate::SUM: case aggregate::AVG:
+            s.integral = s.integral && f.type() == SQL_INTEGER;
+            s.isum += std::int64_t(f);
+            s.sum += double(f);
+            break;
+          case aggregate::MIN:
+            if (!s.count || compare(f, s.value) < 0) s.value = f;
+            break;
+          case aggregate::MAX:
+            if (!s.count || compare(f, s.value) > 0) s.value = f;
+            break;
+        }
+        ++s.count;
+      }
+    }
+  }
+
+  std::shared_ptr<statement> input_;
+  std::vector<std::string> const keys_;
+  std::vector<aggregate> const aggregates_;
+  result_type result_;
+  bool done_ = false;
+  std::vector<group> groups_;
+  size_t current_ = 0;
+};
+
+static inline
+cursor group_by(cursor input, std::vector<std::string> keys, std::vector<aggregate> aggregates) {
+  return { std::make_shared<group_statement>(input.get(), std::move(keys), std::move(aggregates)) };
+}
+
+} // namespace sqlxx
+
+#endif  // _SQLXX_OPS_H_
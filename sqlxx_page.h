@@ -0,0 +1,193 @@
+///////////////////////////////////////////////////////////////////////////////
+/// \author (c) Anthony Fieroni (bvbfan@abv.bg)
+///             2017, Plovdiv, Bulgaria
+///
+/// \license The MIT License (MIT)
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights
+/// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+/// copies of the Software, and to permit persons to whom the Software is
+/// furnished to do so, subject to the following conditions:
+///
+/// The above copyright notice and this permission notice shall be included in
+/// all copies or substantial portions of the Software.
+///
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+/// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+/// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+/// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+/// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+/// THE SOFTWARE.
+///////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef _SQLXX_PAGE_H_
+#define _SQLXX_PAGE_H_
+
+#include "sqlxx.h"
+
+namespace sqlxx {
+
+/*
+ * Keyset pagination, a page continues after the key of the last row of
+ * the page before (WHERE (k1, k2) > (?, ?) ORDER BY k1, k2 LIMIT n), so
+ * every page costs as the first one instead of scanning an OFFSET.
+ * Keys are result column names of the base query, unique together and
+ * not NULL, the base query text is trusted and not escaped
+ */
+class pager {
+public:
+  pager(connection& con, std::string const& base, std::vector<std::string> keys,
+        size_t page_size, std::vector<field_type> binds = {})
+    : con_(&con), keys_(std::move(keys)), size_(page_size ? page_size : 1), binds_(std::move(binds)) {
+    std::string from = "SELECT * FROM (" + trim(base) + ") sqlxx_page";
+    std::string order = " ORDER BY ";
+    for (size_t i = 0; i < keys_.size(); ++i) {
+      if (i) order += ", ";
+      order += keys_[i];
+    }
+    order += " LIMIT " + std::to_string(size_);
+    first_ = from + order;
+    // texts stay the same for all pages, their statements are cached
+    next_ = from + " WHERE " + (con.row_values() ? row_value() : expanded()) + order;
+  }
+
+  pager(pager&&) = default;
+  pager& operator=(pager&&) = default;
+  pager(pager const&) = delete;
+  pager& operator=(pager const&) = delete;
+
+  // the previous page is read to its end to know where the next one starts
+  bool done() {
+    finish();
+    return done_;
+  }
+
+  // next page, no rows after the last one
+  cursor next() {
+    if (done()) return { std::make_shared<error_statement>(SQL_OK) };
+    auto binds = binds_;
+    if (!last_.empty()) {
+      if (con_->row_values()) {
+        binds.insert(binds.end(), last_.begin(), last_.end());
+      } else {
+        // k1 > ? OR (k1 = ? AND k2 > ?) ...
+        for (size_t i = 0; i < last_.size(); ++i) {
+          binds.insert(binds.end(), last_.begin(), last_.begin() + i + 1);
+        }
+      }
+    }
+    auto q = con_->query();
+    auto cur = query::dispatch(*q, last_.empty() ? first_.c_str() : next_.c_str(), std::move(binds));
+    if (cur.result() != SQL_OK) {
+      done_ = true;
+      return cur;
+    }
+    page_ = std::make_shared<page_statement>(cur.get(), keys_);
+    return { page_ };
+  }
+
+  // key of the last row read, a new pager can resume from it
+  std::vector<field_type> const& last_key() const { return last_; }
+  void resume(std::vector<field_type> key) { last_ = std::move(key); }
+
+private:
+  // remembers the key of the last row
+  class page_statement : public statement {
+  public:
+    page_statement(std::shared_ptr<statement> stmt, std::vector<std::string> const& keys)
+      : stmt_(std::move(stmt)), keys_(keys) {}
+
+    row next() override {
+      auto r = stmt_->next();
+      if (r.empty()) {
+        end_ = true;
+        return r;
+      }
+      if (++pos_ > rows_) {
+        rows_ = pos_;
+        key_.clear();
+        for (auto const& key : keys_) key_.push_back(r[key.c_str()].renamed({}));
+      }
+      return r;
+    }
+
+    void first() override { stmt_->first(); pos_ = 0; end_ = false; }
+    result_type result() const override { return stmt_->result(); }
+    std::uint64_t last_id() const override { return stmt_->last_id(); }
+    std::uint64_t affected_rows() const override { return stmt_->affected_rows(); }
+
+    // rows read to the end, from where the reader stopped (a rewind
+    // would run the query again)
+    size_t finish() {
+      while (!end_ && !next().empty());
+      return rows_;
+    }
+
+    std::vector<field_type> key_;
+
+  private:
+    std::shared_ptr<statement> stmt_;
+    std::vector<std::string> const keys_;
+    size_t pos_ = 0;
+    size_t rows_ = 0;
+    bool end_ = false;
+  };
+
+  void finish() {
+    if (!page_) return;
+    size_t rows = page_->finish();
+    if (rows) last_ = std::move(page_->key_);
+    done_ = rows < size_;
+    page_.reset();
+  }
+
+  std::string row_value() const {
+    std::string cols, marks;
+    for (size_t i = 0; i < keys_.size(); ++i) {
+      cols += i ? ", " : "(";
+      cols += keys_[i];
+      marks += i ? ", ?" : "(?";
+    }
+    return cols + ") > " + marks + ')';
+  }
+
+  std::string expanded() const {
+    std::string text;
+    for (size_t i = 0; i < keys_.size(); ++i) {
+      text += i ? " OR (" : "(";
+      for (size_t j = 0; j < i; ++j) text += keys_[j] + " = ? AND ";
+      text += keys_[i] + " > ?)";
+    }
+    return '(' + text + ')';
+  }
+
+  static std::string trim(std::string text) {
+    while (!text.empty() && (std::isspace(static_cast<unsigned char>(text.back())) || text.back() == ';')) {
+      text.pop_back();
+    }
+    return text;
+  }
+
+  connection* con_;
+  std::vector<std::string> keys_;
+  size_t size_;
+  std::vector<field_type> binds_;   // of the base query
+  std::string first_;
+  std::string next_;
+  std::vector<field_type> last_;    // key to continue after
+  std::shared_ptr<page_statement> page_;
+  bool done_ = false;
+};
+
+static inline
+pager paginate(connection& con, std::string const& base, std::vector<std::string> keys,
+               size_t page_size, std::vector<field_type> binds = {}) {
+  return { con, base, std::move(keys), page_size, std::move(binds) };
+}
+
+} // namespace sqlxx
+
+#endif  // _SQLXX_PAGE_H_
@@ -0,0 +1,238 @@
+///////////////////////////////////////////////////////////////////////////////
+/// \author (c) Anthony Fieroni (bvbfan@abv.bg)
+///             2017, Plovdiv, Bulgaria
+///
+/// \license The MIT License (MIT)
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights
+/// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+/// copies of the Software, and to permit persons to whom the Software is
+/// furnished to do so, subject to the following conditions:
+///
+/// The above copyright notice and this permission notice shall be included in
+/// all copies or substantial portions of the Software.
+///
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+/// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+/// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+/// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+/// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+/// THE SOFTWARE.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _SQLXX_POOL_H_
+#define _SQLXX_POOL_H_
+
+#include "sqlxx.h"
+
+#include <mutex>
+#include <future>
+#include <functional>
+#include <condition_variable>
+
+namespace sqlxx {
+
+/*
+ * Pool of connections, opened in parallel and warmed with hot statements
+ */
+class pool : public connection {
+public:
+  typedef std::function<std::unique_ptr<connection>()> factory;
+  typedef std::function<std::vector<std::unique_ptr<connection>>(size_t)> bulk_factory;
+
+  // open size connections, each one on its own thread
+  static std::unique_ptr<pool> create(size_t size, factory open,
+                                      std::vector<std::string> warm = {}) {
+    std::unique_ptr<pool> p{ new pool(std::move(warm)) };
+    auto* self = p.get();
+    p->opener_ = std::async(std::launch::async, [self, size, open]() {
+      std::vector<std::future<void>> workers;
+      for (size_t i = 0; i < size; ++i) {
+        workers.push_back(std::async(std::launch::async, [self, open]() {
+          self->add(open());
+        }));
+      }
+      for (auto& worker : workers) worker.wait();
+      self->done();
+    });
+    return p;
+  }
+
+  // open size connections at once by backend (i.e. pqsqlxx poll loop)
+  static std::unique_ptr<pool> create_bulk(size_t size, bulk_factory open,
+                                           std::vector<std::string> warm = {}) {
+    std::unique_ptr<pool> p{ new pool(std::move(warm)) };
+    auto* self = p.get();
+    p->opener_ = std::async(std::launch::async, [self, size, open]() {
+      auto cons = open(size);
+      std::vector<std::future<void>> workers;
+      for (auto& con : cons) {
+        auto* c = con.release();
+        workers.push_back(std::async(std::launch::async, [self, c]() {
+          self->add(std::unique_ptr<connection>(c));
+        }));
+      }
+      for (auto& worker : workers) worker.wait();
+      self->done();
+    });
+    return p;
+  }
+
+  ~pool() override {
+    if (opener_.valid()) opener_.wait();
+  }
+
+  // number of open connections, ready when all are connected and warmed
+  std::shared_future<size_t> ready() const { return ready_; }
+
+  // number of open connections
+  size_t size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return all_.size();
+  }
+
+  // take an idle connection, it's back to the pool when lease is gone,
+  // blocks until one is idle, null if pool failed to open any
+  std::shared_ptr<connection> acquire() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this]() { return !idle_.empty() || (!opening_ && all_.empty()); });
+    if (idle_.empty()) return {};
+    auto* con = idle_.back();
+    idle_.pop_back();
+    return { con, [this](connection* c) { release(c); } };
+  }
+
+  void vacuum() override {
+    if (auto con = acquire()) con->vacuum();
+  }
+
+  std::string version() override {
+    auto con = acquire();
+    return con ? con->version() : std::string();
+  }
+
+  std::unique_ptr<sqlxx::query> query(std::string const& str) override {
+    return std::unique_ptr<sqlxx::query>{ new pooled_query(*this, str) };
+  }
+
+  bool row_values() const override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return !all_.empty() && all_.front()->row_values();
+  }
+
+  // bulk load on one leased connection
+  std::unique_ptr<bulk_insert> bulk(std::string const& table,
+                                    std::vector<std::string> const& columns) override {
+    auto con = acquire();
+    if (!con) return {};
+    auto load = con->bulk(table, columns);
+    if (!load) return {};
+    return std::unique_ptr<bulk_insert>{ new leased_insert(std::move(con), std::move(load)) };
+  }
+
+private:
+  class leased_insert : public bulk_insert {
+  public:
+    leased_insert(std::shared_ptr<connection> con, std::unique_ptr<bulk_insert> load)
+      : con_(std::move(con)), load_(std::move(load)) {}
+
+    bool write(std::vector<field_type> const& values) override { return load_->write(values); }
+    bool finish() override { return load_->finish(); }
+
+  private:
+    std::shared_ptr<connection> con_;    // released after the load
+    std::unique_ptr<bulk_insert> load_;
+  };
+
+  class pooled_query : public sqlxx::query {
+  public:
+    pooled_query(pool& p, std::string const& str) : sqlxx::query(str), pool_(p) {}
+
+  private:
+    cursor execute_impl(char const* text, std::vector<field_type> bind) override {
+      auto con = pool_.acquire();
+      if (!con) return { std::make_shared<error_statement>(SQL_SERVER_LOST) };
+      auto q = con->query();
+      auto cur = dispatch(*q, text, std::move(bind));
+      return { std::make_shared<holder_statement>(cur.get(), con) };
+    }
+
+    // all bind sets go to one leased connection
+    batch_result execute_many_impl(char const* text, bind_source const& next, bool per_set) override {
+      auto con = pool_.acquire();
+      if (!con) {
+        batch_result result;
+        result.result = SQL_SERVER_LOST;
+        return result;
+      }
+      return dispatch_many(*con->query(), text, next, per_set);
+    }
+
+    bool prepare_impl(char const* text) override {
+      return pool_.prepare_idle(text);
+    }
+
+    pool& pool_;
+  };
+
+  pool(std::vector<std::string> warm)
+    : warm_(std::move(warm)), ready_(promise_.get_future().share()) {}
+
+  pool(pool&&) = delete;
+  pool(pool const&) = delete;
+  pool& operator=(pool&&) = delete;
+  pool& operator=(pool const&) = delete;
+
+  void add(std::unique_ptr<connection> con) {
+    if (!con) return;
+    for (auto const& str : warm_) con->prepare(str);
+    std::lock_guard<std::mutex> lock(mutex_);
+    idle_.push_back(con.get());
+    all_.push_back(std::move(con));
+    cv_.notify_one();
+  }
+
+  void done() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    opening_ = false;
+    promise_.set_value(all_.size());
+    cv_.notify_all();
+  }
+
+  void release(connection* con) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    idle_.push_back(con);
+    cv_.notify_one();
+  }
+
+  // prepare on connections not in use at the moment
+  bool prepare_idle(char const* text) {
+    std::vector<connection*> idle;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      idle.swap(idle_);
+    }
+    bool prepared = !idle.empty();
+    for (auto* con : idle) {
+      prepared = sqlxx::query::dispatch_prepare(*con->query(), text) && prepared;
+      release(con);
+    }
+    return prepared;
+  }
+
+  std::vector<std::string> const warm_;          // hot statements
+  std::vector<std::unique_ptr<connection>> all_; // open connections
+  std::vector<connection*> idle_;                // not in use
+  bool opening_ = true;                          // opener is running
+  mutable std::mutex mutex_;
+  std::condition_variable cv_;
+  std::promise<size_t> promise_;
+  std::shared_future<size_t> ready_;
+  std::future<void> opener_;
+};
+
+} // namespace sqlxx
+
+#endif  // _SQLXX_POOL_H_
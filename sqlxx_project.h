@@ -0,0 +1,411 @@
+///////////////////////////////////////////////////////////////////////////////
+/// \author (c) Anthony Fieroni (bvbfan@abv.bg)
+///             2017, Plovdiv, Bulgaria
+///
+/// \license The MIT License (MIT)
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights
+/// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+/// copies of the Software, and to permit persons to whom the Software is
+/// furnished to do so, subject to the following conditions:
+///
+/// The above copyright notice and this permission notice shall be included in
+/// all copies or substantial portions of the Software.
+///
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+/// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+/// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+/// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+/// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+/// THE SOFTWARE.
+///////////////////////////////////////////////////////////////////////////////
+
+
+
+#ifndef _SQLXX_PROJECT_H_
+#define _SQLXX_PROJECT_H_
+
+#include "sqlxx.h"
+
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+
+namespace sqlxx {
+
+/*
+ * Query text with literals as ? and whitespace collapsed, the same for
+ * every run of a query whatever its values
+ */
+static inline
+std::string query_fingerprint(char const* text) {
+  std::string out;
+  bool space = false;
+  for (char const* p = text ? text : ""; *p; ) {
+    auto c = static_cast<unsigned char>(*p);
+    if (std::isspace(c)) {
+      space = !out.empty();
+      ++p;
+      continue;
+    }
+    if (space) out += ' ';
+    space = false;
+    auto prev = out.empty() ? ' ' : static_cast<unsigned char>(out.back());
+    if (c == '\'') {
+      for (++p; *p; ++p) {
+        if (*p == '\\' && p[1]) ++p;
+        else if (*p == '\'' && p[1] == '\'') ++p;
+        else if (*p == '\'') break;
+      }
+      if (*p) ++p;
+      out += '?';
+    } else if (c == '"' || c == '`') {
+      // quoted identifier as it is
+      char const* end = std::strchr(p + 1, *p);
+      end = end ? end + 1 : p + std::strlen(p);
+      out.append(p, end);
+      p = end;
+    } else if (std::isdigit(c) && !std::isalnum(prev) && prev != '_' && prev != '$') {
+      while (std::isalnum(static_cast<unsigned char>(*p)) || *p == '.') ++p;
+      out += '?';
+    } else {
+      out += *p++;
+    }
+  }
+  while (!out.empty() && (out.back() == ';' || out.back() == ' ')) out.pop_back();
+  return out;
+}
+
+/*
+ * Position of * in SELECT * FROM ..., npos if the select list is anything else
+ */
+static inline
+size_t select_star(std::string const& text) {
+  size_t p = 0;
+  auto blank = [&text, &p]() {
+    size_t from = p;
+    while (p < text.size() && std::isspace(static_cast<unsigned char>(text[p]))) ++p;
+    return p > from;
+  };
+  auto word = [&text, &p](char const* w) {
+    size_t n = std::strlen(w);
+    if (text.size() - p < n) return false;
+    for (size_t i = 0; i < n; ++i) {
+      if (std::toupper(static_cast<unsigned char>(text[p + i])) != w[i]) return false;
+    }
+    p += n;
+    return true;
+  };
+  blank();
+  if (!word("SELECT") || !blank() || p >= text.size() || text[p] != '*') return text.npos;
+  size_t star = p++;
+  return blank() && word("FROM") && blank() ? star : text.npos;
+}
+
+/*
+ * Columns fetched and read of a query, learned by projector
+ */
+struct projection_report {
+  std::string fingerprint;
+  std::uint64_t executions = 0;
+  std::uint64_t rows = 0;
+  std::uint64_t bytes = 0;            // of all columns fetched
+  std::uint64_t wasted = 0;           // of columns never read
+  std::uint64_t misses = 0;           // reads of columns trimmed by a rewrite, as invalid
+  std::vector<std::string> columns;   // in order of the result
+  std::vector<std::string> read;      // ever accessed through row::operator[]
+  bool rewrite = false;               // SELECT * runs as the columns read (not after a miss)
+};
+
+/*
+ * Projection learning over a connection (or pool, router). Rows of queries
+ * with results record which columns are read, by query fingerprint, and
+ * reports tell the bytes fetched to be thrown away. A query opted in to
+ * rewrite runs SELECT * as the columns read so far, rows keep all columns
+ * at their places and a trimmed one reads as invalid (SQL_INVALID, a miss).
+ * After a miss the query runs whole again until a run has learned all of
+ * its columns. Iterating or materializing a row reads all of it
+ */
+class projector : public connection {
+public:
+  static std::unique_ptr<projector> create(std::unique_ptr<connection> con) {
+    if (!con) return {};
+    return std::unique_ptr<projector>{ new projector(std::move(con)) };
+  }
+
+  // learned queries, the most wasteful first
+  std::vector<projection_report> reports() const {
+    std::vector<projection_report> all;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto const& it : entries_) {
+      projection_report report;
+      report.fingerprint = it.first;
+      auto const& e = *it.second;
+      std::lock_guard<std::mutex> guard(e.mutex);
+      report.executions = e.executions;
+      report.rows = e.rows;
+      report.misses = e.misses;
+      report.rewrite = e.rewrite && !e.stale;
+      for (auto const& col : e.columns) {
+        report.columns.push_back(col.name);
+        report.bytes += col.bytes;
+        if (col.read) report.read.push_back(col.name);
+        else report.wasted += col.bytes;
+      }
+      all.push_back(std::move(report));
+    }
+    std::sort(all.begin(), all.end(), [](projection_report const& a, projection_report const& b) {
+      return a.wasted > b.wasted;
+    });
+    return all;
+  }
+
+  // opt a query in (or out) of SELECT * rewrite, it should have run long
+  // enough to have read every column it needs
+  void rewrite(std::string const& text, bool on = true) {
+    auto e = find(query_fingerprint(text.c_str()));
+    std::lock_guard<std::mutex> guard(e->mutex);
+    e->rewrite = on;
+  }
+
+  // forget everything learned
+  void reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.clear();
+  }
+
+  void vacuum() override { con_->vacuum(); }
+  std::string version() override { return con_->version(); }
+
+  std::unique_ptr<sqlxx::query> query(std::string const& str) override {
+    return std::unique_ptr<sqlxx::query>{ new projected_query(*this, str) };
+  }
+
+  bool session(std::string const& str) override { return con_->session(str); }
+  void reconnect(backoff const& policy) override { con_->reconnect(policy); }
+  bool row_values() const override { return con_->row_values(); }
+  size_t begin() override { return con_->begin(); }
+  bool commit(size_t level) override { return con_->commit(level); }
+  bool rollback(size_t level) override { return con_->rollback(level); }
+  result_type transaction_result() const override { return con_->transaction_result(); }
+
+  std::unique_ptr<bulk_insert> bulk(std::string const& table,
+                                    std::vector<std::string> const& columns) override {
+    return con_->bulk(table, columns);
+  }
+
+private:
+  struct column {
+    std::string name;
+    std::uint64_t bytes;
+    bool read;
+  };
+
+  struct entry {
+    mutable std::mutex mutex;
+    std::vector<column> columns;
+    std::uint64_t executions = 0;
+    std::uint64_t rows = 0;
+    std::uint64_t misses = 0;
+    bool rewrite = false;
+    bool stale = false;   // a trimmed column was read, runs whole until relearned
+  };
+
+  typedef std::shared_ptr<std::vector<std::string> const> names_type;
+
+  /*
+   * One run of a query, merged into its entry when the statement and
+   * the last row of it are gone
+   */
+  struct usage {
+    usage(std::shared_ptr<entry> e) : entry_(std::move(e)) {}
+
+    ~usage() {
+      std::lock_guard<std::mutex> guard(entry_->mutex);
+      ++entry_->executions;
+      entry_->rows += rows;
+      entry_->misses += misses;
+      // a whole run has seen every column read, a trimmed one has missed
+      if (misses) entry_->stale = true;
+      else if (names && fetched.empty()) entry_->stale = false;
+      auto& columns = entry_->columns;
+      for (size_t i = 0; names && i < names->size(); ++i) {
+        auto const& name = (*names)[i];
+        auto it = std::find_if(columns.begin(), columns.end(),
+                               [&name](column const& col) { return col.name == name; });
+        if (it == columns.end()) it = columns.insert(columns.end(), { name, 0, false });
+        it->bytes += bytes[i];
+        it->read = it->read || read[i];
+      }
+    }
+
+    // columns of the rows, on the first one
+    void start(names_type all) {
+      names = std::move(all);
+      bytes.assign(names->size(), 0);
+      read = std::vector<std::atomic<bool>>(names->size());
+    }
+
+    std::shared_ptr<entry> entry_;
+    names_type names;
+    std::vector<size_t> fetched;       // column of fetched row, npos if trimmed, empty if not rewritten
+    std::vector<std::uint64_t> bytes;
+    std::vector<std::atomic<bool>> read;     // rows may be read on other threads
+    std::uint64_t rows = 0;
+    std::atomic<std::uint64_t> misses{0};
+  };
+
+  // bytes of a field on the wire, more or less
+  static std::uint64_t weight(field_type const& f) {
+    switch (f.type()) {
+      case SQL_INTEGER:
+      case SQL_FLOAT: return 8;
+      case SQL_TEXT:
+      case SQL_BLOB: return f.size();
+      default: return 0;
+    }
+  }
+
+  // marks columns read as they are decoded
+  class source : public row_source {
+  public:
+    source(std::shared_ptr<usage> use, row&& fetched)
+      : row_source(use->names), usage_(std::move(use)), fetched_(std::move(fetched)) {
+      fetched_.materialize();
+    }
+
+  protected:
+    field_type decode(size_t idx, std::string const&) override {
+      usage_->read[idx] = true;
+      size_t at = usage_->fetched.empty() ? idx : usage_->fetched[idx];
+      if (at >= fetched_.size()) {
+        ++usage_->misses;
+        return invalid<field_type>();
+      }
+      return std::move(fetched_.std::vector<field_type>::operator[](at));
+    }
+
+  private:
+    std::shared_ptr<usage> usage_;
+    row fetched_;
+  };
+
+  class tracked_statement : public statement {
+  public:
+    tracked_statement(std::shared_ptr<statement> stmt, std::shared_ptr<usage> use)
+      : stmt_(std::move(stmt)), usage_(std::move(use)) {}
+
+    ~tracked_statement() override { stmt_.reset(); }
+
+    row next() override {
+      auto fetched = stmt_->next();
+      if (fetched.empty()) return fetched;
+      auto& use = *usage_;
+      if (!use.names) {
+        auto names = std::make_shared<std::vector<std::string>>();
+        for (size_t i = 0; i < fetched.size(); ++i) names->push_back(fetched[i].name());
+        use.start(std::move(names));
+      }
+      ++use.rows;
+      for (size_t i = 0; i < use.bytes.size(); ++i) {
+        size_t at = use.fetched.empty() ? i : use.fetched[i];
+        if (at < fetched.size()) use.bytes[i] += weight(fetched[at]);
+      }
+      return row(std::make_shared<source>(usage_, std::move(fetched)));
+    }
+
+    void first() override { stmt_->first(); }
+    result_type result() const override { return stmt_->result(); }
+    std::uint64_t last_id() const override { return stmt_->last_id(); }
+    std::uint64_t affected_rows() const override { return stmt_->affected_rows(); }
+
+    // rows are decoded on access already, fetched ones are weighed whole
+
+  private:
+    std::shared_ptr<statement> stmt_;
+    std::shared_ptr<usage> usage_;
+  };
+
+  class projected_query : public sqlxx::query {
+  public:
+    projected_query(projector& p, std::string const& str) : sqlxx::query(str), projector_(p) {}
+
+  private:
+    cursor execute_impl(char const* text, std::vector<field_type> bind) override {
+      auto& con = *projector_.con_;
+      if (!query_has_results(text)) return dispatch(*con.query(), text, std::move(bind));
+      auto use = std::make_shared<usage>(projector_.find(query_fingerprint(text)));
+      std::string trimmed;
+      bool rewritten = trim(*use, text, trimmed);
+      auto cur = dispatch(*con.query(), rewritten ? trimmed.c_str() : text, std::move(bind));
+      return { std::make_shared<tracked_statement>(cur.get(), std::move(use)) };
+    }
+
+    batch_result execute_many_impl(char const* text, bind_source const& next, bool per_set) override {
+      return dispatch_many(*projector_.con_->query(), text, next, per_set);
+    }
+
+    bool prepare_impl(char const* text) override {
+      return dispatch_prepare(*projector_.con_->query(), text);
+    }
+
+    // SELECT * as the columns read, when opted in and learned
+    static bool trim(usage& use, char const* text, std::string& trimmed) {
+      auto const& e = *use.entry_;
+      std::lock_guard<std::mutex> guard(e.mutex);
+      if (!e.rewrite || e.stale) return false;
+      std::string query(text);
+      size_t star = select_star(query);
+      if (star == query.npos) return false;
+      auto names = std::make_shared<std::vector<std::string>>();
+      std::vector<size_t> fetched;
+      std::string list;
+      size_t read = 0;
+      for (auto const& col : e.columns) {
+        // plain identifiers only, nothing to quote
+        auto const& name = col.name;
+        bool plain = !name.empty() && !std::isdigit(static_cast<unsigned char>(name[0]))
+          && std::all_of(name.begin(), name.end(), [](char c) {
+               return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+             });
+        if (!plain || std::count(names->begin(), names->end(), name)) return false;
+        names->push_back(name);
+        fetched.push_back(col.read ? read++ : query.npos);
+        if (!col.read) continue;
+        if (!list.empty()) list += ", ";
+        list += name;
+      }
+      if (!read) return false;
+      trimmed = query.substr(0, star) + list + query.substr(star + 1);
+      use.start(std::move(names));
+      use.fetched = std::move(fetched);
+      return true;
+    }
+
+    projector& projector_;
+  };
+
+  projector(std::unique_ptr<connection> con) : con_(std::move(con)) {}
+
+  projector(projector&&) = delete;
+  projector(projector const&) = delete;
+  projector& operator=(projector&&) = delete;
+  projector& operator=(projector const&) = delete;
+
+  std::shared_ptr<entry> find(std::string const& fingerprint) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& e = entries_[fingerprint];
+    if (!e) e = std::make_shared<entry>();
+    return e;
+  }
+
+  std::unique_ptr<connection> con_;
+  mutable std::mutex mutex_;
+  std::unordered_map<std::string, std::shared_ptr<entry>> entries_;
+};
+
+} // namespace sqlxx
+
+#endif  // _SQLXX_PROJECT_H_
@@ -0,0 +1,140 @@
+///////////////////////////////////////////////////////////////////////////////
+/// \author (c) Anthony Fieroni (bvbfan@abv.bg)
+///             2017, Plovdiv, Bulgaria
+///
+/// \license The MIT License (MIT)
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights
+/// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+/// copies of the Software, and to permit persons to whom the Software is
+/// furnished to do so, subject to the following conditions:
+///
+/// The above copyright notice and this permission notice shall be included in
+/// all copies or substantial portions of the Software.
+///
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+/// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+/// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+/// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+/// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+/// THE SOFTWARE.
+///////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef _SQLXX_QUEUE_H_
+#define _SQLXX_QUEUE_H_
+
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+namespace sqlxx {
+
+/*
+ * Bounded blocking queue between pipeline threads, once closed push
+ * fails and pop drains what is left
+ */
+template<class T>
+class bounded_queue {
+public:
+  explicit bounded_queue(size_t capacity) : capacity_(capacity ? capacity : 1) {}
+
+  bounded_queue(bounded_queue&&) = delete;
+  bounded_queue(bounded_queue const&) = delete;
+  bounded_queue& operator=(bounded_queue&&) = delete;
+  bounded_queue& operator=(bounded_queue const&) = delete;
+
+  // blocks while full, false if closed
+  bool push(T value) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_full_.wait(lock, [this]() { return closed_ || items_.size() < capacity_; });
+    if (closed_) return false;
+    items_.push_back(std::move(value));
+    not_empty_.notify_one();
+    return true;
+  }
+
+  // blocks while empty, false if closed and drained
+  bool pop(T& value) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_empty_.wait(lock, [this]() { return closed_ || !items_.empty(); });
+    if (items_.empty()) return false;
+    value = std::move(items_.front());
+    items_.pop_front();
+    not_full_.notify_one();
+    return true;
+  }
+
+  void close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    not_full_.notify_all();
+    not_empty_.notify_all();
+  }
+
+private:
+  size_t const capacity_;
+  std::deque<T> items_;
+  bool closed_ = false;
+  std::mutex mutex_;
+  std::condition_variable not_full_;
+  std::condition_variable not_empty_;
+};
+
+/*
+ * Unbounded lock-free queue of many producers and one consumer, push is
+ * one exchange, a push in progress hides the later ones from pop until
+ * it's linked, so the order of pushes is kept
+ */
+template<class T>
+class mpsc_queue {
+public:
+  mpsc_queue() : head_(&stub_), tail_(&stub_) {}
+
+  mpsc_queue(mpsc_queue&&) = delete;
+  mpsc_queue(mpsc_queue const&) = delete;
+  mpsc_queue& operator=(mpsc_queue&&) = delete;
+  mpsc_queue& operator=(mpsc_queue const&) = delete;
+
+  ~mpsc_queue() {
+    T value;
+    while (pop(value));
+    if (tail_ != &stub_) delete tail_;
+  }
+
+  // any thread
+  void push(T value) {
+    auto* n = new node;
+    n->value = std::move(value);
+    auto* prev = head_.exchange(n, std::memory_order_acq_rel);
+    prev->next.store(n, std::memory_order_release);
+  }
+
+  // consumer thread only, false if empty
+  bool pop(T& value) {
+    auto* tail = tail_;
+    auto* next = tail->next.load(std::memory_order_acquire);
+    if (!next) return false;
+    value = std::move(next->value);
+    tail_ = next; // becomes the empty head node
+    if (tail != &stub_) delete tail;
+    return true;
+  }
+
+private:
+  struct node {
+    std::atomic<node*> next{nullptr};
+    T value;
+  };
+
+  node stub_;
+  std::atomic<node*> head_; // last pushed
+  node* tail_;              // popped one before the next
+};
+
+} // namespace sqlxx
+
+#endif  // _SQLXX_QUEUE_H_
@@ -0,0 +1,418 @@
+///////////////////////////////////////////////////////////////////////////////
+/// \author (c) Anthony Fieroni (bvbfan@abv.bg)
+///             2017, Plovdiv, Bulgaria
+///
+/// \license The MIT License (MIT)
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights
+/// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+/// copies of the Software, and to permit persons to whom the Software is
+/// furnished to do so, subject to the following conditions:
+///
+/// The above copyright notice and this permission notice shall be included in
+/// all copies or substantial portions of the Software.
+///
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+/// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+/// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+/// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+/// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+/// THE SOFTWARE.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _SQLXX_ROUTER_H_
+#define _SQLXX_ROUTER_H_
+
+#include "sqlxx.h"
+#include "sqlxx_ops.h"
+
+#include <atomic>
+#include <future>
+#include <functional>
+
+namespace sqlxx {
+
+/*
+ * Read/write splitting over a primary and its replicas (connections or pools),
+ * reads go to replicas round robin, everything else goes to the primary
+ */
+class router : public connection {
+public:
+  // current lag of a replica by its index
+  typedef std::function<std::chrono::milliseconds(size_t)> lag_callback;
+
+  static std::unique_ptr<router> create(std::unique_ptr<connection> primary,
+                                        std::vector<std::unique_ptr<connection>> replicas,
+                                        lag_callback lag = {},
+                                        std::chrono::milliseconds max_lag = std::chrono::seconds(1)) {
+    if (!primary) return {};
+    return std::unique_ptr<router>{ new router(std::move(primary), std::move(replicas),
+                                               std::move(lag), max_lag) };
+  }
+
+  /*
+   * Read your writes scope of the current thread, once the scope writes
+   * all its statements go to the primary
+   */
+  class scope {
+  public:
+    scope(router& r) { states().push_back({ &r, false }); }
+    ~scope() { states().pop_back(); }
+
+    scope(scope&&) = delete;
+    scope(scope const&) = delete;
+    scope& operator=(scope&&) = delete;
+    scope& operator=(scope const&) = delete;
+  };
+
+  void vacuum() override { primary_->vacuum(); }
+  std::string version() override { return primary_->version(); }
+
+  std::unique_ptr<sqlxx::query> query(std::string const& str) override {
+    return std::unique_ptr<sqlxx::query>{ new routed_query(*this, str) };
+  }
+
+  bool session(std::string const& str) override {
+    bool applied = primary_->session(str);
+    for (auto const& replica : replicas_) {
+      applied = replica->session(str) && applied;
+    }
+    return applied;
+  }
+
+  void reconnect(backoff const& policy) override {
+    primary_->reconnect(policy);
+    for (auto const& replica : replicas_) replica->reconnect(policy);
+  }
+
+  bool row_values() const override { return primary_->row_values(); }
+
+  // transactions are on the primary, reads of the thread go there while one is open
+  size_t begin() override {
+    size_t level = primary_->begin();
+    if (level) depth(level);
+    return level;
+  }
+
+  bool commit(size_t level) override {
+    if (!primary_->commit(level)) return false;
+    if (level) depth(level - 1);
+    return true;
+  }
+
+  bool rollback(size_t level) override {
+    bool ok = primary_->rollback(level);
+    if (level) depth(level - 1);
+    return ok;
+  }
+
+  result_type transaction_result() const override { return primary_->transaction_result(); }
+
+  std::unique_ptr<bulk_insert> bulk(std::string const& table,
+                                    std::vector<std::string> const& columns) override {
+    if (auto* scope = current()) scope->sticky = true;
+    return primary_->bulk(table, columns);
+  }
+
+private:
+  struct state {
+    router const* owner;
+    bool sticky;         // scope has written
+  };
+
+  // scopes of the current thread
+  static std::vector<state>& states() {
+    static thread_local std::vector<state> states;
+    return states;
+  }
+
+  // open transaction levels of routers on the current thread
+  static std::vector<std::pair<router const*, size_t>>& depths() {
+    static thread_local std::vector<std::pair<router const*, size_t>> depths;
+    return depths;
+  }
+
+  size_t depth() const {
+    for (auto const& d : depths()) {
+      if (d.first == this) return d.second;
+    }
+    return 0;
+  }
+
+  // sets the level of this router, its entry is erased at 0, so a router
+  // created later at the same address does not see a stale level
+  void depth(size_t level) const {
+    auto& all = depths();
+    auto it = std::find_if(all.begin(), all.end(),
+                           [this](std::pair<router const*, size_t> const& d) { return d.first == this; });
+    if (it == all.end() && level) all.emplace_back(this, level);
+    else if (it != all.end() && level) it->second = level;
+    else if (it != all.end()) all.erase(it);
+  }
+
+  // innermost scope of this router on the current thread
+  state* current() const {
+    auto& all = states();
+    for (auto it = all.rbegin(); it != all.rend(); ++it) {
+      if (it->owner == this) return &*it;
+    }
+    return nullptr;
+  }
+
+  class routed_query : public sqlxx::query {
+  public:
+    routed_query(router& r, std::string const& str) : sqlxx::query(str), router_(r) {}
+
+  private:
+    cursor execute_impl(char const* text, std::vector<field_type> bind) override {
+      auto* replica = router_.route(text);
+      if (replica) {
+        auto cur = dispatch(*replica->query(), text, bind);
+        if (cur.result() != SQL_SERVER_LOST) return cur;
+      }
+      return dispatch(*router_.primary_->query(), text, std::move(bind));
+    }
+
+    // bind sets are consumed once, so a lost replica is not retried
+    batch_result execute_many_impl(char const* text, bind_source const& next, bool per_set) override {
+      auto* replica = router_.route(text);
+      auto& con = replica ? *replica : *router_.primary_;
+      return dispatch_many(*con.query(), text, next, per_set);
+    }
+
+    bool prepare_impl(char const* text) override {
+      bool prepared = dispatch_prepare(*router_.primary_->query(), text);
+      if (!query_is_read(text)) return prepared;
+      for (auto const& replica : router_.replicas_) {
+        prepared = dispatch_prepare(*replica->query(), text) && prepared;
+      }
+      return prepared;
+    }
+
+    router& router_;
+  };
+
+  router(std::unique_ptr<connection> primary, std::vector<std::unique_ptr<connection>> replicas,
+         lag_callback lag, std::chrono::milliseconds max_lag)
+    : primary_(std::move(primary)), lag_(std::move(lag)), max_lag_(max_lag) {
+    for (auto& replica : replicas) {
+      if (replica) replicas_.push_back(std::move(replica));
+    }
+  }
+
+  router(router&&) = delete;
+  router(router const&) = delete;
+  router& operator=(router&&) = delete;
+  router& operator=(router const&) = delete;
+
+  // replica for a read, null for the primary
+  connection* route(char const* text) {
+    auto* scope = current();
+    if (!query_is_read(text)) {
+      if (scope) scope->sticky = true;
+      return nullptr;
+    }
+    if ((scope && scope->sticky) || depth() || replicas_.empty()) return nullptr;
+    size_t const count = replicas_.size();
+    size_t const first = next_++;
+    for (size_t i = 0; i < count; ++i) {
+      size_t idx = (first + i) % count;
+      if (!lag_ || lag_(idx) <= max_lag_) return replicas_[idx].get();
+    }
+    return nullptr;
+  }
+
+  std::unique_ptr<connection> primary_;
+  std::vector<std::unique_ptr<connection>> replicas_;
+  lag_callback const lag_;
+  std::chrono::milliseconds const max_lag_;
+  std::atomic<size_t> next_{ 0 };
+};
+
+/*
+ * Sharding over connections or pools by a bind value, reads and DDL without
+ * a shard key are run on all shards concurrently and their rows merged, a
+ * write without the key fails
+ */
+class shard_router : public connection {
+public:
+  // statement runs on all shards (reads and DDL, a keyless
+  // INSERT, UPDATE or DELETE fails with SQL_IMPROPER)
+  static constexpr size_t all = size_t(-1);
+
+  // shard of a statement by its binds
+  typedef std::function<size_t(std::vector<field_type> const&, size_t)> shard_key;
+
+  // hash of the bind at index, all shards if it's not bound
+  static shard_key hash_key(size_t index) {
+    return [index](std::vector<field_type> const& binds, size_t shards) -> size_t {
+      if (index >= binds.size() || binds[index].is_null()) return all;
+      return size_t(field_hash(binds[index]) % shards);
+    };
+  }
+
+  // range of the bind at index, shard i holds keys below bounds[i],
+  // last shard holds the rest
+  static shard_key range_key(size_t index, std::vector<std::int64_t> bounds) {
+    return [index, bounds](std::vector<field_type> const& binds, size_t shards) -> size_t {
+      if (index >= binds.size() || binds[index].type() != SQL_INTEGER) return all;
+      std::int64_t const& key = binds[index];
+      size_t shard = std::upper_bound(bounds.begin(), bounds.end(), key) - bounds.begin();
+      return std::min(shard, shards - 1);
+    };
+  }
+
+  static std::unique_ptr<shard_router> create(std::vector<std::unique_ptr<connection>> shards,
+                                              shard_key key) {
+    for (auto const& shard : shards) {
+      if (!shard) return {};
+    }
+    if (shards.empty() || !key) return {};
+    return std::unique_ptr<shard_router>{ new shard_router(std::move(shards), std::move(key)) };
+  }
+
+  void vacuum() override {
+    for (auto const& shard : shards_) shard->vacuum();
+  }
+
+  std::string version() override { return shards_.front()->version(); }
+
+  std::unique_ptr<sqlxx::query> query(std::string const& str) override {
+    return std::unique_ptr<sqlxx::query>{ new sharded_query(*this, str, {}, false) };
+  }
+
+  // scatter-gather rows are merged in order of a column, every shard
+  // should return its rows sorted by it (i.e. ORDER BY column)
+  std::unique_ptr<sqlxx::query> query(std::string const& str, std::string const& order_by,
+                                      bool descending = false) {
+    return std::unique_ptr<sqlxx::query>{ new sharded_query(*this, str, order_by, descending) };
+  }
+
+  bool session(std::string const& str) override {
+    bool applied = true;
+    for (auto const& shard : shards_) applied = shard->session(str) && applied;
+    return applied;
+  }
+
+  void reconnect(backoff const& policy) override {
+    for (auto const& shard : shards_) shard->reconnect(policy);
+  }
+
+  bool row_values() const override { return shards_.front()->row_values(); }
+
+  // rows are routed by the shard key over their values, a row without the key fails
+  std::unique_ptr<bulk_insert> bulk(std::string const& table,
+                                    std::vector<std::string> const& columns) override {
+    return std::unique_ptr<bulk_insert>{ new sharded_insert(*this, table, columns) };
+  }
+
+  // number of shards
+  size_t size() const { return shards_.size(); }
+
+private:
+  class sharded_query : public sqlxx::query {
+  public:
+    sharded_query(shard_router& r, std::string const& str,
+                  std::string order_by, bool descending)
+      : sqlxx::query(str), router_(r), order_by_(std::move(order_by))
+      , descending_(descending) {}
+
+  private:
+    cursor execute_impl(char const* text, std::vector<field_type> bind) override {
+      auto& shards = router_.shards_;
+      size_t shard = router_.key_(bind, shards.size());
+      if (shard != all) {
+        return dispatch(*shards[shard % shards.size()]->query(), text, std::move(bind));
+      }
+      // a row written on every shard would be duplicated
+      if (row_write(text)) return { std::make_shared<error_statement>(SQL_IMPROPER) };
+      // the calling thread runs the first shard, a single shard starts no thread
+      std::vector<std::future<cursor>> gather;
+      for (size_t i = 1; i < shards.size(); ++i) {
+        auto* c = shards[i].get();
+        gather.push_back(std::async(std::launch::async, [c, text, &bind]() {
+          return dispatch(*c->query(), text, bind);
+        }));
+      }
+      std::vector<std::shared_ptr<statement>> stmts;
+      stmts.push_back(dispatch(*shards.front()->query(), text, bind).get());
+      for (auto& cur : gather) stmts.push_back(cur.get().get());
+      if (order_by_.empty()) {
+        return { std::make_shared<concat_statement>(std::move(stmts)) };
+      }
+      return { std::make_shared<merge_statement>(std::move(stmts), order_by_, descending_) };
+    }
+
+    bool prepare_impl(char const* text) override {
+      bool prepared = true;
+      for (auto const& shard : router_.shards_) {
+        prepared = dispatch_prepare(*shard->query(), text) && prepared;
+      }
+      return prepared;
+    }
+
+    shard_router& router_;
+    std::string const order_by_;
+    bool const descending_;
+  };
+
+  class sharded_insert : public bulk_insert {
+  public:
+    sharded_insert(shard_router& r, std::string const& table, std::vector<std::string> const& columns)
+      : router_(r), table_(table), columns_(columns), loads_(r.shards_.size()) {}
+
+    bool write(std::vector<field_type> const& values) override {
+      size_t shard = router_.key_(values, loads_.size());
+      if (!ok_ || shard == all) return ok_ = false;
+      auto& load = loads_[shard % loads_.size()];
+      if (!load) load = router_.shards_[shard % loads_.size()]->bulk(table_, columns_);
+      ok_ = load && load->write(values);
+      return ok_;
+    }
+
+    // shards commit one by one, a failed shard does not undo the others
+    bool finish() override {
+      for (auto& load : loads_) {
+        if (!load) continue;
+        if (ok_) ok_ = load->finish();
+        else load.reset(); // rolled back
+      }
+      return ok_;
+    }
+
+  private:
+    shard_router& router_;
+    std::string const table_;
+    std::vector<std::string> const columns_;
+    std::vector<std::unique_ptr<bulk_insert>> loads_;
+    bool ok_ = true;
+  };
+
+  // statement writes rows of a table, it needs the key, reads and DDL
+  // (CREATE, ALTER, ...) run on all shards
+  static bool row_write(char const* text) {
+    static char const* const writes[] = { "INSERT", "UPDATE", "DELETE", "REPLACE", "MERGE" };
+    auto keyword = query_keyword(text);
+    for (auto const* write : writes) {
+      if (keyword == write) return true;
+    }
+    return false;
+  }
+
+  shard_router(std::vector<std::unique_ptr<connection>> shards, shard_key key)
+    : shards_(std::move(shards)), key_(std::move(key)) {}
+
+  shard_router(shard_router&&) = delete;
+  shard_router(shard_router const&) = delete;
+  shard_router& operator=(shard_router&&) = delete;
+  shard_router& operator=(shard_router const&) = delete;
+
+  std::vector<std::unique_ptr<connection>> shards_;
+  shard_key const key_;
+};
+
+} // namespace sqlxx
+
+#endif  // _SQLXX_ROUTER_H_
@@ -0,0 +1,459 @@
+///////////////////////////////////////////////////////////////////////////////
+/// \author (c) Anthony Fieroni (bvbfan@abv.bg)
+///             2017, Plovdiv, Bulgaria
+///
+/// \license The MIT License (MIT)
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights
+/// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+/// copies of the Software, and to permit persons to whom the Software is
+/// furnished to do so, subject to the following conditions:
+///
+/// The above copyright notice and this permission notice shall be included in
+/// all copies or substantial portions of the Software.
+///
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+/// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+/// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+/// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+/// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+/// THE SOFTWARE.
+///////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef _SQLXX_SNAPSHOT_H_
+#define _SQLXX_SNAPSHOT_H_
+
+#include "sqlxx.h"
+#include "sqlxx_codec.h"
+
+#include <cstdio>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+namespace sqlxx {
+
+/*
+ * Snapshot file of a result set
+ *
+ *   header  "SQLXXSNP" version columns { name }
+ *   blocks  { rows bytes { row } }
+ *   index   { block offset, first row }
+ *   footer  index offset, blocks, rows, "SQLXXEND"
+ *
+ * integers are varint, footer and index are 64-bit little endian,
+ * rows are encoded by sqlxx::codec
+ */
+namespace snapshot_format {
+
+static constexpr std::uint64_t version = 1;
+static constexpr size_t block_rows = 4096;
+static constexpr size_t magic_size = 8;
+static constexpr size_t footer_size = 3 * 8 + magic_size;
+
+static inline char const* magic() { return "SQLXXSNP"; }
+static inline char const* end_magic() { return "SQLXXEND"; }
+
+static inline
+void put_fixed(std::string& out, std::uint64_t v) {
+  for (int i = 0; i < 8; ++i) out.push_back(char(v >> (8 * i)));
+}
+
+static inline
+std::uint64_t get_fixed(char const* p) {
+  std::uint64_t v = 0;
+  for (int i = 0; i < 8; ++i) v |= std::uint64_t(static_cast<unsigned char>(p[i])) << (8 * i);
+  return v;
+}
+
+} // namespace snapshot_format
+
+/*
+ * Streaming writer of a snapshot file, schema is taken from the first row
+ */
+class snapshot_writer {
+public:
+  snapshot_writer(std::string const& path) : file_(std::fopen(path.c_str(), "wb")) {}
+
+  ~snapshot_writer() { close(); }
+
+  snapshot_writer(snapshot_writer&&) = delete;
+  snapshot_writer(snapshot_writer const&) = delete;
+  snapshot_writer& operator=(snapshot_writer&&) = delete;
+  snapshot_writer& operator=(snapshot_writer const&) = delete;
+
+  bool is_open() const { return !!file_; }
+
+  bool write(row const& r) {
+    if (!file_) return false;
+    if (!header_) header(r);
+    codec::put_row(rows_, r);
+    if (++block_count_ == snapshot_format::block_rows) flush();
+    return good_;
+  }
+
+  // write index and footer, false if any write failed
+  bool close() {
+    if (!file_) return good_;
+    if (!header_) header({});
+    flush();
+    std::string tail;
+    for (auto const& block : index_) {
+      snapshot_format::put_fixed(tail, block.first);
+      snapshot_format::put_fixed(tail, block.second);
+    }
+    snapshot_format::put_fixed(tail, offset_);
+    snapshot_format::put_fixed(tail, index_.size());
+    snapshot_format::put_fixed(tail, rows_count_);
+    tail.append(snapshot_format::end_magic(), snapshot_format::magic_size);
+    put(tail);
+    good_ = !std::fclose(file_) && good_;
+    file_ = nullptr;
+    return good_;
+  }
+
+  // write a whole result set
+  static bool write(std::string const& path, result const& rows) {
+    snapshot_writer writer(path);
+    for (auto const& r : rows) writer.write(r);
+    return writer.close();
+  }
+
+  static bool write(std::string const& path, cursor& cur) {
+    snapshot_writer writer(path);
+    for (auto const& r : cur) writer.write(r);
+    return writer.close();
+  }
+
+private:
+  void header(row const& r) {
+    header_ = true;
+    std::string out(snapshot_format::magic(), snapshot_format::magic_size);
+    codec::put_varint(out, snapshot_format::version);
+    codec::put_varint(out, r.size());
+    for (auto const& f : r) {
+      codec::put_varint(out, f.name().size());
+      out.append(f.name());
+    }
+    put(out);
+  }
+
+  void flush() {
+    if (!block_count_) return;
+    index_.emplace_back(offset_, rows_count_);
+    std::string head;
+    codec::put_varint(head, block_count_);
+    codec::put_varint(head, rows_.size());
+    put(head);
+    put(rows_);
+    rows_count_ += block_count_;
+    block_count_ = 0;
+    rows_.clear();
+  }
+
+  void put(std::string const& data) {
+    good_ = good_ && std::fwrite(data.data(), 1, data.size(), file_) == data.size();
+    offset_ += data.size();
+  }
+
+  std::FILE* file_;
+  bool good_ = true;
+  bool header_ = false;
+  std::string rows_;                  // encoded rows of the pending block
+  size_t block_count_ = 0;            // rows in the pending block
+  std::uint64_t rows_count_ = 0;      // rows in written blocks
+  std::uint64_t offset_ = 0;          // bytes written
+  std::vector<std::pair<std::uint64_t, std::uint64_t>> index_;
+};
+
+/*
+ * Field of a mapped row, text and blob point into the mapping
+ */
+class field_view {
+public:
+  field_view() {}
+  field_view(char const* p, char const* end, std::string const* name)
+    : p_(p), end_(end), name_(name) {}
+
+  sql_type type() const { return p_ ? sql_type(*p_) : SQL_INVALID; }
+  bool is_null() const { return type() == SQL_NULL; }
+  std::string const& name() const { return name_ ? *name_ : invalid<std::string>(); }
+
+  std::int64_t integer() const {
+    if (type() == SQL_FLOAT) return std::int64_t(real());
+    if (type() != SQL_INTEGER) return 0;
+    char const* p = p_ + 1;
+    std::uint64_t v;
+    if (!codec::get_varint(p, end_, v)) return 0;
+    return std::int64_t((v >> 1) ^ (~(v & 1) + 1));
+  }
+
+  double real() const {
+    if (type() == SQL_INTEGER) return double(integer());
+    if (type() != SQL_FLOAT || end_ - p_ < 9) return 0;
+    std::uint64_t bits = snapshot_format::get_fixed(p_ + 1);
+    double d;
+    std::memcpy(&d, &bits, sizeof(d));
+    return d;
+  }
+
+  // bytes of text or blob
+  char const* data() const { return bytes().first; }
+  size_t size() const { return bytes().second; }
+
+  std::string text() const { return { data(), size() }; }
+
+  // decoded copy
+  field_type field() const {
+    field_type f;
+    char const* p = p_;
+    if (p) codec::get_field(p, end_, name(), f);
+    return f;
+  }
+
+private:
+  std::pair<char const*, size_t> bytes() const {
+    if (type() != SQL_TEXT && type() != SQL_BLOB) return { nullptr, 0 };
+    char const* p = p_ + 1;
+    std::uint64_t size;
+    if (!codec::get_varint(p, end_, size) || std::uint64_t(end_ - p) < size) return { nullptr, 0 };
+    return { p, size_t(size) };
+  }
+
+  char const* p_ = nullptr;
+  char const* end_ = nullptr;
+  std::string const* name_ = nullptr;
+};
+
+/*
+ * Row of a mapped snapshot, fields are decoded on access
+ */
+class row_view {
+public:
+  row_view() {}
+  row_view(char const* p, char const* end, std::vector<std::string> const* names)
+    : p_(p), end_(end), names_(names) {}
+
+  size_t size() const {
+    char const* p = p_;
+    std::uint64_t size = 0;
+    if (p) codec::get_varint(p, end_, size);
+    return size;
+  }
+
+  bool empty() const { return !size(); }
+
+  field_view operator[](size_t idx) const {
+    char const* p = p_;
+    std::uint64_t size;
+    if (!p || !codec::get_varint(p, end_, size) || idx >= size) return {};
+    for (size_t i = 0; i < idx; ++i) {
+      if (!codec::skip_field(p, end_)) return {};
+    }
+    return { p, end_, names_ && idx < names_->size() ? &(*names_)[idx] : nullptr };
+  }
+
+  field_view operator[](char const* colname) const {
+    for (size_t i = 0; colname && names_ && i < names_->size(); ++i) {
+      if ((*names_)[i] == colname) return operator[](i);
+    }
+    return {};
+  }
+
+  // decoded copy
+  row to_row() const {
+    row r;
+    char const* p = p_;
+    if (p) codec::get_row(p, end_, names_ ? *names_ : invalid<std::vector<std::string>>(), r);
+    return r;
+  }
+
+  // encoded bytes
+  char const* data() const { return p_; }
+
+private:
+  char const* p_ = nullptr;
+  char const* end_ = nullptr;
+  std::vector<std::string> const* names_ = nullptr;
+};
+
+/*
+ * Memory mapped snapshot file, opening is validation of header and footer
+ * only, rows are read in place
+ */
+class snapshot {
+public:
+  static std::unique_ptr<snapshot> open(std::string const& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return {};
+    struct stat st;
+    mapping map;
+    if (!::fstat(fd, &st)) map.map(fd, size_t(st.st_size));
+    ::close(fd);
+    std::unique_ptr<snapshot> snap{ new snapshot(std::move(map)) };
+    if (!snap->parse()) return {};
+    return snap;
+  }
+
+  size_t size() const { return size_t(rows_); }
+  bool empty() const { return !rows_; }
+  std::vector<std::string> const& names() const { return names_; }
+
+  // row by index, empty view if out of range
+  row_view operator[](size_t idx) const {
+    if (idx >= rows_) return {};
+    size_t lo = 0, hi = blocks_;
+    while (hi - lo > 1) {
+      size_t mid = (lo + hi) / 2;
+      if (block_first(mid) <= idx) lo = mid;
+      else hi = mid;
+    }
+    char const* p = map_.data() + block_offset(lo);
+    char const* end = map_.data() + index_;
+    std::uint64_t count, bytes;
+    codec::get_varint(p, end, count);
+    codec::get_varint(p, end, bytes);
+    end = p + bytes;
+    for (auto skip = idx - block_first(lo); skip; --skip) codec::skip_row(p, end);
+    return { p, end, &names_ };
+  }
+
+  class const_iterator {
+  public:
+    using value_type = row_view;
+    using pointer = value_type const*;
+    using reference = value_type const&;
+    using difference_type = std::ptrdiff_t;
+    using iterator_category = std::forward_iterator_tag;
+
+    const_iterator(snapshot const& snap, char const* p) : snap_(&snap), p_(p) { load(); }
+
+    reference operator*() const { return view_; }
+    pointer operator->() const { return &view_; }
+
+    const_iterator& operator++() {
+      char const* p = p_;
+      codec::skip_row(p, block_end_);
+      p_ = p;
+      load();
+      return *this;
+    }
+
+    const_iterator operator++(int) {
+      auto it = *this;
+      operator++();
+      return it;
+    }
+
+    bool operator==(const_iterator const& it) const { return p_ == it.p_; }
+    bool operator!=(const_iterator const& it) const { return p_ != it.p_; }
+
+  private:
+    // skip block headers
+    void load() {
+      char const* end = snap_->data_end();
+      if (p_ == block_end_) block_end_ = nullptr;
+      while (!block_end_ && p_ < end) {
+        std::uint64_t count, bytes;
+        if (!codec::get_varint(p_, end, count) || !codec::get_varint(p_, end, bytes)
+            || std::uint64_t(end - p_) < bytes) {
+          p_ = end;
+          break;
+        }
+        block_end_ = p_ + bytes;
+        if (!count) { p_ = block_end_; block_end_ = nullptr; }
+      }
+      view_ = { p_, block_end_ ? block_end_ : end, &snap_->names_ };
+    }
+
+    snapshot const* snap_;
+    char const* p_;
+    char const* block_end_ = nullptr;
+    row_view view_;
+  };
+
+  const_iterator begin() const { return { *this, data_begin_ }; }
+  const_iterator end() const { return { *this, data_end() }; }
+
+  // decoded copy of all rows
+  result load() const {
+    result rows;
+    rows.reserve(size());
+    for (auto const& view : *this) rows.push_back(view.to_row());
+    return rows;
+  }
+
+private:
+  snapshot(mapping map) : map_(std::move(map)) {}
+
+  snapshot(snapshot&&) = delete;
+  snapshot(snapshot const&) = delete;
+  snapshot& operator=(snapshot&&) = delete;
+  snapshot& operator=(snapshot const&) = delete;
+
+  bool parse() {
+    using namespace snapshot_format;
+    char const* begin = map_.data();
+    size_t const size = map_.size();
+    if (!begin || size < magic_size + footer_size) return false;
+    if (std::memcmp(begin, magic(), magic_size)) return false;
+    char const* footer = begin + size - footer_size;
+    if (std::memcmp(footer + 3 * 8, end_magic(), magic_size)) return false;
+    index_ = get_fixed(footer);
+    blocks_ = get_fixed(footer + 8);
+    rows_ = get_fixed(footer + 16);
+    if (index_ > size - footer_size || (size - footer_size - index_) / 16 != blocks_) return false;
+    char const* p = begin + magic_size;
+    char const* end = begin + index_;
+    std::uint64_t ver, columns;
+    if (!codec::get_varint(p, end, ver) || ver != version) return false;
+    if (!codec::get_varint(p, end, columns)) return false;
+    for (std::uint64_t i = 0; i < columns; ++i) {
+      std::uint64_t len;
+      if (!codec::get_varint(p, end, len) || std::uint64_t(end - p) < len) return false;
+      names_.emplace_back(p, len);
+      p += len;
+    }
+    data_begin_ = p;
+    if (rows_ && !blocks_) return false;
+    for (size_t i = 0; i < blocks_; ++i) {
+      auto offset = block_offset(i);
+      if (offset < std::uint64_t(data_begin_ - begin) || offset >= index_ || block_first(i) >= rows_
+          || (i ? block_first(i) < block_first(i - 1) : block_first(i) != 0)) {
+        return false;
+      }
+      // block header, its rows end before the index
+      char const* b = begin + offset;
+      std::uint64_t count, bytes;
+      if (!codec::get_varint(b, end, count) || !codec::get_varint(b, end, bytes)
+          || std::uint64_t(end - b) < bytes) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  std::uint64_t block_offset(size_t i) const {
+    return snapshot_format::get_fixed(map_.data() + index_ + i * 16);
+  }
+
+  std::uint64_t block_first(size_t i) const {
+    return snapshot_format::get_fixed(map_.data() + index_ + i * 16 + 8);
+  }
+
+  char const* data_end() const { return map_.data() + index_; }
+
+  mapping map_;
+  std::vector<std::string> names_;
+  char const* data_begin_ = nullptr;
+  std::uint64_t index_ = 0;   // index offset
+  std::uint64_t blocks_ = 0;
+  std::uint64_t rows_ = 0;
+};
+
+} // namespace sqlxx
+
+#endif  // _SQLXX_SNAPSHOT_H_
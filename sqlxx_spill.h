@@ -0,0 +1,184 @@
+///////////////////////////////////////////////////////////////////////////////
+/// \author (c) Anthony Fieroni (bvbfan@abv.bg)
+///             2017, Plovdiv, Bulgaria
+///
+/// \license The MIT License (MIT)
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights
+/// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+/// copies of the Software, and to permit persons to whom the Software is
+/// furnished to do so, subject to the following conditions:
+///
+/// The above copyright notice and this permission notice shall be included in
+/// all copies or substantial portions of the Software.
+///
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+/// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+/// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+/// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+/// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+/// THE SOFTWARE.
+///////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef _SQLXX_SPILL_H_
+#define _SQLXX_SPILL_H_
+
+#include "sqlxx.h"
+#include "sqlxx_codec.h"
+
+#include <cstdio>
+
+namespace sqlxx {
+
+/*
+ * Result set which keeps rows in memory up to a budget, next rows are
+ * encoded in blocks to a temporary file and read back through mmap
+ */
+class spilling_result {
+public:
+  static constexpr size_t block_size = 1 << 20;
+
+  explicit spilling_result(size_t budget = 64 << 20) : budget_(budget) {}
+
+  // collect all rows of a cursor
+  spilling_result(cursor& cur, size_t budget = 64 << 20) : budget_(budget) {
+    for (auto const& r : cur) append(r);
+  }
+
+  ~spilling_result() {
+    if (file_) std::fclose(file_);
+  }
+
+  spilling_result(spilling_result&&) = delete;
+  spilling_result(spilling_result const&) = delete;
+  spilling_result& operator=(spilling_result&&) = delete;
+  spilling_result& operator=(spilling_result const&) = delete;
+
+  void append(row const& r) {
+    if (offsets_.empty() && memory_ + footprint(r) <= budget_) {
+      memory_ += footprint(r);
+      rows_.push_back(r);
+      return;
+    }
+    if (offsets_.empty()) names_ = codec::names(r);
+    offsets_.push_back(written_ + block_.size());
+    codec::put_row(block_, r);
+    if (block_.size() >= block_size) flush();
+  }
+
+  spilling_result& operator+=(row const& r) {
+    append(r);
+    return *this;
+  }
+
+  size_t size() const { return rows_.size() + offsets_.size(); }
+  bool empty() const { return !size(); }
+
+  // rows went to the temporary file
+  bool spilled() const { return !offsets_.empty(); }
+
+  // false if the temporary file failed, spilled rows are lost
+  bool good() const { return good_; }
+
+  // row by index, empty row if out of range
+  row operator[](size_t idx) const {
+    if (idx < rows_.size()) return rows_[idx];
+    idx -= rows_.size();
+    if (idx >= offsets_.size()) return {};
+    std::uint64_t offset = offsets_[idx];
+    char const* p;
+    char const* end;
+    if (offset >= written_) {
+      p = block_.data() + (offset - written_);
+      end = block_.data() + block_.size();
+    } else {
+      if (map_.size() < written_) map_.map(file_ ? ::fileno(file_) : -1, written_);
+      if (!map_.data()) return {};
+      p = map_.data() + offset;
+      end = map_.data() + map_.size();
+    }
+    row r;
+    codec::get_row(p, end, names_, r);
+    return r;
+  }
+
+  class const_iterator {
+  public:
+    using value_type = row;
+    using pointer = value_type const*;
+    using reference = value_type const&;
+    using difference_type = std::ptrdiff_t;
+    using iterator_category = std::forward_iterator_tag;
+
+    const_iterator(spilling_result const& result, size_t idx) : result_(&result), idx_(idx) {}
+
+    reference operator*() const { load(); return row_; }
+    pointer operator->() const { load(); return &row_; }
+    const_iterator& operator++() { ++idx_; loaded_ = false; return *this; }
+
+    const_iterator operator++(int) {
+      auto it = *this;
+      operator++();
+      return it;
+    }
+
+    bool operator==(const_iterator const& it) const { return idx_ == it.idx_; }
+    bool operator!=(const_iterator const& it) const { return idx_ != it.idx_; }
+
+  private:
+    void load() const {
+      if (loaded_) return;
+      row_ = (*result_)[idx_];
+      loaded_ = true;
+    }
+
+    spilling_result const* result_;
+    size_t idx_;
+    mutable row row_;
+    mutable bool loaded_ = false;
+  };
+
+  const_iterator begin() const { return { *this, 0 }; }
+  const_iterator end() const { return { *this, size() }; }
+
+private:
+  // approximate heap usage of a row
+  static size_t footprint(row const& r) {
+    size_t size = sizeof(row) + r.size() * sizeof(field_type);
+    for (auto const& f : r) {
+      size += f.name().size();
+      if (f.type() == SQL_TEXT || f.type() == SQL_BLOB) {
+        size += f.size();
+      }
+    }
+    return size;
+  }
+
+  // write pending block to the temporary file
+  void flush() {
+    if (block_.empty()) return;
+    if (!file_ && good_) file_ = std::tmpfile();
+    good_ = good_ && file_ && std::fwrite(block_.data(), 1, block_.size(), file_) == block_.size()
+         && !std::fflush(file_);
+    written_ += block_.size();
+    block_.clear();
+  }
+
+  size_t const budget_;
+  size_t memory_ = 0;                   // in memory rows footprint
+  result rows_;                         // in memory rows
+  std::vector<std::string> names_;      // column names of spilled rows
+  std::vector<std::uint64_t> offsets_;  // spilled rows offsets
+  std::string block_;                   // pending block
+  std::uint64_t written_ = 0;           // bytes in the temporary file
+  std::FILE* file_ = nullptr;
+  bool good_ = true;
+  mutable mapping map_;
+};
+
+} // namespace sqlxx
+
+#endif  // _SQLXX_SPILL_H_
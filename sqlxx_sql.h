@@ -0,0 +1,131 @@
+///////////////////////////////////////////////////////////////////////////////
+/// \author (c) Anthony Fieroni (bvbfan@abv.bg)
+///             2017, Plovdiv, Bulgaria
+///
+/// \license The MIT License (MIT)
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights
+/// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+/// copies of the Software, and to permit persons to whom the Software is
+/// furnished to do so, subject to the following conditions:
+///
+/// The above copyright notice and this permission notice shall be included in
+/// all copies or substantial portions of the Software.
+///
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+/// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+/// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+/// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+/// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+/// THE SOFTWARE.
+///////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef _SQLXX_SQL_H_
+#define _SQLXX_SQL_H_
+
+#include "sqlxx.h"
+
+#include <type_traits>
+
+namespace sqlxx {
+
+/*
+ * Compile time parsing of SQL literals, halves are counted separately so
+ * recursion depth is log of the length, not the length
+ */
+
+// single quotes in s[b, e)
+constexpr size_t sql_quotes(char const* s, size_t b, size_t e) {
+  return e - b == 0 ? 0
+       : e - b == 1 ? (s[b] == '\'' ? 1 : 0)
+       : sql_quotes(s, b, b + (e - b) / 2) + sql_quotes(s, b + (e - b) / 2, e);
+}
+
+// placeholders in s[b, e) outside of string literals
+constexpr size_t sql_binds(char const* s, size_t b, size_t e, bool quoted = false) {
+  return e - b == 0 ? 0
+       : e - b == 1 ? (!quoted && s[b] == '?' ? 1 : 0)
+       : sql_binds(s, b, b + (e - b) / 2, quoted)
+       + sql_binds(s, b + (e - b) / 2, e, quoted != (sql_quotes(s, b, b + (e - b) / 2) % 2 == 1));
+}
+
+/*
+ * SQL literal with N placeholders, sent as is: backends that take $1, $2,
+ * ... number it once when they prepare it, the prepared statement is cached
+ * by this text like any other query
+ */
+template<size_t N>
+class sql_text {
+public:
+  static constexpr size_t binds = N;
+
+  explicit constexpr sql_text(char const* text) : text_(text) {}
+
+  constexpr char const* text() const { return text_; }
+
+private:
+  char const* const text_;
+};
+
+template<class T>
+struct is_bind_type : std::integral_constant<bool,
+     (std::is_arithmetic<T>::value && !std::is_same<T, bool>::value)
+  || std::is_same<T, std::string>::value
+  || std::is_same<T, blob>::value
+  || std::is_same<T, field_type>::value
+  || std::is_same<T, char const*>::value
+  || std::is_same<T, char*>::value> {};
+
+template<class... Args>
+struct are_bind_types : std::true_type {};
+
+template<class T, class... Args>
+struct are_bind_types<T, Args...> : std::integral_constant<bool,
+     is_bind_type<typename std::decay<T>::type>::value && are_bind_types<Args...>::value> {};
+
+template<class T> inline
+typename std::enable_if<std::is_integral<T>::value, field_type>::type bind_field(T v) {
+  return { std::int64_t(v), {} };
+}
+
+template<class T> inline
+typename std::enable_if<std::is_floating_point<T>::value, field_type>::type bind_field(T v) {
+  return { double(v), {} };
+}
+
+static inline field_type bind_field(std::string const& s) { return { s, {} }; }
+static inline field_type bind_field(std::string&& s) { return { std::move(s), {} }; }
+static inline field_type bind_field(char const* s) { return { std::string(s), {} }; }
+static inline field_type bind_field(blob const& b) { return field_type(b, {}); }
+static inline field_type bind_field(blob&& b) { return field_type(std::move(b), {}); }
+static inline field_type bind_field(field_type const& f) { return f; }
+
+/*
+ * Run a SQL literal, number and types of binds are checked at compile time,
+ * the text is trusted and not escaped
+ */
+template<size_t N, class... Args>
+cursor execute(connection& con, sql_text<N> const& sql, Args&&... args) {
+  static_assert(sizeof...(Args) == N, "number of binds doesn't match placeholders of the query");
+  static_assert(are_bind_types<Args...>::value, "unsupported bind type");
+  std::vector<field_type> binds;
+  binds.reserve(N);
+  using expand = int[];
+  (void)expand{ 0, (binds.push_back(bind_field(std::forward<Args>(args))), 0)... };
+  auto q = con.query();
+  return query::dispatch(*q, sql.text(), std::move(binds));
+}
+
+} // namespace sqlxx
+
+// SQLXX_SQL("SELECT * FROM t WHERE id = ?"), placeholders counted at compile time
+#define SQLXX_SQL(text)                                                                   \
+  ([]() -> ::sqlxx::sql_text<::sqlxx::sql_binds("" text, 0, sizeof(text) - 1)> const& {   \
+    static ::sqlxx::sql_text<::sqlxx::sql_binds("" text, 0, sizeof(text) - 1)> const sql(text); \
+    return sql;                                                                           \
+  }())
+
+#endif  // _SQLXX_SQL_H_
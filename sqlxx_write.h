@@ -0,0 +1,247 @@
+///////////////////////////////////////////////////////////////////////////////
+/// \author (c) Anthony Fieroni (bvbfan@abv.bg)
+///             2017, Plovdiv, Bulgaria
+///
+/// \license The MIT License (MIT)
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights
+/// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+/// copies of the Software, and to permit persons to whom the Software is
+/// furnished to do so, subject to the following conditions:
+///
+/// The above copyright notice and this permission notice shall be included in
+/// all copies or substantial portions of the Software.
+///
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+/// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+/// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+/// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+/// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+/// THE SOFTWARE.
+///////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef _SQLXX_WRITE_H_
+#define _SQLXX_WRITE_H_
+
+#include "sqlxx.h"
+#include "sqlxx_sql.h"
+#include "sqlxx_queue.h"
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+
+namespace sqlxx {
+
+struct write_options {
+  size_t max_batch = 1024;                 // writes per group commit
+  std::chrono::milliseconds max_delay{5};  // the longest a write waits
+};
+
+struct write_stats {
+  std::uint64_t writes = 0;    // committed or failed
+  std::uint64_t failed = 0;
+  std::uint64_t commits = 0;   // one per statement text of a batch, more if it was split
+  std::uint64_t batches = 0;
+};
+
+/*
+ * Write-behind buffer, writes of many threads are queued without a lock
+ * and a flusher thread runs them grouped by statement text, one
+ * execute_many (one transaction) per text, when max_batch writes are
+ * pending or max_delay passed. Order is kept per statement text only.
+ * A failed group is split in halves until the failing writes are found,
+ * the others are committed. Statement texts are trusted, they are sent
+ * as written and not escaped. The connection is used by the flusher,
+ * define USE_SHARED_CONNECTION to use it elsewhere too.
+ */
+class write_buffer {
+public:
+  explicit write_buffer(connection& con, write_options options = {})
+    : con_(con), options_(options) {
+    options_.max_batch || (options_.max_batch = 1);
+    flusher_ = std::thread([this]() { run(); });
+  }
+
+  write_buffer(write_buffer&&) = delete;
+  write_buffer(write_buffer const&) = delete;
+  write_buffer& operator=(write_buffer&&) = delete;
+  write_buffer& operator=(write_buffer const&) = delete;
+
+  // everything queued is written before return
+  ~write_buffer() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    wake_.notify_one();
+    flusher_.join();
+  }
+
+  // fire and forget
+  template<class... Args>
+  void write(std::string text, Args&&... args) {
+    push(std::move(text), binds(std::forward<Args>(args)...), nullptr);
+  }
+
+  // the future is ready once the write is committed or failed
+  template<class... Args>
+  std::future<result_type> write_acked(std::string text, Args&&... args) {
+    return write_set_acked(std::move(text), binds(std::forward<Args>(args)...));
+  }
+
+  // binds built already (i.e. routed by them)
+  void write_set(std::string text, std::vector<field_type> binds) {
+    push(std::move(text), std::move(binds), nullptr);
+  }
+
+  std::future<result_type> write_set_acked(std::string text, std::vector<field_type> binds) {
+    std::unique_ptr<std::promise<result_type>> ack(new std::promise<result_type>);
+    auto future = ack->get_future();
+    push(std::move(text), std::move(binds), std::move(ack));
+    return future;
+  }
+
+  // waits until writes queued before are committed
+  void flush() {
+    urgent_ = true;
+    write_acked({}).wait();
+  }
+
+  write_stats stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+  }
+
+private:
+  struct entry {
+    std::string text;  // empty for a flush marker
+    std::vector<field_type> binds;
+    std::unique_ptr<std::promise<result_type>> ack;
+  };
+
+  struct group {
+    std::vector<std::vector<field_type>> sets;
+    std::vector<std::unique_ptr<std::promise<result_type>>> acks;
+  };
+
+  template<class... Args>
+  static std::vector<field_type> binds(Args&&... args) {
+    std::vector<field_type> binds;
+    binds.reserve(sizeof...(Args));
+    using expand = int[];
+    (void)expand{ 0, (binds.push_back(bind_field(std::forward<Args>(args))), 0)... };
+    return binds;
+  }
+
+  void push(std::string text, std::vector<field_type> binds,
+            std::unique_ptr<std::promise<result_type>> ack) {
+    // counted first so the flusher never takes more than was counted,
+    // a lost wakeup costs at most max_delay
+    bool full = ++pending_ == options_.max_batch;
+    queue_.push({ std::move(text), std::move(binds), std::move(ack) });
+    if (full || urgent_) wake_.notify_one();
+  }
+
+  void run() {
+    for (bool stop = false; !stop;) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        wake_.wait_for(lock, options_.max_delay, [this]() {
+          return stop_ || urgent_ || pending_ >= options_.max_batch;
+        });
+        stop = stop_;
+      }
+      urgent_ = false;
+      while (batch());
+    }
+  }
+
+  // one group commit, false when nothing was queued
+  bool batch() {
+    std::vector<std::string> order;
+    std::unordered_map<std::string, group> groups;
+    std::vector<std::unique_ptr<std::promise<result_type>>> markers;
+    entry e;
+    size_t count = 0;
+    while (count < options_.max_batch && queue_.pop(e)) {
+      ++count;
+      if (e.text.empty()) {
+        markers.push_back(std::move(e.ack));
+        continue;
+      }
+      auto it = groups.find(e.text);
+      if (it == groups.end()) {
+        order.push_back(e.text);
+        it = groups.emplace(std::move(e.text), group()).first;
+      }
+      it->second.sets.push_back(std::move(e.binds));
+      it->second.acks.push_back(std::move(e.ack));
+    }
+    if (!count) return false;
+    pending_ -= count;
+    write_stats done;
+    done.batches = 1;
+    for (auto const& text : order) {
+      commit(text, groups[text], 0, groups[text].sets.size(), done);
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stats_.writes += done.writes;
+      stats_.failed += done.failed;
+      stats_.commits += done.commits;
+      stats_.batches += done.batches;
+    }
+    for (auto& marker : markers) {
+      if (marker) marker->set_value(SQL_OK);
+    }
+    return true;
+  }
+
+  // sets [first, last) of a group in one transaction, a failed set rolls
+  // back all of them, so they are run again in halves (a lost connection
+  // fails them all)
+  void commit(std::string const& text, group& g, size_t first, size_t last, write_stats& done) {
+    size_t i = first;
+    query::bind_source next = [&g, &i, last](std::vector<field_type>& binds) -> bool {
+      if (i == last) return false;
+      binds = g.sets[i++];   // kept to run again
+      return true;
+    };
+    auto q = con_.query();
+    auto result = query::dispatch_many(*q, text.c_str(), next, false).result;
+    if (result != SQL_OK && result != SQL_SERVER_LOST && last - first > 1) {
+      size_t middle = first + (last - first) / 2;
+      commit(text, g, first, middle, done);
+      commit(text, g, middle, last, done);
+      return;
+    }
+    done.commits += result == SQL_OK;
+    done.writes += last - first;
+    done.failed += result == SQL_OK ? 0 : last - first;
+    for (size_t j = first; j < last; ++j) {
+      if (g.acks[j]) g.acks[j]->set_value(result);
+    }
+  }
+
+  connection& con_;
+  write_options options_;
+  mpsc_queue<entry> queue_;
+  std::atomic<size_t> pending_{0};
+  std::atomic<bool> urgent_{false};
+  bool stop_ = false;
+  write_stats stats_;
+  mutable std::mutex mutex_;
+  std::condition_variable wake_;
+  std::thread flusher_;
+};
+
+} // namespace sqlxx
+
+#endif  // _SQLXX_WRITE_H_
@@ -3,11 +3,657 @@
 #include "mysqlxx.h"
 #include "pqsqlxx.h"
 #include "sqlitexx.h"
+#include "sqlitexx_shard.h"
+#include "sqlxx_pool.h"
+#include "sqlxx_router.h"
+#include "sqlxx_ops.h"
+#include "sqlxx_spill.h"
+#include "sqlxx_snapshot.h"
+#include "sqlxx_export.h"
+#include "sqlxx_import.h"
+#include "sqlxx_copy.h"
+#include "sqlxx_sql.h"
+#include "sqlxx_write.h"
+#include "sqlxx_page.h"
+#include "sqlxx_project.h"
 
 #include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <future>
 #include <iostream>
+#include <sstream>
 #include <thread>
 
+static int failures = 0;
+
+void check(bool ok, char const* what) {
+    std::cout << (ok ? "ok " : "FAILED ") << what << std::endl;
+    if (!ok) ++failures;
+}
+
+std::int64_t count(sqlxx::connection& con, std::string const& table) {
+    for (auto& row : con.query("SELECT count(*) FROM " + table + ";")->execute()) {
+        return row[size_t(0)];
+    }
+    return -1;
+}
+
+// tables of the checks are created again on every run
+void create(sqlxx::connection& con, std::string const& table, std::string const& columns) {
+    con.query("DROP TABLE IF EXISTS " + table + ";")->execute();
+    con.query("CREATE TABLE " + table + "(" + columns + ");")->execute();
+}
+
+void insert(sqlxx::connection& con, std::string const& table, std::int64_t id, std::string const& name) {
+    auto q = con.query("INSERT INTO " + table + " (id, name) VALUES (?, ?);");
+    (*q) << values(id, name);
+    q->execute();
+}
+
+// 100 rows, id is the row modulo 10 and name tells if it is odd
+void fill_ops(sqlxx::connection& con) {
+    create(con, "test_ops", "id INTEGER, name TEXT, score FLOAT");
+    for (std::int64_t i = 0; i < 100; ++i) {
+        auto q = con.query("INSERT INTO test_ops (id, name, score) VALUES (?, ?, ?);");
+        (*q) << values(i % 10, std::string(i % 2 ? "odd" : "even"), 0.5);
+        q->execute();
+    }
+}
+
+// ids 0-4 named n0-n4
+void fill_names(sqlxx::connection& con) {
+    create(con, "test_names", "id INTEGER, name TEXT");
+    for (std::int64_t i = 0; i < 5; ++i) insert(con, "test_names", i, "n" + std::to_string(i));
+}
+
+void test_pool(sqlxx::connection& con, sqlxx::pool::factory open) {
+    create(con, "test_pool", "id INTEGER, name TEXT");
+    auto p = sqlxx::pool::create(4, open, { "SELECT count(*) FROM test_pool;" });
+    check(p->ready().get() == 4 && p->size() == 4, "pool opens all connections");
+    std::vector<std::shared_ptr<sqlxx::connection>> leases;
+    for (size_t i = 0; i < 4; ++i) leases.push_back(p->acquire());
+    auto waiting = std::async(std::launch::async, [&p]() { return p->acquire(); });
+    check(waiting.wait_for(std::chrono::milliseconds(50)) == std::future_status::timeout,
+          "pool blocks without an idle connection");
+    auto* returned = leases.back().get();
+    leases.pop_back();
+    check(waiting.get().get() == returned, "lease returns to the pool");
+    leases.clear();
+    check(p->prepare("SELECT count(*) FROM test_pool;"), "pool prepares on idle connections");
+    for (std::int64_t i = 0; i < 10; ++i) insert(*p, "test_pool", i, "pool");
+    check(count(*p, "test_pool") == 10 && count(con, "test_pool") == 10, "pool runs queries on leases");
+}
+
+// a killed session is reconnected, only reads out of a transaction are run again
+void test_reconnect(sqlxx::connection& con, sqlxx::pool::factory open, std::string const& type) {
+    auto killer = open();
+    auto kill = [&]() {
+        std::int64_t id = 0;
+        auto q = con.query(type == "PQSQL" ? "SELECT pg_backend_pid();" : "SELECT CONNECTION_ID();");
+        for (auto& row : q->execute()) id = row[size_t(0)];
+        killer->query((type == "PQSQL" ? "SELECT pg_terminate_backend(" + std::to_string(id) + ");"
+                                       : "KILL " + std::to_string(id) + ";"))->execute();
+    };
+    create(con, "test_lost", "id INTEGER, name TEXT");
+    insert(con, "test_lost", 1, "a");
+    kill();
+    auto cur = con.query("SELECT id FROM test_lost;")->execute();
+    check(cur.result() == SQL_OK && cur.begin() != cur.end(), "read is run again after reconnect");
+    {
+        sqlxx::transaction tr(con);
+        insert(con, "test_lost", 2, "b");
+        kill();
+        auto lost = con.query("SELECT id FROM test_lost;")->execute();
+        check(lost.result() == SQL_SERVER_LOST, "read of a lost transaction is not run again");
+        check(!tr.commit(), "lost transaction does not commit");
+    }
+    check(count(con, "test_lost") == 1, "connection works after reconnect");
+}
+
+// name of the first row of test_route
+std::string route_name(sqlxx::connection& con) {
+    for (auto& row : con.query("SELECT name FROM test_route;")->execute()) return row["name"].toString();
+    return {};
+}
+
+// SQLite file with one row in test_route named after it
+std::unique_ptr<sqlxx::connection> open_route(std::string const& path) {
+    std::remove(path.c_str());
+    auto con = sqlitexx::connection::create(path);
+    create(*con, "test_route", "id INTEGER, name TEXT");
+    insert(*con, "test_route", 1, path);
+    return con;
+}
+
+void test_router() {
+    std::vector<std::unique_ptr<sqlxx::connection>> replicas;
+    replicas.push_back(open_route("test_replica.db"));
+    auto primary = open_route("test_primary.db");
+    auto r = sqlxx::router::create(std::move(primary), std::move(replicas));
+    check(route_name(*r) == "test_replica.db", "router reads from a replica");
+    insert(*r, "test_route", 2, "written");
+    auto q = r->query("SELECT count(*) FROM test_route WHERE name = ?;");
+    (*q) << std::string("written");
+    std::int64_t written = -1;
+    for (auto& row : q->execute()) written = row[size_t(0)];
+    check(written == 0, "router writes to the primary");
+    {
+        sqlxx::router::scope scope(*r);
+        check(route_name(*r) == "test_replica.db", "scope reads from a replica before it writes");
+        insert(*r, "test_route", 3, "scoped");
+        check(route_name(*r) == "test_primary.db", "scope reads from the primary after it writes");
+    }
+    check(route_name(*r) == "test_replica.db", "reads go to replicas after the scope");
+    {
+        sqlxx::transaction tr(*r);
+        check(route_name(*r) == "test_primary.db", "reads of a transaction go to the primary");
+    }
+
+    // a pool that opened nothing is a lost replica
+    replicas.clear();
+    replicas.push_back(sqlxx::pool::create(1, []() { return std::unique_ptr<sqlxx::connection>(); }));
+    r = sqlxx::router::create(open_route("test_primary.db"), std::move(replicas));
+    check(route_name(*r) == "test_primary.db", "lost replica falls back to the primary");
+
+    replicas.clear();
+    replicas.push_back(open_route("test_replica.db"));
+    replicas.push_back(open_route("test_replica2.db"));
+    r = sqlxx::router::create(open_route("test_primary.db"), std::move(replicas), [](size_t idx) {
+        return std::chrono::milliseconds(idx ? 0 : 5000);
+    });
+    check(route_name(*r) == "test_replica2.db" && route_name(*r) == "test_replica2.db",
+          "lagging replica is skipped");
+    r.reset();
+    for (auto path : { "test_primary.db", "test_replica.db", "test_replica2.db" }) std::remove(path);
+}
+
+void test_shard_router() {
+    auto open = []() {
+        std::vector<std::unique_ptr<sqlxx::connection>> shards;
+        for (auto path : { "test_shard0.db", "test_shard1.db" }) {
+            std::remove(path);
+            shards.push_back(sqlitexx::connection::create(path));
+        }
+        return shards;
+    };
+    auto shard_count = [](char const* path) {
+        return count(*sqlitexx::connection::create(path), "test_shard");
+    };
+    auto r = sqlxx::shard_router::create(open(), sqlxx::shard_router::range_key(0, { 100 }));
+    create(*r, "test_shard", "id INTEGER, name TEXT");
+    for (std::int64_t id : { 5, 50, 150, 250 }) insert(*r, "test_shard", id, "s" + std::to_string(id));
+    check(shard_count("test_shard0.db") == 2 && shard_count("test_shard1.db") == 2, "range_key routes by bind");
+    auto q = r->query("SELECT name FROM test_shard WHERE id = ?;");
+    (*q) << values(150);
+    size_t found = 0;
+    for (auto& row : q->execute()) found += row["name"] == std::string("s150");
+    check(found == 1, "keyed read runs on its shard");
+    std::string ids;
+    for (auto& row : r->query("SELECT id FROM test_shard ORDER BY id DESC;", "id", true)->execute()) {
+        ids += row[size_t(0)].toString() + " ";
+    }
+    check(ids == "250 150 50 5 ", "scatter-gather rows are merged in order");
+    check(r->query("DELETE FROM test_shard;")->execute().result() == SQL_IMPROPER && count(*r, "test_shard") == 2,
+          "keyless write fails");
+
+    r = sqlxx::shard_router::create(open(), sqlxx::shard_router::hash_key(0));
+    create(*r, "test_shard", "id INTEGER, name TEXT");
+    for (std::int64_t id = 0; id < 20; ++id) insert(*r, "test_shard", id, "h");
+    std::int64_t total = 0;
+    for (auto& row : r->query("SELECT count(*) FROM test_shard;")->execute()) total += std::int64_t(row[size_t(0)]);
+    check(total == 20 && shard_count("test_shard0.db") > 0 && shard_count("test_shard1.db") > 0,
+          "hash_key spreads rows over shards");
+    r.reset();
+    for (auto path : { "test_shard0.db", "test_shard1.db" }) std::remove(path);
+}
+
+void test_ops(sqlxx::connection& con) {
+    fill_ops(con);
+    fill_names(con);
+    for (size_t budget : { size_t(64) << 20, size_t(64) }) {
+        auto joined = sqlxx::hash_join(con.query("SELECT id, name FROM test_names;")->execute(),
+                                       con.query("SELECT id, score FROM test_ops;")->execute(),
+                                       sqlxx::join_keys{ { "id", "id" } }, budget);
+        size_t rows = 0;
+        bool matched = true;
+        for (auto const& row : joined) {
+            ++rows;
+            matched = matched && row.size() == 4 && row[size_t(0)] == row[size_t(2)];
+        }
+        check(rows == 50 && matched, budget > 64 ? "hash_join in memory" : "hash_join spilled");
+    }
+    auto groups = sqlxx::group_by(con.query("SELECT id, name, score FROM test_ops;")->execute(), {"name"},
+                                  { sqlxx::aggregate::count(), sqlxx::aggregate::sum("id").as("ids") });
+    size_t rows = 0;
+    bool counted = true;
+    for (auto const& row : groups) {
+        ++rows;
+        counted = counted && std::int64_t(row["count(*)"]) == 50;
+        counted = counted && std::int64_t(row["ids"]) == (row["name"] == std::string("odd") ? 250 : 200);
+    }
+    check(rows == 2 && counted, "group_by counts and sums groups");
+}
+
+void test_spill(sqlxx::connection& con) {
+    fill_ops(con);
+    auto all = con.query("SELECT id, name, score FROM test_ops;")->execute();
+    sqlxx::spilling_result spilled(all, 1 << 10);
+    std::int64_t sum = 0;
+    for (auto const& row : spilled) sum += std::int64_t(row[size_t(0)]);
+    check(spilled.good() && spilled.spilled() && spilled.size() == 100 && sum == 450,
+          "spilling_result keeps all rows over its budget");
+    check(spilled[99]["name"] == std::string("odd") && spilled[100].empty(), "spilling_result by index");
+}
+
+void test_snapshot(sqlxx::connection& con) {
+    fill_ops(con);
+    auto cur = con.query("SELECT id, name, score FROM test_ops;")->execute();
+    check(sqlxx::snapshot_writer::write("test.snap", cur), "snapshot is written");
+    auto snap = sqlxx::snapshot::open("test.snap");
+    check(!!snap, "snapshot opens");
+    if (snap) {
+        std::int64_t sum = 0;
+        for (auto const& row : *snap) sum += row["id"].integer();
+        check(snap->size() == 100 && sum == 450 && (*snap)[99]["name"].text() == "odd"
+              && (*snap)[99]["score"].real() == 0.5, "snapshot reads back the rows");
+        check((*snap)[100]["id"].type() == SQL_INVALID && (*snap)[100].to_row().empty(),
+              "snapshot row out of range is empty");
+        check(snap->load().size() == 100, "snapshot loads a result");
+    }
+    std::remove("test.snap");
+}
+
+void test_export(sqlxx::connection& con) {
+    fill_names(con);
+    std::ostringstream csv;
+    auto stats = sqlxx::export_csv(con.query("SELECT id, name FROM test_names WHERE id < 2 ORDER BY id;")->execute(), csv);
+    check(stats.ok && stats.rows == 2 && csv.str() == "id,name\n0,n0\n1,n1\n", "export_csv");
+    std::ostringstream jsonl;
+    sqlxx::export_jsonl(con.query("SELECT id, name FROM test_names WHERE id < 2 ORDER BY id;")->execute(), jsonl);
+    check(jsonl.str() == "{\"id\":0,\"name\":\"n0\"}\n{\"id\":1,\"name\":\"n1\"}\n", "export_jsonl writes a line per row");
+}
+
+void test_import(sqlxx::connection& con) {
+    fill_names(con);
+    {
+        std::ofstream csv("test.csv");
+        sqlxx::export_csv(con.query("SELECT id, name FROM test_names ORDER BY id;")->execute(), csv);
+        csv << "5,\n6,\"a,\"\"b\"\n";
+    }
+    create(con, "test_csv", "id INTEGER, name TEXT");
+    sqlxx::import_options options;
+    options.threads = 2;
+    auto imported = sqlxx::import_csv(con, "test_csv", "test.csv", options);
+    std::string names;
+    for (auto& row : con.query("SELECT name FROM test_csv ORDER BY id;")->execute()) {
+        names += row[size_t(0)].type() == SQL_NULL ? "NULL" : row[size_t(0)].toString();
+    }
+    check(imported.ok && imported.rows == 7 && names == "n0n1n2n3n4NULLa,\"b", "CSV round trip");
+    std::remove("test.csv");
+}
+
+// copy into a SQLite file in batches of 7 rows, at most 2 batches in flight
+void test_copy(sqlxx::connection& con) {
+    fill_ops(con);
+    std::remove("test_copy.db");
+    auto dst = sqlitexx::connection::create("test_copy.db");
+    sqlxx::copy_options options;
+    options.batch_rows = 7;
+    options.queue_batches = 2;
+    size_t batches = 0;
+    bool steps = true;
+    options.progress = [&](sqlxx::copy_progress const& progress) {
+        steps = steps && progress.rows == std::min<std::uint64_t>(++batches * 7, 100);
+    };
+    auto stats = sqlxx::copy_table(con, *dst, "SELECT id, name, score FROM test_ops", "test_copied", options);
+    check(stats.ok && stats.rows == 100 && batches == 15 && steps, "copy_table copies in batches");
+    check(count(*dst, "test_copied") == 100, "copy_table rows are committed");
+    std::string types;
+    for (auto& row : dst->query("SELECT typeof(id), typeof(name), typeof(score) FROM test_copied LIMIT 1;")->execute()) {
+        for (auto const& f : row) types += f.toString() + " ";
+    }
+    check(types == "integer text real ", "copy_table creates typed columns");
+    stats = sqlxx::copy_table(con, *dst, "SELECT nothing FROM test_ops", "test_copied", options);
+    check(!stats.ok && stats.result != SQL_OK, "copy_table reports a failed source");
+    dst.reset();
+    std::remove("test_copy.db");
+}
+
+// placeholders of SQL literals are counted outside of quotes at compile time
+static_assert(sqlxx::sql_binds("SELECT ?, '?'", 0, sizeof("SELECT ?, '?'") - 1) == 1, "quoted ? is no bind");
+static_assert(sqlxx::sql_binds("SELECT 'it''s ?', ? WHERE ? = 1", 0,
+                               sizeof("SELECT 'it''s ?', ? WHERE ? = 1") - 1) == 2, "doubled quote stays quoted");
+
+void test_sql(sqlxx::connection& con) {
+    fill_names(con);
+    auto const& sql = SQLXX_SQL("SELECT name, '?', 'it''s' FROM test_names WHERE id = ?;");
+    static_assert(std::decay<decltype(sql)>::type::binds == 1, "SQLXX_SQL counts binds");
+    std::string text;
+    for (auto& row : sqlxx::execute(con, sql, 3)) {
+        for (auto const& f : row) text += f.toString() + " ";
+    }
+    check(text == "n3 ? it's ", "execute sends the literal as written");
+    auto cur = sqlxx::execute(con, SQLXX_SQL("SELECT count(*) FROM test_names WHERE id < ? AND name <> ?;"),
+                              3, std::string("n1"));
+    for (auto& row : cur) check(std::int64_t(row[size_t(0)]) == 2, "execute binds every argument");
+}
+
+void test_bind_ref(sqlxx::connection& con) {
+    create(con, "test_ref", "id INTEGER, name TEXT, data BLOB");
+    std::string big(1 << 20, 'r');
+    blob bytes(1000, 0x5a);
+    auto q = con.query("INSERT INTO test_ref (id, name, data) VALUES (?, ?, ?);");
+    (*q) << values_ref(std::int64_t(1), big, bytes);
+    check(q->execute().result() == SQL_OK, "values_ref binds by reference");
+    for (auto& row : con.query("SELECT name, data FROM test_ref;")->execute()) {
+        check(row["name"].size() == big.size() && row["data"].size() == bytes.size(), "referenced binds are written");
+    }
+    std::string text = "abc";
+    sqlxx::field_type field(bind_ref(text), "");
+    auto copy = field;
+    text[0] = 'x';
+    check(field.is_ref() && field.toString() == "xbc" && !copy.is_ref() && copy.toString() == "abc",
+          "copy of a referenced field owns its bytes");
+    auto moved = std::move(field);
+    check(moved.is_ref(), "move of a referenced field shares its bytes");
+    std::string const& owned = moved;
+    text[0] = 'y';
+    check(owned == "xbc" && !moved.is_ref(), "string of a referenced field is a copy");
+}
+
+void test_execute_many(sqlxx::connection& con) {
+    create(con, "test_many", "id INTEGER, name TEXT");
+    std::vector<std::tuple<std::int64_t, std::string>> sets;
+    for (std::int64_t i = 0; i < 100; ++i) sets.emplace_back(i, "m" + std::to_string(i));
+    auto result = con.query("INSERT INTO test_many (id, name) VALUES (?, ?);")->execute_many(sets, true);
+    check(result.result == SQL_OK && result.executed == 100 && result.affected_rows == 100
+          && result.affected.size() == 100, "execute_many runs every set");
+    check(count(con, "test_many") == 100, "execute_many rows are committed");
+}
+
+void test_write_buffer(sqlxx::connection& con) {
+    create(con, "test_write", "id INTEGER PRIMARY KEY, name TEXT");
+    sqlxx::write_options options;
+    options.max_delay = std::chrono::milliseconds(1000);
+    {
+        sqlxx::write_buffer writes(con, options);
+        for (std::int64_t id = 0; id < 10; ++id) writes.write("INSERT INTO test_write (id, name) VALUES (?, ?);", id, "w");
+        auto ack = writes.write_acked("INSERT INTO test_write (id, name) VALUES (?, 'x');", 10);
+        writes.flush();
+        auto stats = writes.stats();
+        check(ack.get() == SQL_OK && count(con, "test_write") == 11, "flush waits for queued writes");
+        check(stats.writes == 11 && stats.commits == 2 && stats.failed == 0, "writes are grouped by statement text");
+
+        auto first = writes.write_acked("INSERT INTO test_write (id, name) VALUES (?, ?);", 20, "a");
+        auto duplicate = writes.write_acked("INSERT INTO test_write (id, name) VALUES (?, ?);", 1, "b");
+        auto last = writes.write_acked("INSERT INTO test_write (id, name) VALUES (?, ?);", 21, "c");
+        writes.write("INSERT INTO test_write (id, name) VALUES (?, ?);", 22, "d");
+        writes.flush();
+        check(first.get() == SQL_OK && duplicate.get() != SQL_OK && last.get() == SQL_OK,
+              "failed write is acked alone");
+        check(count(con, "test_write") == 14 && writes.stats().failed == 1, "other writes of a failed group commit");
+        writes.write("INSERT INTO test_write (id, name) VALUES (?, ?);", 30, "e");
+    }
+    check(count(con, "test_write") == 15, "destructor writes what is queued");
+}
+
+void test_savepoints(sqlxx::connection& con) {
+    create(con, "test_tx", "id INTEGER, name TEXT");
+    {
+        sqlxx::transaction outer(con);
+        insert(con, "test_tx", 1, "a");
+        {
+            sqlxx::transaction inner(con);
+            check(inner.level() == 2, "nested transaction is a savepoint");
+            insert(con, "test_tx", 2, "b");
+        }
+        check(count(con, "test_tx") == 1, "savepoint without commit is rolled back");
+        {
+            sqlxx::transaction inner(con);
+            insert(con, "test_tx", 3, "c");
+            inner.commit();
+        }
+        check(outer.commit() && count(con, "test_tx") == 2, "committed savepoint is kept");
+    }
+    {
+        sqlxx::transaction outer(con);
+        insert(con, "test_tx", 4, "d");
+    }
+    check(count(con, "test_tx") == 2, "transaction without commit is rolled back");
+}
+
+void test_run_transaction(sqlxx::connection& con) {
+    create(con, "test_tx", "id INTEGER, name TEXT");
+    sqlxx::transaction_metrics metrics;
+    sqlxx::retry_policy policy;
+    policy.metrics = &metrics;
+    policy.delays.initial = std::chrono::milliseconds(1);
+    int runs = 0;
+    auto result = sqlxx::run_transaction(con, [&runs](sqlxx::connection& c) {
+        insert(c, "test_tx", runs, "e");
+        return ++runs == 1 ? SQL_BUSY : SQL_OK;
+    }, policy);
+    check(result == SQL_OK && runs == 2 && metrics.retries == 1 && metrics.busy == 1,
+          "run_transaction retries a busy run");
+    check(count(con, "test_tx") == 1, "run_transaction rolls back the busy run");
+    result = sqlxx::run_transaction(con, [](sqlxx::connection&) { return SQL_UNKNOWN_ERROR; }, policy);
+    check(result == SQL_UNKNOWN_ERROR && metrics.retries == 1, "run_transaction does not retry errors");
+}
+
+void test_paginate(sqlxx::connection& con) {
+    create(con, "test_page", "id INTEGER, name TEXT");
+    for (std::int64_t id = 0; id < 35; ++id) insert(con, "test_page", id, "p" + std::to_string(id));
+    auto pages = sqlxx::paginate(con, "SELECT id, name FROM test_page WHERE id >= ?", {"id"}, 10,
+                                 { sqlxx::field_type(std::int64_t(10), "") });
+    std::int64_t previous = 0, sum = 0;
+    size_t rows = 0, full = 0;
+    bool ordered = true;
+    while (!pages.done()) {
+        size_t in_page = 0;
+        for (auto& row : pages.next()) {
+            std::int64_t id = row["id"];
+            ordered = ordered && id > previous;
+            previous = id;
+            sum += id;
+            ++in_page;
+        }
+        rows += in_page;
+        full += in_page == 10;
+    }
+    check(ordered && rows == 25 && full == 2 && sum == 25 * 22, "paginate reads every row once in key order");
+    pages = sqlxx::paginate(con, "SELECT id, name FROM test_page", {"id"}, 10);
+    for (auto& row : pages.next()) {
+        (void)row;
+        break;
+    }
+    auto second = pages.next();
+    check(second.begin() != second.end() && std::int64_t((*second.begin())["id"]) == 10,
+          "paginate continues after a half read page");
+}
+
+void test_lazy(sqlxx::connection& con) {
+    fill_names(con);
+    auto q = con.query("SELECT id, name FROM test_names WHERE id < ? ORDER BY id;");
+    (*q) << values(4);
+    q->lazy();
+    std::vector<sqlxx::row> kept;
+    bool lazy = true;
+    for (auto& row : q->execute()) {
+        lazy = lazy && row.is_lazy();
+        kept.push_back(row);
+    }
+    check(kept.size() == 4 && lazy, "lazy rows are not decoded");
+    check(kept[1]["name"] == std::string("n1") && std::int64_t(kept[3]["id"]) == 3,
+          "lazy rows outlive the step that read them");
+}
+
+void test_projector(sqlxx::pool::factory open) {
+    auto p = sqlxx::projector::create(open());
+    fill_ops(*p);
+    // rows of a run are read on another thread
+    auto run = [&p](char const* text, char const* column) {
+        std::vector<sqlxx::row> rows;
+        for (auto& row : p->query(text)->execute()) rows.push_back(row);
+        size_t valid = 0;
+        std::thread reader([&rows, &valid, column]() {
+            for (auto const& row : rows) valid += row[column].type() != SQL_INVALID;
+        });
+        reader.join();
+        return valid;
+    };
+    auto report = [&p]() { return p->reports().front(); };
+    run("SELECT * FROM test_ops WHERE id = 1", "name");
+    run("SELECT * FROM test_ops WHERE id = 2", "name");
+    auto learned = report();
+    check(p->reports().size() == 1 && learned.executions == 2 && learned.rows == 20 && learned.columns.size() == 3
+          && learned.read == std::vector<std::string>{ "name" } && learned.wasted > 0 && !learned.rewrite,
+          "projector reports columns read and bytes wasted");
+    p->rewrite("SELECT * FROM test_ops WHERE id = 3");
+    check(report().rewrite && run("SELECT * FROM test_ops WHERE id = 3", "name") == 10,
+          "rewritten SELECT * reads the columns learned");
+    check(run("SELECT * FROM test_ops WHERE id = 4", "id") == 0 && report().misses == 10 && !report().rewrite,
+          "trimmed column reads as invalid and stops the rewrite");
+    check(run("SELECT * FROM test_ops WHERE id = 5", "id") == 10 && report().rewrite
+          && report().read.size() == 2, "whole run after a miss learns the column");
+    check(run("SELECT * FROM test_ops WHERE id = 6", "id") == 10, "rewrite runs again after it is learned");
+}
+
+struct sum_squares {
+    std::int64_t total = 0;
+    void step(std::int64_t x) { total += x * x; }
+    std::int64_t value() const { return total; }
+};
+
+void test_functions(sqlitexx::connection& con) {
+    fill_names(con);
+    check(con.create_function("twice", [](std::int64_t x) { return 2 * x; }), "create_function");
+    check(con.create_aggregate<sum_squares>("sum_squares"), "create_aggregate");
+    auto q = con.query("SELECT twice(id), sum_squares(id) FROM test_names WHERE id = ?;");
+    (*q) << values(3);
+    for (auto& row : q->execute()) {
+        check(std::int64_t(row[size_t(0)]) == 6 && std::int64_t(row[size_t(1)]) == 9, "functions run in SQLite");
+    }
+    for (auto& row : con.query("SELECT sum_squares(id) FROM test_names;")->execute()) {
+        check(std::int64_t(row[size_t(0)]) == 30, "aggregate over all rows");
+    }
+}
+
+void test_vtab(sqlitexx::connection& con) {
+    auto items = std::make_shared<std::vector<std::tuple<std::int64_t, std::string>>>();
+    for (std::int64_t i = 0; i < 100; ++i) items->emplace_back((i * 37) % 100, "i" + std::to_string(i));
+    check(con.register_vtab("test_items", items, {"id", "name"}, {"id"}), "register_vtab");
+    auto q = con.query("SELECT name FROM test_items WHERE id = ?;");
+    (*q) << values(37);
+    size_t rows = 0;
+    for (auto& row : q->execute()) rows += row[size_t(0)] == std::string("i1");
+    check(rows == 1, "vtab equality lookup");
+    q = con.query("SELECT count(*) FROM test_items WHERE id >= ? AND id < ?;");
+    (*q) << values(10, 20);
+    for (auto& row : q->execute()) check(std::int64_t(row[size_t(0)]) == 10, "vtab range");
+    std::string ids;
+    for (auto& row : con.query("SELECT id FROM test_items ORDER BY id DESC LIMIT 3;")->execute()) {
+        ids += row[size_t(0)].toString() + " ";
+    }
+    check(ids == "99 98 97 ", "vtab ORDER BY");
+}
+
+void test_backup(sqlitexx::connection& con) {
+    fill_ops(con);
+    std::remove("test_backup.db");
+    check(con.backup_to("test_backup.db", 1) == SQL_OK, "backup_to file");
+    auto memory = sqlitexx::connection::load_into_memory("test_backup.db");
+    check(memory && count(*memory, "test_ops") == 100, "load_into_memory reads the backup");
+    auto copy = sqlitexx::connection::create(":memory:");
+    check(con.backup_to(static_cast<sqlitexx::connection&>(*copy)) == SQL_OK && count(*copy, "test_ops") == 100,
+          "backup_to connection");
+    std::remove("test_backup.db");
+}
+
+std::int64_t autocheckpoint(sqlxx::connection& con) {
+    for (auto& row : con.query("PRAGMA wal_autocheckpoint;")->execute()) {
+        return row[size_t(0)];
+    }
+    return -1;
+}
+
+void test_checkpointer() {
+    std::remove("test_wal.db");
+    auto con = sqlitexx::connection::create("test_wal.db");
+    auto& lite = static_cast<sqlitexx::connection&>(*con);
+    for (auto& row : con->query("PRAGMA journal_mode=WAL;")->execute()) (void)row;
+    sqlitexx::checkpoint_options options;
+    options.interval = std::chrono::milliseconds(10);
+    {
+        auto wal = lite.background_checkpoints(options);
+        check(wal != nullptr, "background_checkpoints on a file");
+        check(autocheckpoint(*con) == 0, "auto-checkpoint off while the checkpointer runs");
+        fill_ops(*con);
+        wal->wake();
+        for (int i = 0; i < 100 && wal->stats().checkpoints == 0; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        check(wal->stats().checkpoints > 0, "checkpointer counts PASSIVE checkpoints");
+    }
+    check(autocheckpoint(*con) == 1000, "auto-checkpoint restored after the checkpointer");
+    auto wal = lite.background_checkpoints(options);
+    con.reset();
+    wal.reset();
+    check(true, "checkpointer outlives its connection");
+    auto memory = sqlitexx::connection::create(":memory:");
+    check(!static_cast<sqlitexx::connection&>(*memory).background_checkpoints(), "no checkpointer in memory");
+    std::remove("test_wal.db");
+    std::remove("test_wal.db-wal");
+    std::remove("test_wal.db-shm");
+}
+
+void test_sharded_connection() {
+    std::vector<std::string> paths;
+    for (auto i : { "0", "1" }) {
+        paths.push_back(std::string("test_sharded.db.") + i);
+        std::remove(paths.back().c_str());
+    }
+    auto con = sqlitexx::sharded_connection::create("test_sharded.db", 2, sqlxx::shard_router::hash_key(0));
+    check(con && con->size() == 2, "sharded_connection opens its shards");
+    create(*con, "test_sharded", "id INTEGER, name TEXT");
+    for (std::int64_t id = 0; id < 20; ++id) con->write("INSERT INTO test_sharded (id, name) VALUES (?, 'it''s');", id);
+    con->write("DELETE FROM test_sharded;");
+    check(con->write_acked("DELETE FROM test_sharded;").get() == SQL_IMPROPER, "keyless acked write fails");
+    con->flush();
+    auto in_shard = [&con](size_t i, std::string const& name) {
+        auto q = con->shard(i).query("SELECT count(*) FROM test_sharded WHERE name = ?;");
+        (*q) << values(name);
+        for (auto& row : q->execute()) return std::int64_t(row[size_t(0)]);
+        return std::int64_t(-1);
+    };
+    check(in_shard(0, "it's") > 0 && in_shard(1, "it's") > 0 && in_shard(0, "it's") + in_shard(1, "it's") == 20,
+          "writes go to their shard with the text as written");
+    auto stats = con->stats();
+    check(stats.writes == 22 && stats.failed == 2, "keyless writes are counted failed");
+
+    auto load = con->bulk("test_sharded", { "id", "name" });
+    for (std::int64_t id = 0; id < 2000; ++id) {
+        if (!load->write({ sqlxx::bind_field(id), sqlxx::bind_field(std::string("bulk")) })) break;
+    }
+    check(load->finish(), "parallel_insert finishes");
+    check(in_shard(0, "bulk") + in_shard(1, "bulk") == 2000, "parallel_insert loads every row");
+    size_t same = 0;
+    for (size_t i = 0; i < con->size(); ++i) {
+        auto q = con->shard(i).query("SELECT count(*) FROM test_sharded a JOIN test_sharded b"
+                                     " ON a.id = b.id AND a.name = ? AND b.name = ?;");
+        (*q) << values(std::string("it's"), std::string("bulk"));
+        for (auto& row : q->execute()) same += size_t(std::int64_t(row[size_t(0)]));
+    }
+    check(same == 20, "bulk routes by column as write by bind");
+    auto keyless = con->bulk("test_sharded", { "id", "name" });
+    check(!keyless->write({ sqlxx::field_type("id"), sqlxx::bind_field(std::string("x")) }) && !keyless->finish(),
+          "keyless bulk row fails");
+    keyless.reset();
+    load.reset();
+    con.reset();
+    for (auto& path : paths) std::remove(path.c_str());
+}
+
 void usage() {
     std::cout << "options: SQLITE|MYSQL|PQSQL\n";
     std::cout << "sub options: SQLITE {db}|MYSQL {host, user, pass, db}|PQSQL {conninfo}\n";
@@ -69,5 +715,29 @@ int main(int argc, char *argv[])
         worker->join();
         delete worker;
     }
-    return 0;
+    test_pool(*con, db_connect);
+    if (type != "SQLITE") test_reconnect(*con, db_connect, type);
+    if (type == "SQLITE") test_router();
+    if (type == "SQLITE") test_shard_router();
+    test_ops(*con);
+    test_spill(*con);
+    test_snapshot(*con);
+    test_export(*con);
+    test_import(*con);
+    test_copy(*con);
+    test_sql(*con);
+    test_bind_ref(*con);
+    test_execute_many(*con);
+    test_write_buffer(*con);
+    test_savepoints(*con);
+    test_run_transaction(*con);
+    test_paginate(*con);
+    test_lazy(*con);
+    test_projector(db_connect);
+    if (type == "SQLITE") test_functions(static_cast<sqlitexx::connection&>(*con));
+    if (type == "SQLITE") test_vtab(static_cast<sqlitexx::connection&>(*con));
+    if (type == "SQLITE") test_backup(static_cast<sqlitexx::connection&>(*con));
+    if (type == "SQLITE") test_checkpointer();
+    if (type == "SQLITE") test_sharded_connection();
+    return failures ? 1 : 0;
 }